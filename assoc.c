@@ -59,15 +59,45 @@ static bool started_expanding = false;
  */
 static unsigned int expand_bucket = 0;
 
+/* The table is large and read at random, so it gets the same huge page and
+ * NUMA placement as the item-cache. Interleaving needs a mapping of its own,
+ * as mbind() would also move whatever shares its first and last page. */
+static item **hashtable_alloc(const unsigned int power) {
+    size_t size = hashsize(power) * sizeof(void *);
+    item **table;
+
+    if (settings.numa_interleave) {
+        if ((table = mem_map(size)) != NULL)
+            mem_interleave(table, size);
+    } else {
+        table = calloc(hashsize(power), sizeof(void *));
+    }
+    if (table != NULL && settings.large_pages)
+        mem_advise_large(table, size);
+    return table;
+}
+
+static void hashtable_free(item **table, const unsigned int power) {
+    if (settings.numa_interleave)
+        mem_unmap(table, hashsize(power) * sizeof(void *));
+    else
+        free(table);
+}
+
 void assoc_init(const int hashtable_init) {
     if (hashtable_init) {
         hashpower = hashtable_init;
     }
-    primary_hashtable = calloc(hashsize(hashpower), sizeof(void *));
+    primary_hashtable = hashtable_alloc(hashpower);
     if (! primary_hashtable) {
         fprintf(stderr, "Failed to init hashtable.\n");
         exit(EXIT_FAILURE);
     }
+    if (settings.prefault_threads) {
+        mem_prefault(primary_hashtable, hashsize(hashpower) * sizeof(void *),
+                     settings.prefault_threads,
+                     settings.verbose > 0 ? "hash table" : NULL);
+    }
     STATS_LOCK();
     stats.hash_power_level = hashpower;
     stats.hash_bytes = hashsize(hashpower) * sizeof(void *);
@@ -93,39 +123,31 @@ item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
             ret = it;
             break;
         }
-        it = it->h_next;
+        it = ITEM_h_next(it);
         ++depth;
     }
     MEMCACHED_ASSOC_FIND(key, nkey, depth);
     return ret;
 }
 
-/* returns the address of the item pointer before the key.  if *item == 0,
-   the item wasn't found */
+/* returns the address of the bucket the key hashes to. */
 
-static item** _hashitem_before (const char *key, const size_t nkey, const uint32_t hv) {
-    item **pos;
+static item** _hashitem_bucket (const uint32_t hv) {
     unsigned int oldbucket;
 
     if (expanding &&
         (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
     {
-        pos = &old_hashtable[oldbucket];
-    } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
+        return &old_hashtable[oldbucket];
     }
-
-    while (*pos && ((nkey != (*pos)->nkey) || memcmp(key, ITEM_key(*pos), nkey))) {
-        pos = &(*pos)->h_next;
-    }
-    return pos;
+    return &primary_hashtable[hv & hashmask(hashpower)];
 }
 
 /* grows the hashtable to the next power of 2. */
 static void assoc_expand(void) {
     old_hashtable = primary_hashtable;
 
-    primary_hashtable = calloc(hashsize(hashpower + 1), sizeof(void *));
+    primary_hashtable = hashtable_alloc(hashpower + 1);
     if (primary_hashtable) {
         if (settings.verbose > 1)
             fprintf(stderr, "Hash table expansion starting\n");
@@ -159,10 +181,10 @@ int assoc_insert(item *it, const uint32_t hv) {
     if (expanding &&
         (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
     {
-        it->h_next = old_hashtable[oldbucket];
+        ITEM_set_h_next(it, old_hashtable[oldbucket]);
         old_hashtable[oldbucket] = it;
     } else {
-        it->h_next = primary_hashtable[hv & hashmask(hashpower)];
+        ITEM_set_h_next(it, primary_hashtable[hv & hashmask(hashpower)]);
         primary_hashtable[hv & hashmask(hashpower)] = it;
     }
 
@@ -176,23 +198,33 @@ int assoc_insert(item *it, const uint32_t hv) {
 }
 
 void assoc_delete(const char *key, const size_t nkey, const uint32_t hv) {
-    item **before = _hashitem_before(key, nkey, hv);
+    item **bucket = _hashitem_bucket(hv);
+    item *before = NULL;
+    item *it = *bucket;
+
+    /* Chain links may be arena offsets, so walk with the previous item
+     * rather than the address of its link. */
+    while (it && ((nkey != it->nkey) || memcmp(key, ITEM_key(it), nkey))) {
+        before = it;
+        it = ITEM_h_next(it);
+    }
 
-    if (*before) {
-        item *nxt;
+    if (it) {
         hash_items--;
         /* The DTrace probe cannot be triggered as the last instruction
          * due to possible tail-optimization by the compiler
          */
         MEMCACHED_ASSOC_DELETE(key, nkey, hash_items);
-        nxt = (*before)->h_next;
-        (*before)->h_next = 0;   /* probably pointless, but whatever. */
-        *before = nxt;
+        if (before)
+            ITEM_set_h_next(before, ITEM_h_next(it));
+        else
+            *bucket = ITEM_h_next(it);
+        ITEM_set_h_next(it, 0);   /* probably pointless, but whatever. */
         return;
     }
     /* Note:  we never actually get here.  the callers don't delete things
        they can't find. */
-    assert(*before != 0);
+    assert(it != 0);
 }
 
 
@@ -209,17 +241,17 @@ static void *assoc_maintenance_thread(void *arg) {
         /* Lock the cache, and bulk move multiple buckets to the new
          * hash table. */
         item_lock_global();
-        mutex_lock(&cache_lock);
+        CACHE_LOCK();
 
         for (ii = 0; ii < hash_bulk_move && expanding; ++ii) {
             item *it, *next;
             int bucket;
 
             for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
-                next = it->h_next;
+                next = ITEM_h_next(it);
 
                 bucket = hash(ITEM_key(it), it->nkey) & hashmask(hashpower);
-                it->h_next = primary_hashtable[bucket];
+                ITEM_set_h_next(it, primary_hashtable[bucket]);
                 primary_hashtable[bucket] = it;
             }
 
@@ -228,7 +260,7 @@ static void *assoc_maintenance_thread(void *arg) {
             expand_bucket++;
             if (expand_bucket == hashsize(hashpower - 1)) {
                 expanding = false;
-                free(old_hashtable);
+                hashtable_free(old_hashtable, hashpower - 1);
                 STATS_LOCK();
                 stats.hash_bytes -= hashsize(hashpower - 1) * sizeof(void *);
                 stats.hash_is_expanding = 0;
@@ -238,7 +270,7 @@ static void *assoc_maintenance_thread(void *arg) {
             }
         }
 
-        mutex_unlock(&cache_lock);
+        CACHE_UNLOCK();
         item_unlock_global();
 
         if (!expanding) {
@@ -246,16 +278,17 @@ static void *assoc_maintenance_thread(void *arg) {
             switch_item_lock_type(ITEM_LOCK_GRANULAR);
             slabs_rebalancer_resume();
             /* We are done expanding.. just wait for next invocation */
-            mutex_lock(&cache_lock);
+            CACHE_LOCK();
             started_expanding = false;
-            pthread_cond_wait(&maintenance_cond, &cache_lock);
+            lockprof_cond_wait(&maintenance_cond, &cache_lock,
+                               LOCKPROF_CACHE_LOCK, NULL);
             /* Before doing anything, tell threads to use a global lock */
-            mutex_unlock(&cache_lock);
+            CACHE_UNLOCK();
             slabs_rebalancer_pause();
             switch_item_lock_type(ITEM_LOCK_GLOBAL);
-            mutex_lock(&cache_lock);
+            CACHE_LOCK();
             assoc_expand();
-            mutex_unlock(&cache_lock);
+            CACHE_UNLOCK();
         }
     }
     return NULL;
@@ -281,10 +314,10 @@ int start_assoc_maintenance_thread() {
 }
 
 void stop_assoc_maintenance_thread() {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_run_maintenance_thread = 0;
     pthread_cond_signal(&maintenance_cond);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 
     /* Wait for the maintenance thread to stop */
     pthread_join(maintenance_tid, NULL);
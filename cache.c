@@ -8,6 +8,7 @@
 #endif
 
 #include "cache.h"
+#include "lockprof.h"
 
 #ifndef NDEBUG
 const uint64_t redzone_pattern = 0xdeadbeefcafebabe;
@@ -71,7 +72,8 @@ void cache_destroy(cache_t *cache) {
 void* cache_alloc(cache_t *cache) {
     void *ret;
     void *object;
-    pthread_mutex_lock(&cache->mutex);
+    lockprof_lock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at,
+                  false);
     if (cache->freecurr > 0) {
         ret = cache->ptr[--cache->freecurr];
         object = get_object(ret);
@@ -87,7 +89,7 @@ void* cache_alloc(cache_t *cache) {
             }
         }
     }
-    pthread_mutex_unlock(&cache->mutex);
+    lockprof_unlock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at);
 
 #ifndef NDEBUG
     if (object != NULL) {
@@ -104,7 +106,8 @@ void* cache_alloc(cache_t *cache) {
 }
 
 void cache_free(cache_t *cache, void *ptr) {
-    pthread_mutex_lock(&cache->mutex);
+    lockprof_lock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at,
+                  false);
 
 #ifndef NDEBUG
     /* validate redzone... */
@@ -112,7 +115,7 @@ void cache_free(cache_t *cache, void *ptr) {
                &redzone_pattern, sizeof(redzone_pattern)) != 0) {
         raise(SIGABRT);
         cache_error = 1;
-        pthread_mutex_unlock(&cache->mutex);
+        lockprof_unlock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at);
         return;
     }
     uint64_t *pre = ptr;
@@ -120,7 +123,7 @@ void cache_free(cache_t *cache, void *ptr) {
     if (*pre != redzone_pattern) {
         raise(SIGABRT);
         cache_error = -1;
-        pthread_mutex_unlock(&cache->mutex);
+        lockprof_unlock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at);
         return;
     }
     ptr = pre;
@@ -143,6 +146,6 @@ void cache_free(cache_t *cache, void *ptr) {
 
         }
     }
-    pthread_mutex_unlock(&cache->mutex);
+    lockprof_unlock(&cache->mutex, LOCKPROF_CACHE_T, &cache->locked_at);
 }
 
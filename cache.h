@@ -2,6 +2,7 @@
 #ifndef CACHE_H
 #define CACHE_H
 #include <pthread.h>
+#include <stdint.h>
 
 #ifdef HAVE_UMEM_H
 #include <umem.h>
@@ -60,6 +61,8 @@ typedef struct {
     cache_constructor_t* constructor;
     /** The destructor to be called each time before we release memory */
     cache_destructor_t* destructor;
+    /** When the mutex was taken, for the lock profiler */
+    uint64_t locked_at;
 } cache_t;
 
 /**
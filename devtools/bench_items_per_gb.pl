@@ -0,0 +1,49 @@
+#! /usr/bin/perl
+#
+# Fills a server with small items until it starts evicting, then reports
+# how many items a gigabyte of cache holds. Compare a default build with
+# one configured with --enable-compact-items, started with the same -m.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 2
+    or die "Usage: $FindBin::Script HOST:PORT [VALUE_BYTES]\n";
+
+my $addr = $ARGV[0];
+my $len = defined $ARGV[1] ? $ARGV[1] : 10;
+my $batch = 10_000;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+sub stats {
+    my %stats;
+    print $sock "stats\r\n";
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        $stats{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return \%stats;
+}
+
+my $val = 'x' x $len;
+my $stored = 0;
+my $stats = stats();
+while ($stats->{evictions} == 0) {
+    foreach my $i ($stored + 1 .. $stored + $batch) {
+        print $sock "set key$i 0 0 $len noreply\r\n$val\r\n";
+    }
+    $stored += $batch;
+    $stats = stats();
+}
+
+my $gb = $stats->{limit_maxbytes} / (1024 * 1024 * 1024);
+printf("%d byte values, %d keys stored, %d held in %d MB\n",
+       $len, $stored, $stats->{curr_items},
+       $stats->{limit_maxbytes} / (1024 * 1024));
+printf("%.0f items per GB\n", $stats->{curr_items} / $gb);
@@ -0,0 +1,50 @@
+#! /usr/bin/perl
+#
+# Random multi-gets over a keyspace much larger than the TLB covers, so the
+# cost of page walks on the hash table and item memory shows up. Compare a
+# server started with and without -L (and -o numa_interleave).
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 3
+    or die "Usage: $FindBin::Script HOST:PORT [KEYS] [GETS]\n";
+
+my $addr = $ARGV[0];
+my $keys = $ARGV[1] || 1_000_000;
+my $gets = $ARGV[2] || 2_000_000;
+my $batch = 100;
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                 Timeout  => 3);
+die "$!\n" unless $sock;
+
+my $start = [gettimeofday];
+foreach my $i (1 .. $keys) {
+    print $sock "set key$i 0 0 10 noreply\r\n0123456789\r\n";
+}
+print $sock "version\r\n";
+scalar<$sock>;
+printf("stored %d keys: %.2f secs\n", $keys, tv_interval($start));
+
+$start = [gettimeofday];
+my $hits = 0;
+for (my $done = 0; $done < $gets; $done += $batch) {
+    print $sock "get ",
+        join(' ', map { 'key' . (1 + int(rand($keys))) } 1 .. $batch),
+        "\r\n";
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        if ($line =~ /^VALUE/) {
+            scalar<$sock>;
+            $hits++;
+        }
+    }
+}
+my $secs = tv_interval($start);
+printf("%d random gets (%d hits): %.2f secs, %.0f gets/sec\n",
+       $gets, $hits, $secs, $gets / $secs);
@@ -0,0 +1,93 @@
+#! /usr/bin/perl
+#
+# TCP gets of one small key from several client processes, each with a
+# number of connections that all have a request in flight. Reports
+# requests per second, and requests per second of server cpu time, which
+# is what a worker thread that is kept busy could do on one core. Compare
+# a server started with -o io_uring against the default.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use IO::Select;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 4
+    or die "Usage: $FindBin::Script HOST:PORT [CLIENTS] [CONNS] [SECS]\n";
+
+my $addr = $ARGV[0];
+my $clients = $ARGV[1] || 4;
+my $conns = $ARGV[2] || 16;
+my $secs = $ARGV[3] || 10;
+
+sub connect_sock {
+    my $sock = IO::Socket::INET->new(PeerAddr => $addr);
+    die "$!\n" unless $sock;
+    $sock->autoflush(1);
+    return $sock;
+}
+
+sub server_cpu {
+    my $sock = shift;
+    my %stats;
+    print $sock "stats\r\n";
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        $stats{$1} = $2 if $line =~ /^STAT (\S+) (\S+)/;
+    }
+    return $stats{rusage_user} + $stats{rusage_system};
+}
+
+my $sock = connect_sock();
+print $sock "set hotkey 0 0 10\r\n0123456789\r\n";
+<$sock>;
+my $reply = "VALUE hotkey 0 10\r\n0123456789\r\nEND\r\n";
+
+my $cpu = server_cpu($sock);
+pipe(my $results, my $results_w) or die "pipe: $!\n";
+my @kids;
+for my $n (1 .. $clients) {
+    my $pid = fork();
+    die "fork: $!\n" unless defined $pid;
+    if ($pid == 0) {
+        close($results);
+        my @socks = map { connect_sock() } 1 .. $conns;
+        my $sel = IO::Select->new(@socks);
+        my %pending;
+        my $start = [gettimeofday];
+        my $done = 0;
+        while (tv_interval($start) < $secs) {
+            for my $s (@socks) {
+                next if exists $pending{$s};
+                syswrite($s, "get hotkey\r\n");
+                $pending{$s} = '';
+            }
+            for my $s ($sel->can_read(1)) {
+                sysread($s, my $buf, 4096) or die "server went away\n";
+                $pending{$s} .= $buf;
+                while (length($pending{$s}) >= length($reply)) {
+                    substr($pending{$s}, 0, length($reply), '');
+                    $done++;
+                }
+                delete $pending{$s} if $pending{$s} eq '';
+            }
+        }
+        print $results_w "$done\n";
+        exit 0;
+    }
+    push @kids, $pid;
+}
+close($results_w);
+
+my $total = 0;
+while (my $line = <$results>) {
+    $total += $line;
+}
+waitpid($_, 0) for @kids;
+$cpu = server_cpu($sock) - $cpu;
+printf("%d clients x %d conns, %d requests in %d secs: %.0f requests/sec\n",
+       $clients, $conns, $total, $secs, $total / $secs);
+printf("server cpu %.2f secs: %.0f requests per cpu second\n",
+       $cpu, $cpu > 0 ? $total / $cpu : 0);
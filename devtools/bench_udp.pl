@@ -0,0 +1,78 @@
+#! /usr/bin/perl
+#
+# UDP gets of one small hot key from several client processes, each keeping
+# a window of requests in flight. Reports replies per second, which is
+# mostly a measure of system calls per datagram on the server. Compare a
+# server started with -o udp_batch=1 against the default.
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use IO::Select;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+use FindBin;
+
+@ARGV >= 1 and @ARGV <= 3
+    or die "Usage: $FindBin::Script HOST:UDPPORT [CLIENTS] [SECS]\n";
+
+my $addr = $ARGV[0];
+my $clients = $ARGV[1] || 4;
+my $secs = $ARGV[2] || 10;
+my $window = 32;
+
+sub udp_sock {
+    my $sock = IO::Socket::INET->new(PeerAddr => $addr,
+                                     Proto    => 'udp');
+    die "$!\n" unless $sock;
+    return $sock;
+}
+
+# One request per datagram: request id, sequence 0 of 1 packets
+sub request {
+    my ($id, $cmd) = @_;
+    return pack("nnnn", $id, 0, 1, 0) . $cmd;
+}
+
+my $sock = udp_sock();
+$sock->send(request(0, "set hotkey 0 0 10\r\n0123456789\r\n"));
+my $reply;
+IO::Select->new($sock)->can_read(3) or die "No reply from $addr\n";
+$sock->recv($reply, 1500);
+
+pipe(my $results, my $results_w) or die "pipe: $!\n";
+my @kids;
+for my $n (1 .. $clients) {
+    my $pid = fork();
+    die "fork: $!\n" unless defined $pid;
+    if ($pid == 0) {
+        close($results);
+        my $s = udp_sock();
+        my $sel = IO::Select->new($s);
+        my $start = [gettimeofday];
+        my ($id, $replies) = (0, 0);
+        while (tv_interval($start) < $secs) {
+            # top the window up; whatever was lost is simply resent
+            $s->send(request($id++ % 65536, "get hotkey\r\n"))
+                for 1 .. $window;
+            my $got = 0;
+            while ($got < $window && $sel->can_read(0.05)) {
+                $s->recv(my $buf, 1500);
+                $got++;
+            }
+            $replies += $got;
+        }
+        print $results_w "$replies\n";
+        exit 0;
+    }
+    push @kids, $pid;
+}
+close($results_w);
+
+my $total = 0;
+while (my $line = <$results>) {
+    $total += $line;
+}
+waitpid($_, 0) for @kids;
+printf("%d clients, %d replies in %d secs: %.0f replies/sec\n",
+       $clients, $total, $secs, $total / $secs);
@@ -7,6 +7,8 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <errno.h>
+#include <poll.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -17,6 +19,7 @@
 /* Forward Declarations */
 static void item_link_q(item *it);
 static void item_unlink_q(item *it);
+static int lru_crawler_autocrawl_check(void);
 
 #define LARGEST_ID POWER_LARGEST
 typedef struct {
@@ -29,24 +32,105 @@ typedef struct {
     uint64_t expired_unfetched;
     uint64_t evicted_unfetched;
     uint64_t crawler_reclaimed;
+    uint64_t crawler_items_checked;
+    uint64_t total_items;
 } itemstats_t;
 
+/* TTL histogram of a single crawl pass over one slab class. The autocrawler
+ * uses the last complete pass to guess when enough items will have expired
+ * for another pass to be worth its while. */
+#define CRAWLER_HISTO_BUCKETS 60 /* one minute per bucket */
+typedef struct {
+    uint64_t seen;          /* items examined */
+    uint64_t noexp;         /* items without an exptime */
+    uint64_t ttl_hourplus;  /* items expiring past the last bucket */
+    uint64_t reclaimed;     /* expired items freed by the pass */
+    uint64_t histo[CRAWLER_HISTO_BUCKETS];
+    rel_time_t start_time;
+    rel_time_t end_time;
+    bool run_complete;      /* not yet looked at by the scheduler */
+} crawlerstats_t;
+
+/* Longest the autocrawler will leave a class alone, and the minimum spacing
+ * between two scheduled passes over the same class. */
+#define AUTOCRAWL_MAX_WAIT (60 * 60)
+#define AUTOCRAWL_MIN_WAIT 5
+/* Items crawled between two checks of the CPU budget */
+#define CRAWLER_BUDGET_BATCH 100
+/* Items a crawler thread examines per cache_lock acquisition */
+#define CRAWLER_LOCK_BATCH 16
+
+#if defined(__GNUC__)
+#define crawler_prefetch(p) __builtin_prefetch(p)
+#else
+#define crawler_prefetch(p)
+#endif
+
+/* Output buffered per crawler thread for a metadump client. It is flushed
+ * whenever less than a batch worth of worst case lines would fit. */
+#define CRAWLER_DUMP_BUFSIZE (64 * 1024)
+#define CRAWLER_DUMP_LINE 1024
+
+typedef struct {
+    pthread_t tid;
+    int id;
+    char *dumpbuf;
+    size_t dumplen;
+} crawler_worker_t;
+
+/* The connection a metadump is streamed to. The worker thread that owned
+ * it stops watching the socket until the crawler hands it back. */
+typedef struct {
+    conn *c;
+    int sfd;
+    bool error;     /* write failed, stop sending */
+} crawler_client_t;
+
 static item *heads[LARGEST_ID];
 static item *tails[LARGEST_ID];
+#ifdef COMPACT_ITEMS
+/* Crawlers sit in the LRUs, so they live in the slab arena */
+static crawler *crawlers;
+#else
 static crawler crawlers[LARGEST_ID];
+#endif
 static itemstats_t itemstats[LARGEST_ID];
+static crawlerstats_t crawlerstats[LARGEST_ID];     /* last complete pass */
+static crawlerstats_t crawlerstats_run[LARGEST_ID]; /* pass in progress */
+static rel_time_t next_crawls[LARGEST_ID];
+static rel_time_t next_crawl_wait[LARGEST_ID];
 static unsigned int sizes[LARGEST_ID];
+static uint64_t sizes_bytes[LARGEST_ID];
+
+/* Linked items by total size, kept up to date on link and unlink so size
+ * reports needn't walk the LRU. Buckets are CHUNK_ALIGN_BYTES wide unless
+ * that would take more than SIZE_HISTOGRAM_MAX_BUCKETS. Chunked items are
+ * only counted. Guarded by cache_lock. */
+#define SIZE_HISTOGRAM_MAX_BUCKETS 131072
+static unsigned int *size_histogram = NULL;
+static unsigned int size_histogram_buckets = 0;
+static unsigned int size_histogram_bucket = CHUNK_ALIGN_BYTES;
+static bool size_histogram_tried = false;
+static uint64_t size_histogram_chunked = 0;
 
 static int crawler_count = 0;
+static crawler_worker_t *crawler_workers = NULL;
+static int crawler_nworkers = 0;
+static int crawler_active = 0;  /* threads currently crawling */
+static enum crawler_run_type crawler_run_type = CRAWLER_EXPIRED;
+static crawler_client_t crawler_client;
+static pthread_mutex_t crawler_client_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timeval crawler_pass_start;
+static uint64_t crawler_pass_checked = 0;
 static volatile int do_run_lru_crawler_thread = 0;
 static int lru_crawler_initialized = 0;
 static pthread_mutex_t lru_crawler_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  lru_crawler_cond = PTHREAD_COND_INITIALIZER;
 
 void item_stats_reset(void) {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     memset(itemstats, 0, sizeof(itemstats));
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 
@@ -86,23 +170,11 @@ static size_t item_make_header(const uint8_t nkey, const int flags, const int nb
     return sizeof(item) + nkey + *nsuffix + nbytes;
 }
 
-/*@null@*/
-item *do_item_alloc(char *key, const size_t nkey, const int flags,
-                    const rel_time_t exptime, const int nbytes,
-                    const uint32_t cur_hv) {
-    uint8_t nsuffix;
+/* Takes a chunk of class id, reclaiming or evicting from the tail of the
+ * class's LRU when there is no free memory. Called with cache_lock held. */
+static item *do_item_alloc_pull(const size_t ntotal, const unsigned int id,
+                                const uint32_t cur_hv) {
     item *it = NULL;
-    char suffix[40];
-    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
-    if (settings.use_cas) {
-        ntotal += sizeof(uint64_t);
-    }
-
-    unsigned int id = slabs_clsid(ntotal);
-    if (id == 0)
-        return 0;
-
-    mutex_lock(&cache_lock);
     /* do a quick check if we have any expired items in the tail.. */
     int tries = 5;
     int tried_alloc = 0;
@@ -113,7 +185,7 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
     search = tails[id];
     /* We walk up *only* for locked items. Never searching for expired.
      * Waste of CPU for almost all deployments */
-    for (; tries > 0 && search != NULL; tries--, search=search->prev) {
+    for (; tries > 0 && search != NULL; tries--, search=ITEM_prev(search)) {
         if (search->nbytes == 0 && search->nkey == 0 && search->it_flags == 1) {
             /* We are a crawler, ignore it. */
             tries++;
@@ -153,6 +225,7 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
             it = search;
             slabs_adjust_mem_requested(it->slabs_clsid, ITEM_ntotal(it), ntotal);
             do_item_unlink_nolock(it, hv);
+            item_free_chunks(it);
             /* Initialize the item block: */
             it->slabs_clsid = 0;
         } else if ((it = slabs_alloc(ntotal, id)) == NULL) {
@@ -170,6 +243,7 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
                 it = search;
                 slabs_adjust_mem_requested(it->slabs_clsid, ITEM_ntotal(it), ntotal);
                 do_item_unlink_nolock(it, hv);
+                item_free_chunks(it);
                 /* Initialize the item block: */
                 it->slabs_clsid = 0;
 
@@ -197,23 +271,111 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
 
     if (it == NULL) {
         itemstats[id].outofmemory++;
-        mutex_unlock(&cache_lock);
         return NULL;
     }
 
     assert(it->slabs_clsid == 0);
     assert(it != heads[id]);
+    /* Reclaimed items keep their old flags until initialized */
+    it->it_flags = 0;
+    return it;
+}
+
+/* Gives the partly built chunked item it the chunks for the rest of its
+ * nbytes value, all from class id. Called with cache_lock held. */
+static bool do_item_alloc_chunks(item *it, const int nbytes,
+                                 const unsigned int id, const uint32_t cur_hv) {
+    item_chunk *chunk = ITEM_chunk(it);
+    int remaining;
+
+    CHUNK_set_next(chunk, NULL);
+    CHUNK_set_prev(chunk, NULL);
+    CHUNK_set_head(chunk, it);
+    chunk->size = settings.slab_chunk_max - (chunk->data - (char *)it);
+    remaining = nbytes - chunk->size;
+
+    while (remaining > 0) {
+        int size = settings.slab_chunk_max - sizeof(item_chunk);
+        item_chunk *next;
+        if (size > remaining)
+            size = remaining;
+        next = (item_chunk *)do_item_alloc_pull(sizeof(item_chunk) + size,
+                                                id, cur_hv);
+        if (next == NULL)
+            return false;
+        CHUNK_set_next(next, NULL);
+        CHUNK_set_prev(next, chunk);
+        CHUNK_set_head(next, it);
+        next->size = size;
+        next->it_flags = ITEM_CHUNK;
+        next->slabs_clsid = id;
+        CHUNK_set_next(chunk, next);
+        chunk = next;
+        remaining -= size;
+    }
+    return true;
+}
+
+/*@null@*/
+item *do_item_alloc(char *key, const size_t nkey, const int flags,
+                    const rel_time_t exptime, const int nbytes,
+                    const uint32_t cur_hv) {
+    uint8_t nsuffix;
+    item *it = NULL;
+    char suffix[40];
+    bool chunked = false;
+    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
+    if (settings.use_cas) {
+        ntotal += sizeof(uint64_t);
+    }
+
+    /* Values too large for a chunk of the largest class are split over
+     * several of them */
+    if (settings.large_item_max != 0 && ntotal > settings.slab_chunk_max) {
+        if (ntotal > settings.large_item_max)
+            return 0;
+        chunked = true;
+        ntotal = settings.slab_chunk_max;
+    }
+
+    unsigned int id = slabs_clsid(ntotal);
+    if (id == 0)
+        return 0;
+
+    CACHE_LOCK();
+    it = do_item_alloc_pull(ntotal, id, cur_hv);
+    if (it == NULL) {
+        CACHE_UNLOCK();
+        return NULL;
+    }
 
     /* Item initialization can happen outside of the lock; the item's already
      * been removed from the slab LRU.
      */
     it->refcount = 1;     /* the caller will have a reference */
-    mutex_unlock(&cache_lock);
-    it->next = it->prev = it->h_next = 0;
+    if (chunked) {
+        /* Enough of the header for the chunks to be found again */
+        it->it_flags = ITEM_CHUNKED | (settings.use_cas ? ITEM_CAS : 0);
+        it->nkey = nkey;
+        it->nsuffix = nsuffix;
+        if (!do_item_alloc_chunks(it, nbytes, id, cur_hv)) {
+            itemstats[id].outofmemory++;
+            it->refcount = 0;
+            it->slabs_clsid = id;
+            item_free(it);
+            CACHE_UNLOCK();
+            return NULL;
+        }
+    }
+    CACHE_UNLOCK();
+    ITEM_set_next(it, 0);
+    ITEM_set_prev(it, 0);
+    ITEM_set_h_next(it, 0);
     it->slabs_clsid = id;
 
     DEBUG_REFCNT(it, '*');
-    it->it_flags = settings.use_cas ? ITEM_CAS : 0;
+    it->it_flags = (settings.use_cas ? ITEM_CAS : 0) |
+        (chunked ? ITEM_CHUNKED : 0);
     it->nkey = nkey;
     it->nbytes = nbytes;
     memcpy(ITEM_key(it), key, nkey);
@@ -223,6 +385,22 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
     return it;
 }
 
+/* Returns the chunks of a chunked item to the slab allocator. */
+void item_free_chunks(item *it) {
+    item_chunk *chunk, *next;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0)
+        return;
+    for (chunk = CHUNK_next(ITEM_chunk(it)); chunk != NULL; chunk = next) {
+        unsigned int clsid = chunk->slabs_clsid;
+        next = CHUNK_next(chunk);
+        chunk->it_flags = 0;
+        chunk->slabs_clsid = 0;
+        slabs_free(chunk, sizeof(item_chunk) + chunk->size, clsid);
+    }
+    CHUNK_set_next(ITEM_chunk(it), NULL);
+}
+
 void item_free(item *it) {
     size_t ntotal = ITEM_ntotal(it);
     unsigned int clsid;
@@ -231,13 +409,76 @@ void item_free(item *it) {
     assert(it != tails[it->slabs_clsid]);
     assert(it->refcount == 0);
 
+    item_free_chunks(it);
     /* so slab size changer can tell later if item is already free or not */
     clsid = it->slabs_clsid;
     it->slabs_clsid = 0;
+    it->it_flags = 0;
     DEBUG_REFCNT(it, 'F');
     slabs_free(it, ntotal, clsid);
 }
 
+/* Copies len bytes of the value of it from offset off into buf. */
+void item_data_read(item *it, int off, char *buf, int len) {
+    item_chunk *chunk;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+        memcpy(buf, ITEM_data(it) + off, len);
+        return;
+    }
+    for (chunk = ITEM_chunk(it); chunk != NULL && len > 0;
+         chunk = CHUNK_next(chunk)) {
+        if (off >= chunk->size) {
+            off -= chunk->size;
+            continue;
+        }
+        int n = chunk->size - off < len ? chunk->size - off : len;
+        memcpy(buf, chunk->data + off, n);
+        buf += n;
+        len -= n;
+        off = 0;
+    }
+}
+
+/* Copies len bytes from buf into the value of it at offset off. */
+void item_data_write(item *it, int off, const char *buf, int len) {
+    item_chunk *chunk;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0) {
+        memcpy(ITEM_data(it) + off, buf, len);
+        return;
+    }
+    for (chunk = ITEM_chunk(it); chunk != NULL && len > 0;
+         chunk = CHUNK_next(chunk)) {
+        if (off >= chunk->size) {
+            off -= chunk->size;
+            continue;
+        }
+        int n = chunk->size - off < len ? chunk->size - off : len;
+        memcpy(chunk->data + off, buf, n);
+        buf += n;
+        len -= n;
+        off = 0;
+    }
+}
+
+/* Copies the first len bytes of the value of src into dst at offset off. */
+void item_data_copy(item *dst, int off, item *src, int len) {
+    item_chunk *chunk;
+
+    if ((src->it_flags & ITEM_CHUNKED) == 0) {
+        item_data_write(dst, off, ITEM_data(src), len);
+        return;
+    }
+    for (chunk = ITEM_chunk(src); chunk != NULL && len > 0;
+         chunk = CHUNK_next(chunk)) {
+        int n = chunk->size < len ? chunk->size : len;
+        item_data_write(dst, off, chunk->data, n);
+        off += n;
+        len -= n;
+    }
+}
+
 /**
  * Returns true if an item will fit in the cache (its size does not exceed
  * the maximum for a cache entry.)
@@ -252,6 +493,8 @@ bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
         ntotal += sizeof(uint64_t);
     }
 
+    if (settings.large_item_max != 0 && ntotal > settings.slab_chunk_max)
+        return ntotal <= settings.large_item_max;
     return slabs_clsid(ntotal) != 0;
 }
 
@@ -264,9 +507,9 @@ static void item_link_q(item *it) { /* item is the new head */
     tail = &tails[it->slabs_clsid];
     assert(it != *head);
     assert((*head && *tail) || (*head == 0 && *tail == 0));
-    it->prev = 0;
-    it->next = *head;
-    if (it->next) it->next->prev = it;
+    ITEM_set_prev(it, 0);
+    ITEM_set_next(it, *head);
+    if (*head) ITEM_set_prev(*head, it);
     *head = it;
     if (*tail == 0) *tail = it;
     sizes[it->slabs_clsid]++;
@@ -280,34 +523,57 @@ static void item_unlink_q(item *it) {
     tail = &tails[it->slabs_clsid];
 
     if (*head == it) {
-        assert(it->prev == 0);
-        *head = it->next;
+        assert(ITEM_prev(it) == 0);
+        *head = ITEM_next(it);
     }
     if (*tail == it) {
-        assert(it->next == 0);
-        *tail = it->prev;
+        assert(ITEM_next(it) == 0);
+        *tail = ITEM_prev(it);
     }
-    assert(it->next != it);
-    assert(it->prev != it);
+    assert(ITEM_next(it) != it);
+    assert(ITEM_prev(it) != it);
 
-    if (it->next) it->next->prev = it->prev;
-    if (it->prev) it->prev->next = it->next;
+    if (ITEM_next(it)) ITEM_set_prev(ITEM_next(it), ITEM_prev(it));
+    if (ITEM_prev(it)) ITEM_set_next(ITEM_prev(it), ITEM_next(it));
     sizes[it->slabs_clsid]--;
     return;
 }
 
+static void item_size_histogram_adjust(item *it, const int incr) {
+    unsigned int bucket;
+    if (it->it_flags & ITEM_CHUNKED) {
+        size_histogram_chunked += incr;
+        return;
+    }
+    if (!size_histogram_tried) {
+        size_histogram_tried = true;
+        while (settings.slab_chunk_max / size_histogram_bucket >=
+               SIZE_HISTOGRAM_MAX_BUCKETS)
+            size_histogram_bucket *= 2;
+        size_histogram_buckets =
+            settings.slab_chunk_max / size_histogram_bucket + 1;
+        size_histogram = calloc(size_histogram_buckets, sizeof(unsigned int));
+    }
+    if (size_histogram == NULL)
+        return;
+    bucket = (ITEM_ntotal(it) + size_histogram_bucket - 1)
+        / size_histogram_bucket;
+    if (bucket < size_histogram_buckets)
+        size_histogram[bucket] += incr;
+}
+
 int do_item_link(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_LINK(ITEM_key(it), it->nkey, it->nbytes);
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
 
-    STATS_LOCK();
-    stats.curr_bytes += ITEM_ntotal(it);
-    stats.curr_items += 1;
-    stats.total_items += 1;
-    STATS_UNLOCK();
+    /* Item counts live with the LRU under cache_lock, which is already
+     * held, rather than under the global stats lock. */
+    sizes_bytes[it->slabs_clsid] += ITEM_ntotal(it);
+    item_size_histogram_adjust(it, 1);
+    itemstats[it->slabs_clsid].total_items++;
 
     /* Allocate a new CAS ID on link. */
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
@@ -315,26 +581,24 @@ int do_item_link(item *it, const uint32_t hv) {
     item_link_q(it);
     refcount_incr(&it->refcount);
 	notify_log(it);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 
     return 1;
 }
 
 void do_item_unlink(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        sizes_bytes[it->slabs_clsid] -= ITEM_ntotal(it);
+        item_size_histogram_adjust(it, -1);
         assoc_delete(ITEM_key(it), it->nkey, hv);
         item_unlink_q(it);
         do_item_remove(it);
 		notify_log(it);
     }
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 /* FIXME: Is it necessary to keep this copy/pasted code? */
@@ -342,10 +606,8 @@ void do_item_unlink_nolock(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        sizes_bytes[it->slabs_clsid] -= ITEM_ntotal(it);
+        item_size_histogram_adjust(it, -1);
         assoc_delete(ITEM_key(it), it->nkey, hv);
         item_unlink_q(it);
         do_item_remove(it);
@@ -367,13 +629,13 @@ void do_item_update(item *it) {
     if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
         assert((it->it_flags & ITEM_SLABBED) == 0);
 
-        mutex_lock(&cache_lock);
+        CACHE_LOCK();
         if ((it->it_flags & ITEM_LINKED) != 0) {
             item_unlink_q(it);
             it->time = current_time;
             item_link_q(it);
         }
-        mutex_unlock(&cache_lock);
+        CACHE_UNLOCK();
     }
 }
 
@@ -386,6 +648,53 @@ int do_item_replace(item *it, item *new_it, const uint32_t hv) {
     return do_item_link(new_it, hv);
 }
 
+/* Moves a linked item into new_it, a free chunk of the same class, keeping
+ * its place in the hash chain and the LRU along with its CAS. Used by the
+ * slab page mover to rescue live items. Caller holds cache_lock and the
+ * item lock, and its own reference is the only one besides the link's. */
+void do_item_relocate_nolock(item *it, item *new_it, const uint32_t hv) {
+    item **head, **tail;
+
+    assert((it->it_flags & ITEM_LINKED) != 0);
+    assert(it->refcount == 2);
+
+    memcpy(new_it, it, ITEM_ntotal(it));
+    new_it->refcount = 1;
+
+    assoc_delete(ITEM_key(it), it->nkey, hv);
+    assoc_insert(new_it, hv);
+
+    head = &heads[it->slabs_clsid];
+    tail = &tails[it->slabs_clsid];
+    if (ITEM_prev(it)) {
+        ITEM_set_next(ITEM_prev(it), new_it);
+    } else {
+        assert(*head == it);
+        *head = new_it;
+    }
+    if (ITEM_next(it)) {
+        ITEM_set_prev(ITEM_next(it), new_it);
+    } else {
+        assert(*tail == it);
+        *tail = new_it;
+    }
+
+    /* The first chunk moved along with the header */
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_chunk *chunk = ITEM_chunk(new_it);
+        if (CHUNK_next(chunk))
+            CHUNK_set_prev(CHUNK_next(chunk), chunk);
+        for (; chunk != NULL; chunk = CHUNK_next(chunk)) {
+            CHUNK_set_head(chunk, new_it);
+        }
+        /* The old copy no longer owns them */
+        it->it_flags &= ~ITEM_CHUNKED;
+    }
+
+    it->it_flags &= ~ITEM_LINKED;
+    it->refcount = 1;
+}
+
 /*@null@*/
 char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes) {
     unsigned int memlimit = 2 * 1024 * 1024;   /* 2MB max response size */
@@ -406,7 +715,7 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
     while (it != NULL && (limit == 0 || shown < limit)) {
         assert(it->nkey <= KEY_MAX_LENGTH);
         if (it->nbytes == 0 && it->nkey == 0) {
-            it = it->next;
+            it = ITEM_next(it);
             continue;
         }
         /* Copy the key since it may not be null-terminated in the struct */
@@ -420,7 +729,7 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
         memcpy(buffer + bufcurr, temp, len);
         bufcurr += len;
         shown++;
-        it = it->next;
+        it = ITEM_next(it);
     }
 
     memcpy(buffer + bufcurr, "END\r\n", 6);
@@ -432,24 +741,66 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
 
 void item_stats_evictions(uint64_t *evicted) {
     int i;
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     for (i = 0; i < LARGEST_ID; i++) {
         evicted[i] = itemstats[i].evicted;
     }
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
+}
+
+/* Seconds since the LRU tail of each class was last used. Classes with an
+ * empty LRU are reported as -1. */
+void item_stats_tail_ages(int *ages) {
+    int i;
+    CACHE_LOCK();
+    for (i = 0; i < LARGEST_ID; i++) {
+        ages[i] = tails[i] != NULL ? (int)(current_time - tails[i]->time) : -1;
+    }
+    CACHE_UNLOCK();
+}
+
+unsigned int *item_stats_histogram(unsigned int *nbuckets,
+                                   unsigned int *bucket, uint64_t *chunked,
+                                   unsigned int *counts) {
+    unsigned int *histogram = NULL;
+    int i;
+    CACHE_LOCK();
+    if (size_histogram != NULL) {
+        histogram = malloc(size_histogram_buckets * sizeof(unsigned int));
+        if (histogram != NULL) {
+            memcpy(histogram, size_histogram,
+                   size_histogram_buckets * sizeof(unsigned int));
+        }
+    }
+    *nbuckets = histogram != NULL ? size_histogram_buckets : 0;
+    *bucket = size_histogram_bucket;
+    *chunked = size_histogram_chunked;
+    for (i = 0; i < LARGEST_ID; i++) {
+        counts[i] = sizes[i];
+    }
+    CACHE_UNLOCK();
+    return histogram;
 }
 
 void do_item_stats_totals(ADD_STAT add_stats, void *c) {
     itemstats_t totals;
     memset(&totals, 0, sizeof(itemstats_t));
+    uint64_t curr_items = 0, curr_bytes = 0;
     int i;
     for (i = 0; i < LARGEST_ID; i++) {
+        curr_items += sizes[i];
+        curr_bytes += sizes_bytes[i];
+        totals.total_items += itemstats[i].total_items;
         totals.expired_unfetched += itemstats[i].expired_unfetched;
         totals.evicted_unfetched += itemstats[i].evicted_unfetched;
         totals.evicted += itemstats[i].evicted;
         totals.reclaimed += itemstats[i].reclaimed;
         totals.crawler_reclaimed += itemstats[i].crawler_reclaimed;
+        totals.crawler_items_checked += itemstats[i].crawler_items_checked;
     }
+    APPEND_STAT("bytes", "%llu", (unsigned long long)curr_bytes);
+    APPEND_STAT("curr_items", "%llu", (unsigned long long)curr_items);
+    APPEND_STAT("total_items", "%llu", (unsigned long long)totals.total_items);
     APPEND_STAT("expired_unfetched", "%llu",
                 (unsigned long long)totals.expired_unfetched);
     APPEND_STAT("evicted_unfetched", "%llu",
@@ -460,6 +811,21 @@ void do_item_stats_totals(ADD_STAT add_stats, void *c) {
                 (unsigned long long)totals.reclaimed);
     APPEND_STAT("crawler_reclaimed", "%llu",
                 (unsigned long long)totals.crawler_reclaimed);
+    APPEND_STAT("crawler_items_checked", "%llu",
+                (unsigned long long)totals.crawler_items_checked);
+}
+
+/* Estimate how many items in a class have expired since the last complete
+ * crawl, based on the TTL histogram that crawl collected. */
+static uint64_t crawler_reclaimable(const int i) {
+    crawlerstats_t *s = &crawlerstats[i];
+    rel_time_t since = current_time - s->end_time;
+    uint64_t reclaimable = 0;
+    int x;
+    for (x = 0; x < CRAWLER_HISTO_BUCKETS && (rel_time_t)x * 60 <= since; x++) {
+        reclaimable += s->histo[x];
+    }
+    return reclaimable;
 }
 
 void do_item_stats(ADD_STAT add_stats, void *c) {
@@ -494,6 +860,15 @@ void do_item_stats(ADD_STAT add_stats, void *c) {
                                 "%llu", (unsigned long long)itemstats[i].evicted_unfetched);
             APPEND_NUM_FMT_STAT(fmt, i, "crawler_reclaimed",
                                 "%llu", (unsigned long long)itemstats[i].crawler_reclaimed);
+            APPEND_NUM_FMT_STAT(fmt, i, "crawler_items_checked",
+                                "%llu", (unsigned long long)itemstats[i].crawler_items_checked);
+            APPEND_NUM_FMT_STAT(fmt, i, "crawler_reclaimable",
+                                "%llu", (unsigned long long)crawler_reclaimable(i));
+            if (settings.lru_crawler_autocrawl) {
+                APPEND_NUM_FMT_STAT(fmt, i, "crawler_next_crawl", "%u",
+                                    next_crawls[i] > current_time ?
+                                    next_crawls[i] - current_time : 0);
+            }
         }
     }
 
@@ -504,42 +879,30 @@ void do_item_stats(ADD_STAT add_stats, void *c) {
 /** dumps out a list of objects of each size, with granularity of 32 bytes */
 /*@null@*/
 void do_item_stats_sizes(ADD_STAT add_stats, void *c) {
-
-    /* max 1MB object, divided into 32 bytes size buckets */
-    const int num_buckets = 32768;
-    unsigned int *histogram = calloc(num_buckets, sizeof(int));
-
-    if (histogram != NULL) {
-        int i;
-
-        /* build the histogram */
-        for (i = 0; i < LARGEST_ID; i++) {
-            item *iter = heads[i];
-            while (iter) {
-                int ntotal = ITEM_ntotal(iter);
-                int bucket = ntotal / 32;
-                if ((ntotal % 32) != 0) bucket++;
-                if (bucket < num_buckets) histogram[bucket]++;
-                iter = iter->next;
+    /* Reported in 32 byte buckets, or the histogram's own if wider */
+    unsigned int width = size_histogram_bucket > 32 ? size_histogram_bucket : 32;
+    unsigned int per = width / size_histogram_bucket;
+    unsigned int count = 0;
+    unsigned int i;
+
+    for (i = 0; size_histogram != NULL && i < size_histogram_buckets; i++) {
+        /* Bucket i holds sizes up to i * size_histogram_bucket */
+        count += size_histogram[i];
+        if (i % per == 0 || i == size_histogram_buckets - 1) {
+            if (count != 0) {
+                char key[16];
+                snprintf(key, sizeof(key), "%u", (i + per - 1) / per * width);
+                APPEND_STAT(key, "%u", count);
             }
+            count = 0;
         }
-
-        /* write the buffer */
-        for (i = 0; i < num_buckets; i++) {
-            if (histogram[i] != 0) {
-                char key[8];
-                snprintf(key, sizeof(key), "%d", i * 32);
-                APPEND_STAT(key, "%u", histogram[i]);
-            }
-        }
-        free(histogram);
     }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
 /** wrapper around assoc_find which does the lazy expiration logic */
 item *do_item_get(const char *key, const size_t nkey, const uint32_t hv) {
-    //mutex_lock(&cache_lock);
+    //CACHE_LOCK();
     item *it = assoc_find(key, nkey, hv);
     if (it != NULL) {
         refcount_incr(&it->refcount);
@@ -553,7 +916,7 @@ item *do_item_get(const char *key, const size_t nkey, const uint32_t hv) {
             it = NULL;
         }
     }
-    //mutex_unlock(&cache_lock);
+    //CACHE_UNLOCK();
     int was_found = 0;
 
     if (settings.verbose > 2) {
@@ -621,7 +984,7 @@ void do_item_flush_expired(void) {
         for (iter = heads[i]; iter != NULL; iter = next) {
             /* iter->time of 0 are magic objects. */
             if (iter->time != 0 && iter->time >= settings.oldest_live) {
-                next = iter->next;
+                next = ITEM_next(iter);
                 if ((iter->it_flags & ITEM_SLABBED) == 0) {
                     do_item_unlink_nolock(iter, hash(ITEM_key(iter), iter->nkey));
                 }
@@ -644,11 +1007,11 @@ static void crawler_link_q(item *it) { /* item is the new tail */
     assert(*tail != 0);
     assert(it != *tail);
     assert((*head && *tail) || (*head == 0 && *tail == 0));
-    it->prev = *tail;
-    it->next = 0;
-    if (it->prev) {
-        assert(it->prev->next == 0);
-        it->prev->next = it;
+    ITEM_set_prev(it, *tail);
+    ITEM_set_next(it, 0);
+    if (*tail) {
+        assert(ITEM_next(*tail) == 0);
+        ITEM_set_next(*tail, it);
     }
     *tail = it;
     if (*head == 0) *head = it;
@@ -662,18 +1025,18 @@ static void crawler_unlink_q(item *it) {
     tail = &tails[it->slabs_clsid];
 
     if (*head == it) {
-        assert(it->prev == 0);
-        *head = it->next;
+        assert(ITEM_prev(it) == 0);
+        *head = ITEM_next(it);
     }
     if (*tail == it) {
-        assert(it->next == 0);
-        *tail = it->prev;
+        assert(ITEM_next(it) == 0);
+        *tail = ITEM_prev(it);
     }
-    assert(it->next != it);
-    assert(it->prev != it);
+    assert(ITEM_next(it) != it);
+    assert(ITEM_prev(it) != it);
 
-    if (it->next) it->next->prev = it->prev;
-    if (it->prev) it->prev->next = it->next;
+    if (ITEM_next(it)) ITEM_set_prev(ITEM_next(it), ITEM_prev(it));
+    if (ITEM_prev(it)) ITEM_set_next(ITEM_prev(it), ITEM_next(it));
     return;
 }
 
@@ -681,57 +1044,58 @@ static void crawler_unlink_q(item *it) {
  * more clearly. */
 static item *crawler_crawl_q(item *it) {
     item **head, **tail;
+    item *prev, *next;
     assert(it->it_flags == 1);
     assert(it->nbytes == 0);
     assert(it->slabs_clsid < LARGEST_ID);
     head = &heads[it->slabs_clsid];
     tail = &tails[it->slabs_clsid];
+    prev = ITEM_prev(it);
+    next = ITEM_next(it);
 
     /* We've hit the head, pop off */
-    if (it->prev == 0) {
+    if (prev == 0) {
         assert(*head == it);
-        if (it->next) {
-            *head = it->next;
-            assert(it->next->prev == it);
-            it->next->prev = 0;
+        if (next) {
+            *head = next;
+            assert(ITEM_prev(next) == it);
+            ITEM_set_prev(next, 0);
         }
         return NULL; /* Done */
     }
 
     /* Swing ourselves in front of the next item */
     /* NB: If there is a prev, we can't be the head */
-    assert(it->prev != it);
-    if (it->prev) {
-        if (*head == it->prev) {
-            /* Prev was the head, now we're the head */
-            *head = it;
-        }
-        if (*tail == it) {
-            /* We are the tail, now they are the tail */
-            *tail = it->prev;
-        }
-        assert(it->next != it);
-        if (it->next) {
-            assert(it->prev->next == it);
-            it->prev->next = it->next;
-            it->next->prev = it->prev;
-        } else {
-            /* Tail. Move this above? */
-            it->prev->next = 0;
-        }
-        /* prev->prev's next is it->prev */
-        it->next = it->prev;
-        it->prev = it->next->prev;
-        it->next->prev = it;
-        /* New it->prev now, if we're not at the head. */
-        if (it->prev) {
-            it->prev->next = it;
-        }
+    assert(prev != it);
+    if (*head == prev) {
+        /* Prev was the head, now we're the head */
+        *head = it;
+    }
+    if (*tail == it) {
+        /* We are the tail, now they are the tail */
+        *tail = prev;
+    }
+    assert(next != it);
+    if (next) {
+        assert(ITEM_next(prev) == it);
+        ITEM_set_next(prev, next);
+        ITEM_set_prev(next, prev);
+    } else {
+        /* Tail. Move this above? */
+        ITEM_set_next(prev, 0);
+    }
+    /* prev->prev's next is it->prev */
+    ITEM_set_next(it, prev);
+    ITEM_set_prev(it, ITEM_prev(prev));
+    ITEM_set_prev(prev, it);
+    /* New it->prev now, if we're not at the head. */
+    if (ITEM_prev(it)) {
+        ITEM_set_next(ITEM_prev(it), it);
     }
-    assert(it->next != it);
-    assert(it->prev != it);
+    assert(ITEM_next(it) != it);
+    assert(ITEM_prev(it) != it);
 
-    return it->next; /* success */
+    return ITEM_next(it); /* success */
 }
 
 /* I pulled this out to make the main thread clearer, but it reaches into the
@@ -739,9 +1103,13 @@ static item *crawler_crawl_q(item *it) {
  */
 static void item_crawler_evaluate(item *search, uint32_t hv, int i) {
     rel_time_t oldest_live = settings.oldest_live;
+    crawlerstats_t *s = &crawlerstats_run[i];
+    itemstats[i].crawler_items_checked++;
+    s->seen++;
     if ((search->exptime != 0 && search->exptime < current_time)
         || (search->time <= oldest_live && oldest_live <= current_time)) {
         itemstats[i].crawler_reclaimed++;
+        s->reclaimed++;
 
         if (settings.verbose > 1) {
             int ii;
@@ -760,126 +1128,485 @@ static void item_crawler_evaluate(item *search, uint32_t hv, int i) {
         do_item_remove(search);
         assert(search->slabs_clsid == 0);
     } else {
+        if (search->exptime == 0) {
+            s->noexp++;
+        } else if (search->exptime - current_time >= CRAWLER_HISTO_BUCKETS * 60) {
+            s->ttl_hourplus++;
+        } else {
+            s->histo[(search->exptime - current_time) / 60]++;
+        }
         refcount_decr(&search->refcount);
     }
 }
 
-static void *item_crawler_thread(void *arg) {
+/* Keeps the time the crawler spends working under lru_crawler_budget percent
+ * of wall clock time. "slept" is what the batch already spent in
+ * lru_crawler_sleep; whatever is still owed is slept off here. */
+static void crawler_throttle(struct timeval *start, uint64_t slept) {
+    struct timeval now;
+    int64_t elapsed;
+    uint64_t busy, owed;
+
+    gettimeofday(&now, NULL);
+    elapsed = (int64_t)(now.tv_sec - start->tv_sec) * 1000000
+        + (now.tv_usec - start->tv_usec);
+    busy = elapsed > (int64_t)slept ? elapsed - slept : 0;
+    owed = busy * (100 - settings.lru_crawler_budget) / settings.lru_crawler_budget;
+    if (owed > slept) {
+        owed -= slept;
+        usleep(owed > 1000000 ? 1000000 : owed);
+    }
+    gettimeofday(start, NULL);
+}
+
+/* Percent-encodes everything but unreserved characters, so binary keys
+ * can't break up a metadump line. "out" needs room for nkey * 3 + 1. */
+static void crawler_key_encode(const char *key, const int nkey, char *out) {
+    static const char hex[] = "0123456789ABCDEF";
     int i;
+    for (i = 0; i < nkey; i++) {
+        unsigned char ch = key[i];
+        if (isalnum(ch) || ch == '-' || ch == '_' || ch == '.' || ch == '~') {
+            *out++ = ch;
+        } else {
+            *out++ = '%';
+            *out++ = hex[ch >> 4];
+            *out++ = hex[ch & 0xf];
+        }
+    }
+    *out = '\0';
+}
 
-    pthread_mutex_lock(&lru_crawler_lock);
+/* Appends one line describing a live item to the thread's dump buffer.
+ * Expired and flushed items are skipped but left for a normal crawl. */
+static void item_crawler_metadump(crawler_worker_t *w, item *search) {
+    rel_time_t oldest_live = settings.oldest_live;
+    char keybuf[KEY_MAX_LENGTH * 3 + 1];
+
+    if ((search->exptime != 0 && search->exptime < current_time)
+        || (search->time <= oldest_live && oldest_live <= current_time)) {
+        refcount_decr(&search->refcount);
+        return;
+    }
+    crawler_key_encode(ITEM_key(search), search->nkey, keybuf);
+    w->dumplen += snprintf(w->dumpbuf + w->dumplen,
+                           CRAWLER_DUMP_BUFSIZE - w->dumplen,
+                           "key=%s exp=%ld la=%llu cls=%u size=%lu\n",
+                           keybuf,
+                           (search->exptime == 0) ? -1 :
+                           (long)search->exptime + process_started,
+                           (unsigned long long)search->time + process_started,
+                           search->slabs_clsid,
+                           (unsigned long)ITEM_ntotal(search));
+    refcount_decr(&search->refcount);
+}
+
+/* Writes all of buf to a metadump client, waiting for the socket to drain
+ * when the client falls behind. This is where crawling pauses for slow
+ * readers, so never call it with cache_lock held. Returns false once the
+ * client can't be written to any more. */
+static bool crawler_write_client(const int sfd, const char *p, size_t left) {
+    while (left > 0) {
+        ssize_t sent = write(sfd, p, left);
+        if (sent > 0) {
+            p += sent;
+            left -= sent;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK
+                                  || errno == EINTR)) {
+            struct pollfd pfd;
+            pfd.fd = sfd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if ((poll(&pfd, 1, 1000) == -1 && errno != EINTR)
+                || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Sends what a crawler thread has buffered. Threads take turns so lines
+ * from different classes don't interleave. */
+static void crawler_dump_flush(crawler_worker_t *w) {
+    pthread_mutex_lock(&crawler_client_lock);
+    if (!crawler_client.error &&
+        !crawler_write_client(crawler_client.sfd, w->dumpbuf, w->dumplen)) {
+        crawler_client.error = true;
+    }
+    pthread_mutex_unlock(&crawler_client_lock);
+    w->dumplen = 0;
+}
+
+/* Called with cache_lock held once a crawler reaches the head of its class
+ * or runs out of items to check. */
+static void crawler_class_done(const int i) {
     if (settings.verbose > 2)
-        fprintf(stderr, "Starting LRU crawler background thread\n");
-    while (do_run_lru_crawler_thread) {
-    pthread_cond_wait(&lru_crawler_cond, &lru_crawler_lock);
+        fprintf(stderr, "Nothing left to crawl for %d\n", i);
+    crawlers[i].it_flags = 0;
+    crawler_count--;
+    crawler_unlink_q((item *)&crawlers[i]);
+    if (crawler_run_type == CRAWLER_EXPIRED) {
+        crawlerstats_run[i].end_time = current_time;
+        crawlerstats_run[i].run_complete = true;
+        memcpy(&crawlerstats[i], &crawlerstats_run[i], sizeof(crawlerstats_t));
+    }
+
+    if (crawler_count == 0) {
+        struct timeval now;
+        uint64_t usec;
+        gettimeofday(&now, NULL);
+        usec = (uint64_t)(now.tv_sec - crawler_pass_start.tv_sec) * 1000000
+            + now.tv_usec - crawler_pass_start.tv_usec;
+        STATS_LOCK();
+        stats.lru_crawler_running = false;
+        stats.lru_crawler_pass_usec = usec;
+        stats.lru_crawler_items_per_sec = usec ?
+            crawler_pass_checked * 1000000 / usec : crawler_pass_checked;
+        STATS_UNLOCK();
+    }
+}
 
-    while (crawler_count) {
-        item *search = NULL;
+/* Examines up to CRAWLER_LOCK_BATCH items of class i, so the lock is taken
+ * once per batch rather than once per item. Caller must hold cache_lock.
+ * Returns the number of items stepped over. */
+static int crawler_crawl_batch(crawler_worker_t *w, const int i) {
+    int n;
+
+    for (n = 0; n < CRAWLER_LOCK_BATCH; n++) {
+        item *search = crawler_crawl_q((item *)&crawlers[i]);
         void *hold_lock = NULL;
+        uint32_t hv;
 
-        for (i = 0; i < LARGEST_ID; i++) {
+        if (search == NULL ||
+            (crawlers[i].remaining && --crawlers[i].remaining < 1)) {
+            crawler_class_done(i);
+            break;
+        }
+        /* The crawler now sits just above "search"; pull in the item it
+         * will step over next while this one is hashed and evaluated. */
+        if (ITEM_prev(&crawlers[i]) != NULL)
+            crawler_prefetch(ITEM_prev(&crawlers[i]));
+
+        hv = hash(ITEM_key(search), search->nkey);
+        /* Attempt to hash item lock the "search" item. If locked, no
+         * other callers can incr the refcount
+         */
+        if ((hold_lock = item_trylock(hv)) == NULL) {
+            continue;
+        }
+        /* Now see if the item is refcount locked */
+        if (refcount_incr(&search->refcount) != 2) {
+            refcount_decr(&search->refcount);
+            item_trylock_unlock(hold_lock);
+            continue;
+        }
+
+        /* Frees the item or decrements the refcount. */
+        /* Interface for this could improve: do the free/decr here
+         * instead? */
+        if (crawler_run_type == CRAWLER_METADUMP) {
+            item_crawler_metadump(w, search);
+        } else {
+            item_crawler_evaluate(search, hv, i);
+        }
+        crawler_pass_checked++;
+        item_trylock_unlock(hold_lock);
+    }
+    return n;
+}
+
+/* Classes are split between the crawler threads by class id modulo the
+ * number of threads. Caller must hold lru_crawler_lock. */
+static bool crawler_has_work(const int id) {
+    int i;
+    for (i = id; i < LARGEST_ID; i += crawler_nworkers) {
+        if (crawlers[i].it_flags == 1)
+            return true;
+    }
+    return false;
+}
+
+/* Round-robins over the classes owned by crawler thread "id" until none of
+ * them has a crawler left in it. Runs without lru_crawler_lock held. */
+static void crawler_crawl_classes(crawler_worker_t *w) {
+    const int id = w->id;
+    struct timeval batch_start;
+    uint64_t slept = 0;
+    int budget_batch = 0;
+    int i, n;
+    bool active;
+
+    gettimeofday(&batch_start, NULL);
+    do {
+        active = false;
+        for (i = id; i < LARGEST_ID; i += crawler_nworkers) {
             if (crawlers[i].it_flags != 1) {
                 continue;
             }
-            pthread_mutex_lock(&cache_lock);
-            search = crawler_crawl_q((item *)&crawlers[i]);
-            if (search == NULL ||
-                (crawlers[i].remaining && --crawlers[i].remaining < 1)) {
-                if (settings.verbose > 2)
-                    fprintf(stderr, "Nothing left to crawl for %d\n", i);
-                crawlers[i].it_flags = 0;
-                crawler_count--;
-                crawler_unlink_q((item *)&crawlers[i]);
-                pthread_mutex_unlock(&cache_lock);
-                continue;
+            active = true;
+            if (crawler_run_type == CRAWLER_METADUMP &&
+                CRAWLER_DUMP_BUFSIZE - w->dumplen <
+                    CRAWLER_LOCK_BATCH * CRAWLER_DUMP_LINE) {
+                crawler_dump_flush(w);
             }
-            uint32_t hv = hash(ITEM_key(search), search->nkey);
-            /* Attempt to hash item lock the "search" item. If locked, no
-             * other callers can incr the refcount
-             */
-            if ((hold_lock = item_trylock(hv)) == NULL) {
-                pthread_mutex_unlock(&cache_lock);
-                continue;
+            CACHE_LOCK_BLOCKING();
+            n = crawler_crawl_batch(w, i);
+            CACHE_UNLOCK();
+
+            if (settings.lru_crawler_sleep && n) {
+                uint64_t tosleep = (uint64_t)settings.lru_crawler_sleep * n;
+                if (tosleep > 1000000)
+                    tosleep = 1000000;
+                usleep(tosleep);
+                slept += tosleep;
             }
-            /* Now see if the item is refcount locked */
-            if (refcount_incr(&search->refcount) != 2) {
-                refcount_decr(&search->refcount);
-                if (hold_lock)
-                    item_trylock_unlock(hold_lock);
-                pthread_mutex_unlock(&cache_lock);
-                continue;
+            if (settings.lru_crawler_budget < 100) {
+                budget_batch += n;
+                if (budget_batch >= CRAWLER_BUDGET_BATCH) {
+                    crawler_throttle(&batch_start, slept);
+                    slept = 0;
+                    budget_batch = 0;
+                }
             }
+        }
+    } while (active);
+}
 
-            /* Frees the item or decrements the refcount. */
-            /* Interface for this could improve: do the free/decr here
-             * instead? */
-            item_crawler_evaluate(search, hv, i);
+static void *item_crawler_thread(void *arg) {
+    crawler_worker_t *me = arg;
 
-            if (hold_lock)
-                item_trylock_unlock(hold_lock);
-            pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_lock(&lru_crawler_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Starting LRU crawler background thread %d\n", me->id);
+    while (do_run_lru_crawler_thread || crawler_has_work(me->id)) {
+        if (!crawler_has_work(me->id)) {
+            /* The first thread also runs the autocrawl scheduler. */
+            if (me->id == 0 && settings.lru_crawler_autocrawl) {
+                struct timespec ts;
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                ts.tv_sec = tv.tv_sec + 1;
+                ts.tv_nsec = tv.tv_usec * 1000;
+                pthread_cond_timedwait(&lru_crawler_cond, &lru_crawler_lock, &ts);
+                if (do_run_lru_crawler_thread && lru_crawler_autocrawl_check() > 0)
+                    pthread_cond_broadcast(&lru_crawler_cond);
+            } else {
+                pthread_cond_wait(&lru_crawler_cond, &lru_crawler_lock);
+            }
+            continue;
+        }
 
-            if (settings.lru_crawler_sleep)
-                usleep(settings.lru_crawler_sleep);
+        crawler_active++;
+        pthread_mutex_unlock(&lru_crawler_lock);
+        crawler_crawl_classes(me);
+        if (me->dumplen)
+            crawler_dump_flush(me);
+        if (settings.verbose > 2)
+            fprintf(stderr, "LRU crawler thread %d sleeping\n", me->id);
+        pthread_mutex_lock(&lru_crawler_lock);
+        /* The last thread out finishes off a metadump. */
+        if (--crawler_active == 0 && crawler_client.c != NULL) {
+            int remaining;
+            CACHE_LOCK_BLOCKING();
+            remaining = crawler_count;
+            CACHE_UNLOCK();
+            if (remaining == 0) {
+                crawler_client_t done = crawler_client;
+                crawler_client.c = NULL;
+                pthread_mutex_unlock(&lru_crawler_lock);
+                if (!done.error)
+                    crawler_write_client(done.sfd, "END\r\n", 5);
+                redispatch_conn(done.c);
+                pthread_mutex_lock(&lru_crawler_lock);
+            }
         }
     }
-    if (settings.verbose > 2)
-        fprintf(stderr, "LRU crawler thread sleeping\n");
-    STATS_LOCK();
-    stats.lru_crawler_running = false;
-    STATS_UNLOCK();
-    }
     pthread_mutex_unlock(&lru_crawler_lock);
     if (settings.verbose > 2)
-        fprintf(stderr, "LRU crawler thread stopping\n");
+        fprintf(stderr, "LRU crawler thread %d stopping\n", me->id);
 
     return NULL;
 }
 
-static pthread_t item_crawler_tid;
-
 int stop_item_crawler_thread(void) {
-    int ret;
+    int i, ret;
     pthread_mutex_lock(&lru_crawler_lock);
     do_run_lru_crawler_thread = 0;
-    pthread_cond_signal(&lru_crawler_cond);
+    pthread_cond_broadcast(&lru_crawler_cond);
     pthread_mutex_unlock(&lru_crawler_lock);
-    if ((ret = pthread_join(item_crawler_tid, NULL)) != 0) {
-        fprintf(stderr, "Failed to stop LRU crawler thread: %s\n", strerror(ret));
-        return -1;
+    for (i = 0; i < crawler_nworkers; i++) {
+        if ((ret = pthread_join(crawler_workers[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Failed to stop LRU crawler thread: %s\n", strerror(ret));
+            return -1;
+        }
+        free(crawler_workers[i].dumpbuf);
     }
+    free(crawler_workers);
+    crawler_workers = NULL;
+    crawler_nworkers = 0;
     settings.lru_crawler = false;
     return 0;
 }
 
 int start_item_crawler_thread(void) {
-    int ret;
+    int i, ret;
 
     if (settings.lru_crawler)
         return -1;
+    crawler_workers = calloc(settings.lru_crawler_threads,
+                             sizeof(crawler_worker_t));
+    if (crawler_workers == NULL) {
+        fprintf(stderr, "Can't allocate LRU crawler threads\n");
+        return -1;
+    }
     pthread_mutex_lock(&lru_crawler_lock);
     do_run_lru_crawler_thread = 1;
     settings.lru_crawler = true;
-    if ((ret = pthread_create(&item_crawler_tid, NULL,
-        item_crawler_thread, NULL)) != 0) {
-        fprintf(stderr, "Can't create LRU crawler thread: %s\n",
-            strerror(ret));
-        pthread_mutex_unlock(&lru_crawler_lock);
-        return -1;
+    crawler_nworkers = settings.lru_crawler_threads;
+    for (i = 0; i < crawler_nworkers; i++) {
+        crawler_workers[i].id = i;
+        crawler_workers[i].dumpbuf = malloc(CRAWLER_DUMP_BUFSIZE);
+        if (crawler_workers[i].dumpbuf == NULL) {
+            fprintf(stderr, "Can't allocate LRU crawler dump buffer\n");
+            crawler_nworkers = i;
+            pthread_mutex_unlock(&lru_crawler_lock);
+            stop_item_crawler_thread();
+            return -1;
+        }
+        if ((ret = pthread_create(&crawler_workers[i].tid, NULL,
+            item_crawler_thread, &crawler_workers[i])) != 0) {
+            fprintf(stderr, "Can't create LRU crawler thread: %s\n",
+                strerror(ret));
+            free(crawler_workers[i].dumpbuf);
+            crawler_nworkers = i;
+            pthread_mutex_unlock(&lru_crawler_lock);
+            stop_item_crawler_thread();
+            return -1;
+        }
     }
     pthread_mutex_unlock(&lru_crawler_lock);
 
     return 0;
 }
 
-enum crawler_result_type lru_crawler_crawl(char *slabs) {
+/* Links a crawler into the tail of every requested class that has items.
+ * Caller must hold lru_crawler_lock. Returns the number of classes kicked,
+ * or -1 if the previous request is still being crawled. */
+static int do_lru_crawler_start(uint8_t *tocrawl,
+                                enum crawler_run_type type) {
+    uint32_t sid;
+    int starts = 0;
+
+    CACHE_LOCK_BLOCKING();
+    if (crawler_count != 0 || crawler_client.c != NULL) {
+        CACHE_UNLOCK();
+        return -1;
+    }
+    for (sid = POWER_SMALLEST; sid < LARGEST_ID; sid++) {
+        if (tocrawl[sid] != 0 && tails[sid] != NULL &&
+            crawlers[sid].it_flags != 1) {
+            if (settings.verbose > 2)
+                fprintf(stderr, "Kicking LRU crawler off for slab %d\n", sid);
+            crawlers[sid].nbytes = 0;
+            crawlers[sid].nkey = 0;
+            crawlers[sid].it_flags = 1; /* For a crawler, this means enabled. */
+            ITEM_set_next(&crawlers[sid], 0);
+            ITEM_set_prev(&crawlers[sid], 0);
+            crawlers[sid].time = 0;
+            /* A metadump always covers the whole class. */
+            crawlers[sid].remaining = type == CRAWLER_METADUMP ?
+                0 : settings.lru_crawler_tocrawl;
+            crawlers[sid].slabs_clsid = sid;
+            crawler_link_q((item *)&crawlers[sid]);
+            memset(&crawlerstats_run[sid], 0, sizeof(crawlerstats_t));
+            crawlerstats_run[sid].start_time = current_time;
+            crawler_count++;
+            starts++;
+        }
+    }
+    if (starts) {
+        gettimeofday(&crawler_pass_start, NULL);
+        crawler_pass_checked = 0;
+        crawler_run_type = type;
+    }
+    CACHE_UNLOCK();
+    if (starts) {
+        STATS_LOCK();
+        stats.lru_crawler_running = true;
+        stats.lru_crawler_starts += starts;
+        STATS_UNLOCK();
+    }
+    return starts;
+}
+
+/* Called from the crawler thread while idle in autocrawl mode. For every
+ * class whose last pass finished, nudge the wait before the next pass
+ * towards the point where the TTL histogram says at least 1% of the items
+ * that can expire will have done so, then kick off the classes that are
+ * due. Caller must hold lru_crawler_lock. */
+static int lru_crawler_autocrawl_check(void) {
+    uint8_t tocrawl[LARGEST_ID];
+    int i, x;
+    int todo = 0;
+
+    memset(tocrawl, 0, sizeof(tocrawl));
+    CACHE_LOCK_BLOCKING();
+    if (crawler_count != 0) {
+        CACHE_UNLOCK();
+        return 0;
+    }
+    for (i = POWER_SMALLEST; i < LARGEST_ID; i++) {
+        crawlerstats_t *s = &crawlerstats[i];
+        if (s->run_complete) {
+            uint64_t possible_reclaims = s->seen - s->noexp;
+            uint64_t low_watermark = (possible_reclaims / 100) + 1;
+            uint64_t available_reclaims = 0;
+            for (x = 0; x < CRAWLER_HISTO_BUCKETS; x++) {
+                available_reclaims += s->histo[x];
+                if (available_reclaims > low_watermark)
+                    break;
+            }
+            if (x == CRAWLER_HISTO_BUCKETS) {
+                /* Nothing worth reclaiming within the hour; back off. */
+                next_crawl_wait[i] += 60;
+            } else if (next_crawl_wait[i] < (rel_time_t)x * 60) {
+                next_crawl_wait[i] += 60;
+            } else if (next_crawl_wait[i] >= 60) {
+                next_crawl_wait[i] -= 60;
+            }
+            if (next_crawl_wait[i] > AUTOCRAWL_MAX_WAIT)
+                next_crawl_wait[i] = AUTOCRAWL_MAX_WAIT;
+            next_crawls[i] = s->end_time + next_crawl_wait[i] + AUTOCRAWL_MIN_WAIT;
+            s->run_complete = false;
+        }
+        if (tails[i] != NULL && current_time >= next_crawls[i]) {
+            tocrawl[i] = 1;
+            todo++;
+            next_crawls[i] = current_time + AUTOCRAWL_MIN_WAIT;
+        }
+    }
+    CACHE_UNLOCK();
+
+    return todo ? do_lru_crawler_start(tocrawl, CRAWLER_EXPIRED) : 0;
+}
+
+/* Starts a crawl of the given classes. For a metadump "c" is the client
+ * connection the dump is written to; on CRAWLER_OK the crawler owns it
+ * until it hands it back with redispatch_conn(). */
+enum crawler_result_type lru_crawler_crawl(char *slabs,
+                                           enum crawler_run_type type,
+                                           conn *c) {
     char *b = NULL;
     uint32_t sid = 0;
-    uint8_t tocrawl[POWER_LARGEST];
+    uint8_t tocrawl[LARGEST_ID];
+    int starts;
     if (pthread_mutex_trylock(&lru_crawler_lock) != 0) {
         return CRAWLER_RUNNING;
     }
-    pthread_mutex_lock(&cache_lock);
+    memset(tocrawl, 0, sizeof(tocrawl));
 
     if (strcmp(slabs, "all") == 0) {
         for (sid = 0; sid < LARGEST_ID; sid++) {
@@ -891,8 +1618,7 @@ enum crawler_result_type lru_crawler_crawl(char *slabs) {
              p = strtok_r(NULL, ",", &b)) {
 
             if (!safe_strtoul(p, &sid) || sid < POWER_SMALLEST
-                    || sid > POWER_LARGEST) {
-                pthread_mutex_unlock(&cache_lock);
+                    || sid >= LARGEST_ID) {
                 pthread_mutex_unlock(&lru_crawler_lock);
                 return CRAWLER_BADCLASS;
             }
@@ -900,29 +1626,30 @@ enum crawler_result_type lru_crawler_crawl(char *slabs) {
         }
     }
 
-    for (sid = 0; sid < LARGEST_ID; sid++) {
-        if (tocrawl[sid] != 0 && tails[sid] != NULL) {
-            if (settings.verbose > 2)
-                fprintf(stderr, "Kicking LRU crawler off for slab %d\n", sid);
-            crawlers[sid].nbytes = 0;
-            crawlers[sid].nkey = 0;
-            crawlers[sid].it_flags = 1; /* For a crawler, this means enabled. */
-            crawlers[sid].next = 0;
-            crawlers[sid].prev = 0;
-            crawlers[sid].time = 0;
-            crawlers[sid].remaining = settings.lru_crawler_tocrawl;
-            crawlers[sid].slabs_clsid = sid;
-            crawler_link_q((item *)&crawlers[sid]);
-            crawler_count++;
+    starts = do_lru_crawler_start(tocrawl, type);
+    if (starts > 0) {
+        if (type == CRAWLER_METADUMP) {
+            crawler_client.c = c;
+            crawler_client.sfd = c->sfd;
+            crawler_client.error = false;
         }
+        pthread_cond_broadcast(&lru_crawler_cond);
     }
-    pthread_mutex_unlock(&cache_lock);
-    pthread_cond_signal(&lru_crawler_cond);
-    STATS_LOCK();
-    stats.lru_crawler_running = true;
-    STATS_UNLOCK();
     pthread_mutex_unlock(&lru_crawler_lock);
-    return CRAWLER_OK;
+    if (starts < 0)
+        return CRAWLER_RUNNING;
+    return starts == 0 ? CRAWLER_NOTSTARTED : CRAWLER_OK;
+}
+
+/* Switches the autocrawler on or off. A crawler thread blocked waiting for
+ * work is woken so it picks up the new mode; one that is busy crawling will
+ * see it once the current pass completes. */
+void lru_crawler_autocrawl_set(bool enabled) {
+    settings.lru_crawler_autocrawl = enabled;
+    if (pthread_mutex_trylock(&lru_crawler_lock) == 0) {
+        pthread_cond_broadcast(&lru_crawler_cond);
+        pthread_mutex_unlock(&lru_crawler_lock);
+    }
 }
 
 int init_lru_crawler(void) {
@@ -932,6 +1659,13 @@ int init_lru_crawler(void) {
             return -1;
         }
         pthread_mutex_init(&lru_crawler_lock, NULL);
+#ifdef COMPACT_ITEMS
+        crawlers = slabs_arena_reserve(sizeof(crawler) * LARGEST_ID);
+        if (crawlers == NULL) {
+            fprintf(stderr, "Can't allocate lru crawlers\n");
+            return -1;
+        }
+#endif
         lru_crawler_initialized = 1;
     }
     return 0;
@@ -4,6 +4,7 @@ uint64_t get_cas_id(void);
 /*@null@*/
 item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes, const uint32_t cur_hv);
 void item_free(item *it);
+void item_free_chunks(item *it);
 bool item_size_ok(const size_t nkey, const int flags, const int nbytes);
 
 int  do_item_link(item *it, const uint32_t hv);     /** may fail if transgresses limits */
@@ -12,6 +13,12 @@ void do_item_unlink_nolock(item *it, const uint32_t hv);
 void do_item_remove(item *it);
 void do_item_update(item *it);   /** update LRU time to current and reposition */
 int  do_item_replace(item *it, item *new_it, const uint32_t hv);
+void do_item_relocate_nolock(item *it, item *new_it, const uint32_t hv);
+
+/* Access to item values, whether chunked or not */
+void item_data_read(item *it, int off, char *buf, int len);
+void item_data_write(item *it, int off, const char *buf, int len);
+void item_data_copy(item *dst, int off, item *src, int len);
 
 /*@null@*/
 char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
@@ -26,12 +33,26 @@ item *do_item_touch(const char *key, const size_t nkey, uint32_t exptime, const
 void item_stats_reset(void);
 extern pthread_mutex_t cache_lock;
 void item_stats_evictions(uint64_t *evicted);
+void item_stats_tail_ages(int *ages);
+/* Copy of the linked item size histogram, where bucket n counts items of
+ * up to n * bucket bytes, and of the per class item counts. NULL if nothing
+ * was linked yet; caller frees. */
+unsigned int *item_stats_histogram(unsigned int *nbuckets,
+                                   unsigned int *bucket, uint64_t *chunked,
+                                   unsigned int *counts);
 
 enum crawler_result_type {
-    CRAWLER_OK=0, CRAWLER_RUNNING, CRAWLER_BADCLASS
+    CRAWLER_OK=0, CRAWLER_RUNNING, CRAWLER_BADCLASS, CRAWLER_NOTSTARTED
+};
+
+enum crawler_run_type {
+    CRAWLER_EXPIRED=0, CRAWLER_METADUMP
 };
 
 int start_item_crawler_thread(void);
 int stop_item_crawler_thread(void);
 int init_lru_crawler(void);
-enum crawler_result_type lru_crawler_crawl(char *slabs);
+enum crawler_result_type lru_crawler_crawl(char *slabs,
+                                           enum crawler_run_type type,
+                                           conn *c);
+void lru_crawler_autocrawl_set(bool enabled);
@@ -0,0 +1,94 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Lock contention and hold time profiler. See lockprof.h.
+ */
+#include "config.h"
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "lockprof.h"
+
+volatile bool lockprof_enabled = false;
+uint64_t lockprof_locked_at[LOCKPROF_COUNT];
+
+static struct lockprof_stats lockprof_stats[LOCKPROF_COUNT];
+
+static const char *lockprof_names[LOCKPROF_COUNT] = {
+    "cache_lock",
+    "item_locks",
+    "slabs_lock",
+    "stats_lock",
+    "cache_t"
+};
+
+/* Counters are bumped by every thread taking the lock, outside of it. */
+#ifdef HAVE_GCC_ATOMICS
+#define lockprof_add(v, n) __sync_fetch_and_add(&(v), (n))
+#else
+#define lockprof_add(v, n) ((v) += (n))
+#endif
+
+uint64_t lockprof_now(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+}
+
+static int lockprof_bucket(uint64_t ns) {
+    uint64_t usec = ns / 1000;
+    int b = 0;
+    while (usec > 0 && b < LOCKPROF_HISTO_BUCKETS - 1) {
+        usec >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void lockprof_lock_slow(pthread_mutex_t *mutex, enum lockprof_id id,
+                        uint64_t *locked_at, bool spin) {
+    struct lockprof_stats *s = &lockprof_stats[id];
+    uint64_t *at = locked_at ? locked_at : &lockprof_locked_at[id];
+
+    if (pthread_mutex_trylock(mutex) != 0) {
+        uint64_t start = lockprof_now();
+        if (spin) {
+            while (pthread_mutex_trylock(mutex));
+        } else {
+            pthread_mutex_lock(mutex);
+        }
+        *at = lockprof_now();
+        uint64_t waited = *at - start;
+        lockprof_add(s->contended, 1);
+        lockprof_add(s->wait_ns, waited);
+        lockprof_add(s->wait_histo[lockprof_bucket(waited)], 1);
+    } else {
+        *at = lockprof_now();
+        lockprof_add(s->wait_histo[0], 1);
+    }
+    lockprof_add(s->acquires, 1);
+}
+
+void lockprof_record_hold(enum lockprof_id id, uint64_t held_ns) {
+    struct lockprof_stats *s = &lockprof_stats[id];
+    lockprof_add(s->hold_ns, held_ns);
+    lockprof_add(s->hold_histo[lockprof_bucket(held_ns)], 1);
+}
+
+void lockprof_get_stats(enum lockprof_id id, struct lockprof_stats *out) {
+    memcpy(out, &lockprof_stats[id], sizeof(*out));
+}
+
+void lockprof_reset(void) {
+    memset(lockprof_stats, 0, sizeof(lockprof_stats));
+}
+
+const char *lockprof_name(enum lockprof_id id) {
+    return lockprof_names[id];
+}
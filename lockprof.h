@@ -0,0 +1,105 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Optional lock profiler for the contended locks of the server. Each
+ * profiled lock site goes through lockprof_lock()/lockprof_unlock(); while
+ * profiling is disabled these cost a single branch over the plain
+ * pthread call.
+ */
+
+enum lockprof_id {
+    LOCKPROF_CACHE_LOCK,    /* global cache_lock */
+    LOCKPROF_ITEM_LOCKS,    /* striped item locks and the global item lock */
+    LOCKPROF_SLABS_LOCK,    /* slab allocator lock */
+    LOCKPROF_STATS_LOCK,    /* global stats lock */
+    LOCKPROF_CACHE_T,       /* mutex of each cache_t object cache */
+    LOCKPROF_COUNT
+};
+
+/* Histogram bucket i counts times below 2^i microseconds; the last bucket
+ * takes everything longer. */
+#define LOCKPROF_HISTO_BUCKETS 20
+
+struct lockprof_stats {
+    uint64_t acquires;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t hold_ns;
+    uint64_t wait_histo[LOCKPROF_HISTO_BUCKETS];
+    uint64_t hold_histo[LOCKPROF_HISTO_BUCKETS];
+};
+
+extern volatile bool lockprof_enabled;
+
+/* When a lock was taken, for locks that have a single instance. Locks with
+ * many instances keep their own and pass it in. */
+extern uint64_t lockprof_locked_at[LOCKPROF_COUNT];
+
+uint64_t lockprof_now(void);
+void lockprof_lock_slow(pthread_mutex_t *mutex, enum lockprof_id id,
+                        uint64_t *locked_at, bool spin);
+void lockprof_record_hold(enum lockprof_id id, uint64_t held_ns);
+
+/* Copies out the counters of one lock, or clears all of them. */
+void lockprof_get_stats(enum lockprof_id id, struct lockprof_stats *out);
+void lockprof_reset(void);
+const char *lockprof_name(enum lockprof_id id);
+
+/**
+ * Acquire a profiled lock. spin selects the trylock loop used by
+ * mutex_lock() over a blocking pthread_mutex_lock(). locked_at may be NULL
+ * for single instance locks.
+ */
+static inline void lockprof_lock(pthread_mutex_t *mutex, enum lockprof_id id,
+                                 uint64_t *locked_at, bool spin) {
+    if (!lockprof_enabled) {
+        if (spin) {
+            while (pthread_mutex_trylock(mutex));
+        } else {
+            pthread_mutex_lock(mutex);
+        }
+        return;
+    }
+    lockprof_lock_slow(mutex, id, locked_at, spin);
+}
+
+/* The hold time is recorded after the lock is dropped. A lock taken while
+ * profiling was off has no timestamp and is not counted. */
+static inline void lockprof_unlock(pthread_mutex_t *mutex,
+                                   enum lockprof_id id, uint64_t *locked_at) {
+    uint64_t *at = locked_at ? locked_at : &lockprof_locked_at[id];
+    uint64_t start = *at;
+    if (start == 0) {
+        pthread_mutex_unlock(mutex);
+        return;
+    }
+    *at = 0;
+    uint64_t now = lockprof_now();
+    pthread_mutex_unlock(mutex);
+    lockprof_record_hold(id, now - start);
+}
+
+/* pthread_cond_wait() on a profiled lock. The time spent waiting on the
+ * condition is not hold time. */
+static inline void lockprof_cond_wait(pthread_cond_t *cond,
+                                      pthread_mutex_t *mutex,
+                                      enum lockprof_id id,
+                                      uint64_t *locked_at) {
+    uint64_t *at = locked_at ? locked_at : &lockprof_locked_at[id];
+    if (*at != 0) {
+        lockprof_record_hold(id, lockprof_now() - *at);
+        *at = 0;
+    }
+    pthread_cond_wait(cond, mutex);
+    if (lockprof_enabled) {
+        *at = lockprof_now();
+    }
+}
+
+#endif
@@ -35,6 +35,18 @@
 #endif
 #include <pwd.h>
 #include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#ifdef USE_IO_URING
+#include <poll.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define USE_ZEROCOPY 1
+#endif
+#endif
 #include <fcntl.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -78,6 +90,7 @@ static void conn_set_state(conn *c, enum conn_states state);
 static void stats_init(void);
 static void server_stats(ADD_STAT add_stats, conn *c);
 static void process_stat_settings(ADD_STAT add_stats, void *c);
+static void process_stat_locks(ADD_STAT add_stats, void *c);
 static void conn_to_str(const conn *c, char *buf);
 
 
@@ -111,6 +124,7 @@ volatile int slab_rebalance_signal;
 
 /** file scope variables **/
 static conn *listen_conn = NULL;
+static bool listen_conns_accepting = true;
 static int max_fds;
 static struct event_base *main_base;
 
@@ -144,6 +158,19 @@ static void maxconns_handler(const int fd, const short which, void *arg) {
     }
 }
 
+/* The same polling, on a worker thread that owns listeners */
+static void listen_retry_handler(const int fd, const short which, void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    struct timeval t = {.tv_sec = 0, .tv_usec = 10000};
+
+    if (allow_new_conns == false) {
+        evtimer_add(&me->listen_retry_event, &t);
+    } else {
+        me->listen_retry = false;
+        accept_new_conns(true);
+    }
+}
+
 #define REALTIME_MAXDELTA 60*60*24*30
 
 /*
@@ -172,14 +199,16 @@ static rel_time_t realtime(const time_t exptime) {
 }
 
 static void stats_init(void) {
-    stats.curr_items = stats.total_items = stats.curr_conns = stats.total_conns = stats.conn_structs = stats.changes_after_last_snapshot = stats.slabs_num = 0;
+    stats.curr_conns = stats.total_conns = stats.conn_structs = stats.changes_after_last_snapshot = stats.slabs_num = 0;
     stats.get_cmds = stats.set_cmds = stats.get_hits = stats.get_misses = stats.evictions = stats.reclaimed = 0;
     stats.touch_cmds = stats.touch_misses = stats.touch_hits = stats.rejected_conns = 0;
     stats.malloc_fails = 0;
-    stats.curr_bytes = stats.listen_disabled_num = 0;
+    stats.listen_disabled_num = 0;
     stats.hash_power_level = stats.hash_bytes = stats.hash_is_expanding = 0;
     stats.expired_unfetched = stats.evicted_unfetched = 0;
     stats.slabs_moved = 0;
+    stats.slab_reassign_rescues = 0;
+    stats.slab_reassign_evictions = 0;
     stats.accepting_conns = true; /* assuming we start in this state. */
     stats.slab_reassign_running = false;
     stats.lru_crawler_running = false;
@@ -194,7 +223,7 @@ static void stats_init(void) {
 
 static void stats_reset(void) {
     STATS_LOCK();
-    stats.total_items = stats.total_conns = 0;
+    stats.total_conns = 0;
     stats.rejected_conns = 0;
     stats.malloc_fails = 0;
     stats.evictions = 0;
@@ -204,6 +233,7 @@ static void stats_reset(void) {
     STATS_UNLOCK();
     threadlocal_stats_reset();
     item_stats_reset();
+    lockprof_reset();
 }
 
 static void settings_init(void) {
@@ -233,9 +263,31 @@ static void settings_init(void) {
     settings.lru_crawler = false;
     settings.lru_crawler_sleep = 100;
     settings.lru_crawler_tocrawl = 0;
+    settings.lru_crawler_autocrawl = false;
+    settings.lru_crawler_budget = 100;
+    settings.lru_crawler_threads = 1;
     settings.hashpower_init = 0;
     settings.slab_reassign = false;
     settings.slab_automove = 0;
+    settings.slab_automove_ratio = 0.8;
+    settings.slab_automove_interval = 2;
+    settings.slab_chunk_max = 0;      /* item_size_max unless large items */
+    settings.large_item_max = 0;
+    settings.large_pages = false;
+    settings.numa_interleave = false;
+    settings.numa_local = false;
+    settings.prefault_threads = 0;
+    settings.reuseport = false;
+    settings.conn_placement = PLACE_ROUND_ROBIN;
+    settings.conn_migrate = false;
+    settings.udp_batch = UDP_BATCH_DEFAULT;
+    settings.zerocopy_min = 0;
+    settings.io_uring = false;
+    settings.conn_buffer_pool = false;
+    settings.idle_timeout = 0;
+    settings.worker_cpus = NULL;
+    settings.housekeeping_cpus = NULL;
+    settings.busy_poll = 0;
     settings.shutdown_command = false;
     settings.tail_repair_time = TAIL_REPAIR_TIME_DEFAULT;
     settings.flush_enabled = true;
@@ -345,6 +397,535 @@ static const char *prot_text(enum protocol prot) {
     return rv;
 }
 
+/* A UDP request that came in several datagrams, being put back together */
+struct udp_partial {
+    struct sockaddr_in6 addr;   /* who sent it */
+    socklen_t addr_size;        /* 0 if the slot is free */
+    int request_id;
+    int total;                  /* datagrams in the request */
+    int got;                    /* datagrams in so far */
+    rel_time_t started;
+    char *data;                 /* the pieces, in the order they came */
+    int bytes;
+    int size;
+    int off[UDP_REASSEMBLY_PARTS]; /* where each piece is in data, or -1 */
+    int len[UDP_REASSEMBLY_PARTS];
+};
+
+static void udp_partial_clear(struct udp_partial *p) {
+    free(p->data);
+    p->data = NULL;
+    p->addr_size = 0;
+}
+
+#ifdef UDP_BATCHING
+/*
+ * A vector of datagrams for recvmmsg()/sendmmsg(). Each has its own
+ * buffer and address, so replies to several clients can go out together.
+ */
+struct udp_batch {
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+    struct sockaddr_in6 *addrs;
+    char *bufs;
+    int size;       /* datagrams there is room for */
+    int used;       /* datagrams read, or queued to send */
+    int curr;       /* next read datagram to handle */
+};
+
+static void udp_batch_free(struct udp_batch *b) {
+    if (b == NULL)
+        return;
+    free(b->msgs);
+    free(b->iov);
+    free(b->addrs);
+    free(b->bufs);
+    free(b);
+}
+
+/* Big buffers are only touched as far as datagrams fill them */
+static struct udp_batch *udp_batch_new(int size, size_t bufsize) {
+    struct udp_batch *b = calloc(1, sizeof(struct udp_batch));
+    int i;
+
+    if (b == NULL)
+        return NULL;
+    b->msgs = calloc(size, sizeof(struct mmsghdr));
+    b->iov = calloc(size, sizeof(struct iovec));
+    b->addrs = calloc(size, sizeof(struct sockaddr_in6));
+    b->bufs = malloc(size * bufsize);
+    if (b->msgs == NULL || b->iov == NULL || b->addrs == NULL ||
+        b->bufs == NULL) {
+        udp_batch_free(b);
+        return NULL;
+    }
+
+    b->size = size;
+    for (i = 0; i < size; i++) {
+        b->iov[i].iov_base = b->bufs + i * bufsize;
+        b->iov[i].iov_len = bufsize;
+        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+    }
+    return b;
+}
+
+#define UDP_RX_PENDING(c) \
+    ((c)->udp_rx != NULL && (c)->udp_rx->curr < (c)->udp_rx->used)
+
+/*
+ * Sends the replies queued by transmit_udp_batch(). A datagram the socket
+ * has no room for is dropped, as the network is free to drop it anyway.
+ */
+static void udp_flush(conn *c) {
+    struct udp_batch *tx = c->udp_tx;
+    uint64_t bytes = 0;
+    int sent = 0;
+    int res, i;
+
+    if (tx == NULL || tx->used == 0)
+        return;
+
+    while (sent < tx->used) {
+        res = sendmmsg(c->sfd, tx->msgs + sent, tx->used - sent, 0);
+        if (res > 0) {
+            for (i = sent; i < sent + res; i++)
+                bytes += tx->msgs[i].msg_len;
+            sent += res;
+        } else if (res == -1 && errno == EINTR) {
+            continue;
+        } else if (res == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            /* this one datagram failed; skip it */
+            if (settings.verbose > 0)
+                perror("Failed to write UDP reply");
+            sent++;
+        } else {
+            break;
+        }
+    }
+    THR_STATS_ADD(c, bytes_written, bytes);
+    tx->used = 0;
+}
+#else
+#define UDP_RX_PENDING(c) false
+#define udp_flush(c)
+#endif
+
+#ifdef USE_ZEROCOPY
+/* An item kept alive while the kernel may still send from its memory */
+struct zerocopy_hold {
+    item *it;
+    uint32_t seq;       /* number the kernel gave the send */
+    struct timeval sent;
+};
+
+/*
+ * Lets go of the items held for sends up to and including seq hi. TCP
+ * finishes sends in order, so a notice for a range covers everything
+ * sent before it too.
+ */
+static void zerocopy_release(conn *c, uint32_t lo, uint32_t hi, bool copied) {
+    struct timeval now;
+    int done = 0;
+
+    gettimeofday(&now, NULL);
+    if (copied)
+        THR_STATS_ADD(c, zerocopy_copied, hi - lo + 1);
+    while (done < c->zc_holds_used &&
+           (int32_t)(c->zc_holds[done].seq - hi) <= 0) {
+        struct zerocopy_hold *h = &c->zc_holds[done];
+        item_remove(h->it);
+        THR_STATS_INCR(c, zerocopy_completions);
+        THR_STATS_ADD(c, zerocopy_completion_usec,
+                      (now.tv_sec - h->sent.tv_sec) * 1000000 +
+                      (now.tv_usec - h->sent.tv_usec));
+        done++;
+    }
+    c->zc_holds_used -= done;
+    memmove(c->zc_holds, c->zc_holds + done,
+            c->zc_holds_used * sizeof(struct zerocopy_hold));
+}
+
+/* Reads the kernel's completion notices off the socket's error queue. */
+static void zerocopy_reap(conn *c) {
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+
+    while (c->zc_holds_used > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->sfd, &msg, MSG_ERRQUEUE) == -1)
+            return;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+            zerocopy_release(c, serr->ee_info, serr->ee_data,
+                             serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+        }
+    }
+}
+
+/*
+ * The kernel can go on sending from a held item after the socket is closed,
+ * so a closing connection with holds left is only shut down. It then sits
+ * on a timer, not on events, which a shut down socket raises nonstop, and
+ * reaps until the last completion is in. Returns true while still waiting.
+ */
+static bool zerocopy_close_wait(conn *c) {
+    struct timeval tv = {0, ZEROCOPY_CLOSE_POLL_USEC};
+    struct event_base *base = c->event.ev_base;
+
+    zerocopy_reap(c);
+    if (c->zc_holds_used == 0)
+        return false;
+    if (!c->zc_closing) {
+        shutdown(c->sfd, SHUT_RDWR);
+        c->zc_closing = true;
+        event_del(&c->event);
+        event_set(&c->event, c->sfd, 0, event_handler, (void *)c);
+        event_base_set(base, &c->event);
+        c->ev_flags = 0;
+    }
+    event_add(&c->event, &tv);
+    return true;
+}
+
+/* The item, of those the connection is sending, that buf lies within */
+static item *zerocopy_item(conn *c, const char *buf, size_t len) {
+    item *it;
+    int i;
+
+    for (i = -1; i < c->ileft; i++) {
+        it = i < 0 ? c->item : c->icurr[i];
+        if (it == NULL || (it->it_flags & ITEM_CHUNKED))
+            continue;
+        if (buf >= (char *)it && buf + len <= (char *)it + ITEM_ntotal(it))
+            return it;
+    }
+    return NULL;
+}
+
+/*
+ * Sends like sendmsg(), except that an iovec of zerocopy_min bytes or
+ * more that lies in an item goes out alone with MSG_ZEROCOPY, and the
+ * item is held until the kernel says it is done with it. Whatever comes
+ * before it is sent first with MSG_MORE. Headers and suffixes live in
+ * buffers the connection reuses, so only item memory can skip the copy.
+ */
+static ssize_t zerocopy_sendmsg(conn *c, struct msghdr *m) {
+    struct msghdr part = *m;
+    item *it;
+    ssize_t res;
+    size_t i;
+
+    for (i = 0; i < m->msg_iovlen; i++) {
+        if (m->msg_iov[i].iov_len >= (size_t)settings.zerocopy_min)
+            break;
+    }
+    if (i == m->msg_iovlen)
+        return sendmsg(c->sfd, m, 0);
+    if (i > 0) {
+        part.msg_iovlen = i;
+        return sendmsg(c->sfd, &part, MSG_MORE);
+    }
+
+    if (c->zc_holds_used == ZEROCOPY_HOLDS_MAX)
+        zerocopy_reap(c);
+    if (c->zc_holds == NULL)
+        c->zc_holds = malloc(sizeof(struct zerocopy_hold) * ZEROCOPY_HOLDS_MAX);
+    it = zerocopy_item(c, m->msg_iov[0].iov_base, m->msg_iov[0].iov_len);
+    if (it == NULL || c->zc_holds == NULL ||
+        c->zc_holds_used == ZEROCOPY_HOLDS_MAX) {
+        THR_STATS_INCR(c, zerocopy_fallbacks);
+        return sendmsg(c->sfd, m, 0);
+    }
+
+    part.msg_iovlen = 1;
+    res = sendmsg(c->sfd, &part, MSG_ZEROCOPY);
+    if (res == -1 && errno == ENOBUFS) {
+        /* no room to pin more pages for this socket; copy instead */
+        THR_STATS_INCR(c, zerocopy_fallbacks);
+        return sendmsg(c->sfd, m, 0);
+    }
+    if (res > 0) {
+        struct zerocopy_hold *h = &c->zc_holds[c->zc_holds_used++];
+        refcount_incr(&it->refcount);
+        h->it = it;
+        h->seq = c->zc_seq++;
+        gettimeofday(&h->sent, NULL);
+        THR_STATS_INCR(c, zerocopy_sends);
+        THR_STATS_ADD(c, zerocopy_bytes, res);
+    }
+    return res;
+}
+#endif
+
+/*
+ * With -o conn_buffer_pool a client connection hands its buffers to its
+ * thread when it goes idle, and takes a set back when it has something to
+ * read, so buffer memory follows active connections rather than open ones.
+ * Only sets at their starting sizes are kept; conn_shrink() brings most
+ * back there between requests, and the rest are freed.
+ */
+struct conn_bufs {
+    struct conn_bufs *next;     /* lives at the start of the read buffer */
+    char *wbuf;
+    item **ilist;
+    char **suffixlist;
+    struct iovec *iov;
+    struct msghdr *msglist;
+};
+
+/* Memory in one set of buffers at their starting sizes */
+#define CONN_BUFS_BYTES (DATA_BUFFER_SIZE * 2 + \
+    sizeof(item *) * ITEM_LIST_INITIAL + \
+    sizeof(char *) * SUFFIX_LIST_INITIAL + \
+    sizeof(struct iovec) * IOV_LIST_INITIAL + \
+    sizeof(struct msghdr) * MSG_LIST_INITIAL)
+
+static void conn_buffers_init_sizes(conn *c, int rsize) {
+    c->rsize = rsize;
+    c->wsize = DATA_BUFFER_SIZE;
+    c->isize = ITEM_LIST_INITIAL;
+    c->suffixsize = SUFFIX_LIST_INITIAL;
+    c->iovsize = IOV_LIST_INITIAL;
+    c->msgsize = MSG_LIST_INITIAL;
+}
+
+static void conn_buffers_free(conn *c) {
+    free(c->rbuf);
+    free(c->wbuf);
+    free(c->ilist);
+    free(c->suffixlist);
+    free(c->iov);
+    free(c->msglist);
+    c->rbuf = c->wbuf = NULL;
+    c->ilist = NULL;
+    c->suffixlist = NULL;
+    c->iov = NULL;
+    c->msglist = NULL;
+}
+
+/* Gives the connection a fresh set of buffers. On failure it has none. */
+static bool conn_buffers_alloc(conn *c, int rsize) {
+    conn_buffers_init_sizes(c, rsize);
+    c->rbuf = (char *)malloc((size_t)c->rsize);
+    c->wbuf = (char *)malloc((size_t)c->wsize);
+    c->ilist = (item **)malloc(sizeof(item *) * c->isize);
+    c->suffixlist = (char **)malloc(sizeof(char *) * c->suffixsize);
+    c->iov = (struct iovec *)malloc(sizeof(struct iovec) * c->iovsize);
+    c->msglist = (struct msghdr *)malloc(sizeof(struct msghdr) * c->msgsize);
+
+    if (c->rbuf == 0 || c->wbuf == 0 || c->ilist == 0 || c->iov == 0 ||
+            c->msglist == 0 || c->suffixlist == 0) {
+        conn_buffers_free(c);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Puts an idle client connection's buffers in its thread's pool, or frees
+ * them if they've grown or the pool is full. Does nothing while anything
+ * is still read in or waiting to go out.
+ */
+void conn_buffers_release(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+    struct conn_bufs *b;
+
+    if (c->rbuf == NULL || IS_UDP(c->transport) || c->rbytes > 0 ||
+        c->ileft > 0 || c->suffixleft > 0 || c->write_and_free != NULL) {
+        return;
+    }
+
+    if (c->rsize == DATA_BUFFER_SIZE && c->wsize == DATA_BUFFER_SIZE &&
+        c->isize == ITEM_LIST_INITIAL &&
+        c->suffixsize == SUFFIX_LIST_INITIAL &&
+        c->iovsize == IOV_LIST_INITIAL && c->msgsize == MSG_LIST_INITIAL &&
+        t->buf_pool_count < CONN_BUF_POOL_MAX) {
+        b = (struct conn_bufs *)c->rbuf;
+        b->wbuf = c->wbuf;
+        b->ilist = c->ilist;
+        b->suffixlist = c->suffixlist;
+        b->iov = c->iov;
+        b->msglist = c->msglist;
+        b->next = t->buf_pool;
+        t->buf_pool = b;
+        t->buf_pool_count++;
+        c->rbuf = c->wbuf = NULL;
+        c->ilist = NULL;
+        c->suffixlist = NULL;
+        c->iov = NULL;
+        c->msglist = NULL;
+    } else {
+        conn_buffers_free(c);
+    }
+
+    c->rcurr = c->wcurr = NULL;
+    c->icurr = NULL;
+    c->suffixcurr = NULL;
+    c->msgcurr = c->msgused = c->iovused = 0;
+    t->bufs_attached--;
+}
+
+/* Gives a client connection a set of buffers from its thread's pool, or
+ * fresh ones if the pool is empty. */
+static bool conn_buffers_attach(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+    struct conn_bufs *b = t->buf_pool;
+
+    if (b != NULL) {
+        t->buf_pool = b->next;
+        t->buf_pool_count--;
+        c->rbuf = (char *)b;
+        c->wbuf = b->wbuf;
+        c->ilist = b->ilist;
+        c->suffixlist = b->suffixlist;
+        c->iov = b->iov;
+        c->msglist = b->msglist;
+        conn_buffers_init_sizes(c, DATA_BUFFER_SIZE);
+    } else if (!conn_buffers_alloc(c, DATA_BUFFER_SIZE)) {
+        STATS_LOCK();
+        stats.malloc_fails++;
+        STATS_UNLOCK();
+        return false;
+    }
+
+    c->rcurr = c->rbuf;
+    c->wcurr = c->wbuf;
+    c->icurr = c->ilist;
+    c->suffixcurr = c->suffixlist;
+    t->bufs_attached++;
+    return true;
+}
+
+#ifdef USE_IO_URING
+/* What a connection on the ring is waiting for */
+enum uring_ops {
+    URING_OP_NONE = 0,
+    URING_OP_RECV,      /* a command, read into a provided buffer */
+    URING_OP_SEND,      /* transmit()'s current message */
+    URING_OP_POLL       /* readiness, to read or write the usual way */
+};
+
+/* uring_rres after a poll: try_read_network() reads the socket itself */
+#define URING_READ_DIRECT INT_MIN
+
+/*
+ * Moves a new client connection off libevent and onto its thread's ring,
+ * and starts it waiting for a command.
+ */
+void conn_uring_start(conn *c) {
+    event_del(&c->event);
+    c->ev_flags = 0;
+    c->uring = true;
+    c->zerocopy = false;
+    drive_machine(c);
+}
+
+/*
+ * update_event() for a connection on the ring, which has no events: the
+ * wait becomes a request that completes when the socket is ready. Waiting
+ * for a command reads it into a provided buffer as it arrives. Values are
+ * still read straight into their items, so waits for those only poll.
+ */
+static bool conn_uring_wait(conn *c, const int new_flags) {
+    struct uring *r = c->thread->ring;
+    bool ok;
+
+    if (c->uring_op != URING_OP_NONE)
+        return true;
+    if (new_flags & EV_WRITE) {
+        ok = uring_poll(r, c->sfd, POLLOUT, c);
+        c->uring_op = URING_OP_POLL;
+    } else if (c->state == conn_waiting || c->state == conn_new_cmd) {
+        ok = uring_recv(r, c->sfd, c);
+        c->uring_op = URING_OP_RECV;
+    } else {
+        ok = uring_poll(r, c->sfd, POLLIN, c);
+        c->uring_op = URING_OP_POLL;
+    }
+    if (!ok)
+        c->uring_op = URING_OP_NONE;
+    return ok;
+}
+
+/* Adds what a ring read brought in to the read buffer, growing it as
+ * try_read_network() would. */
+static bool conn_uring_append(conn *c, const char *buf, int len) {
+    if (c->rbuf == NULL && !conn_buffers_attach(c))
+        return false;
+    if (c->rcurr != c->rbuf) {
+        if (c->rbytes != 0)
+            memmove(c->rbuf, c->rcurr, c->rbytes);
+        c->rcurr = c->rbuf;
+    }
+    while (c->rsize - c->rbytes < len) {
+        char *new_rbuf = realloc(c->rbuf, c->rsize * 2);
+        if (!new_rbuf)
+            return false;
+        c->rcurr = c->rbuf = new_rbuf;
+        c->rsize *= 2;
+    }
+    memcpy(c->rbuf + c->rbytes, buf, len);
+    c->rbytes += len;
+    return true;
+}
+
+/*
+ * Called by the thread's ring for each finished request: records what it
+ * did and runs the state machine on from where it stopped to wait.
+ */
+void conn_uring_complete(void *data, int res, const char *buf) {
+    conn *c = data;
+    int op = c->uring_op;
+
+    c->uring_op = URING_OP_NONE;
+    if (c->uring_closing) {
+        c->uring_closing = false;
+        conn_close(c);
+        return;
+    }
+
+    switch (op) {
+    case URING_OP_RECV:
+        if (res == -ENOBUFS) {
+            /* the thread's buffers are all in use; wait for data instead */
+            if (uring_poll(c->thread->ring, c->sfd, POLLIN, c)) {
+                c->uring_op = URING_OP_POLL;
+                return;
+            }
+            res = URING_READ_DIRECT;
+        } else if (res > 0) {
+            if (conn_uring_append(c, buf, res)) {
+                THR_STATS_ADD(c, bytes_read, res);
+            } else {
+                res = -ENOMEM;
+            }
+        }
+        c->uring_rres = res;
+        break;
+    case URING_OP_SEND:
+        c->uring_wres = res;
+        break;
+    case URING_OP_POLL:
+        if (c->state == conn_read)
+            c->uring_rres = URING_READ_DIRECT;
+        break;
+    }
+    drive_machine(c);
+}
+#endif
+
 conn *conn_new(const int sfd, enum conn_states init_state,
                 const int event_flags,
                 const int read_buffer_size, enum network_transport transport,
@@ -370,32 +951,11 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         c->iov = 0;
         c->msglist = 0;
         c->hdrbuf = 0;
-
-        c->rsize = read_buffer_size;
-        c->wsize = DATA_BUFFER_SIZE;
-        c->isize = ITEM_LIST_INITIAL;
-        c->suffixsize = SUFFIX_LIST_INITIAL;
-        c->iovsize = IOV_LIST_INITIAL;
-        c->msgsize = MSG_LIST_INITIAL;
+        c->udp_rx = c->udp_tx = NULL;
+        c->zc_holds = NULL;
+        c->zc_holds_used = 0;
         c->hdrsize = 0;
 
-        c->rbuf = (char *)malloc((size_t)c->rsize);
-        c->wbuf = (char *)malloc((size_t)c->wsize);
-        c->ilist = (item **)malloc(sizeof(item *) * c->isize);
-        c->suffixlist = (char **)malloc(sizeof(char *) * c->suffixsize);
-        c->iov = (struct iovec *)malloc(sizeof(struct iovec) * c->iovsize);
-        c->msglist = (struct msghdr *)malloc(sizeof(struct msghdr) * c->msgsize);
-
-        if (c->rbuf == 0 || c->wbuf == 0 || c->ilist == 0 || c->iov == 0 ||
-                c->msglist == 0 || c->suffixlist == 0) {
-            conn_free(c);
-            STATS_LOCK();
-            stats.malloc_fails++;
-            STATS_UNLOCK();
-            fprintf(stderr, "Failed to allocate buffers for connection\n");
-            return NULL;
-        }
-
         STATS_LOCK();
         stats.conn_structs++;
         STATS_UNLOCK();
@@ -404,9 +964,39 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         conns[sfd] = c;
     }
 
+    /* A pooling client connection takes its buffers when it first has
+     * something to read */
+    if (c->rbuf == NULL &&
+        !(settings.conn_buffer_pool && init_state == conn_new_cmd) &&
+        !conn_buffers_alloc(c, read_buffer_size)) {
+        conn_free(c);
+        STATS_LOCK();
+        stats.malloc_fails++;
+        stats.conn_structs--;
+        STATS_UNLOCK();
+        fprintf(stderr, "Failed to allocate buffers for connection\n");
+        return NULL;
+    }
+
     c->transport = transport;
     c->protocol = settings.binding_protocol;
 
+#ifdef UDP_BATCHING
+    if (IS_UDP(transport) && settings.udp_batch > 1 && c->udp_rx == NULL) {
+        c->udp_rx = udp_batch_new(settings.udp_batch, c->rsize);
+        c->udp_tx = udp_batch_new(settings.udp_batch, UDP_MAX_PAYLOAD_SIZE);
+        if (c->udp_rx == NULL || c->udp_tx == NULL) {
+            /* works without, a datagram at a time */
+            udp_batch_free(c->udp_rx);
+            udp_batch_free(c->udp_tx);
+            c->udp_rx = c->udp_tx = NULL;
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+        }
+    }
+#endif
+
     /* unix socket mode doesn't need this, so zeroed out.  but why
      * is this done for every command?  presumably for UDP
      * mode.  */
@@ -424,6 +1014,33 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         }
     }
 
+    c->zerocopy = false;
+    c->zc_closing = false;
+    c->zc_seq = 0;
+    c->uring = false;
+#ifdef USE_IO_URING
+    c->uring_closing = false;
+    c->uring_op = URING_OP_NONE;
+    c->uring_rres = c->uring_wres = -EAGAIN;
+#endif
+#ifdef SO_BUSY_POLL
+    if (settings.busy_poll > 0 && transport != local_transport &&
+        init_state != conn_listening) {
+        /* the kernel polls the device queue on reads; an error only
+         * means we can't, without CAP_NET_ADMIN */
+        setsockopt(sfd, SOL_SOCKET, SO_BUSY_POLL, &settings.busy_poll,
+                   sizeof(settings.busy_poll));
+    }
+#endif
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_min > 0 && transport == tcp_transport &&
+        init_state == conn_new_cmd) {
+        int on = 1;
+        c->zerocopy = setsockopt(sfd, SOL_SOCKET, SO_ZEROCOPY,
+                                 &on, sizeof(on)) == 0;
+    }
+#endif
+
     if (settings.verbose > 1) {
         if (init_state == conn_listening) {
             fprintf(stderr, "<%d server listening (%s)\n", sfd,
@@ -451,6 +1068,7 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->wcurr = c->wbuf;
     c->rcurr = c->rbuf;
     c->ritem = 0;
+    c->rchunk = NULL;
     c->icurr = c->ilist;
     c->suffixcurr = c->suffixlist;
     c->ileft = 0;
@@ -459,6 +1077,8 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->msgcurr = 0;
     c->msgused = 0;
     c->authenticated = false;
+    c->last_cmd_time = current_time;
+    c->thread_next = c->thread_prev = NULL;
 
     c->write_and_go = init_state;
     c->write_and_free = 0;
@@ -556,6 +1176,12 @@ void conn_free(conn *c) {
             free(c->suffixlist);
         if (c->iov)
             free(c->iov);
+#ifdef UDP_BATCHING
+        udp_batch_free(c->udp_rx);
+        udp_batch_free(c->udp_tx);
+#endif
+        if (c->zc_holds)
+            free(c->zc_holds);
         free(c);
     }
 }
@@ -563,6 +1189,20 @@ void conn_free(conn *c) {
 static void conn_close(conn *c) {
     assert(c != NULL);
 
+#ifdef USE_IO_URING
+    if (c->uring_op != URING_OP_NONE) {
+        /* The ring still has a request on the socket. Shutting it down
+         * ends that, and its completion comes back here. */
+        shutdown(c->sfd, SHUT_RDWR);
+        c->uring_closing = true;
+        return;
+    }
+#endif
+#ifdef USE_ZEROCOPY
+    if (c->zc_holds_used > 0 && zerocopy_close_wait(c))
+        return;
+#endif
+
     /* delete the event, the socket and the conn */
     event_del(&c->event);
 
@@ -570,6 +1210,11 @@ static void conn_close(conn *c) {
         fprintf(stderr, "<%d connection closed.\n", c->sfd);
 
     conn_cleanup(c);
+    if (settings.conn_buffer_pool && c->thread != NULL) {
+        /* any half read request goes with the connection */
+        c->rbytes = 0;
+        conn_buffers_release(c);
+    }
 
     MEMCACHED_CONN_RELEASE(c->sfd);
     conn_set_state(c, conn_closed);
@@ -579,6 +1224,11 @@ static void conn_close(conn *c) {
     allow_new_conns = true;
     pthread_mutex_unlock(&conn_lock);
 
+    if (c->thread != NULL && !IS_UDP(c->transport)) {
+        conn_thread_unlink(c);
+        THR_CONNS_ADD(c->thread, -1);
+    }
+
     STATS_LOCK();
     stats.curr_conns--;
     STATS_UNLOCK();
@@ -586,6 +1236,70 @@ static void conn_close(conn *c) {
     return;
 }
 
+/*
+ * Puts a client connection on its thread's conn_list, unless it's there
+ * already because it only went out to the crawler and back.
+ */
+void conn_thread_link(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+
+    if (c->thread_prev != NULL || t->conn_list == c)
+        return;
+    c->thread_next = t->conn_list;
+    if (t->conn_list != NULL)
+        t->conn_list->thread_prev = c;
+    t->conn_list = c;
+}
+
+/* Takes a connection off its thread's conn_list, if it's on it. */
+void conn_thread_unlink(conn *c) {
+    LIBEVENT_THREAD *t = c->thread;
+
+    if (c->thread_prev != NULL)
+        c->thread_prev->thread_next = c->thread_next;
+    else if (t->conn_list == c)
+        t->conn_list = c->thread_next;
+    else
+        return;
+    if (c->thread_next != NULL)
+        c->thread_next->thread_prev = c->thread_prev;
+    c->thread_next = c->thread_prev = NULL;
+}
+
+/*
+ * Closes this thread's client connections that have gone longer than
+ * -o idle_timeout without a command while waiting on the client. Only the
+ * owner ever closes a connection, so the scan takes no locks; the clock
+ * handler asks each worker for one a second.
+ */
+void conn_idle_scan(LIBEVENT_THREAD *me) {
+    conn *c, *next;
+
+    for (c = me->conn_list; c != NULL; c = next) {
+        next = c->thread_next;
+        /* not conn_watch, whose socket the crawler is writing to */
+        if (c->state != conn_read && c->state != conn_nread &&
+            c->state != conn_swallow)
+            continue;
+#ifdef USE_IO_URING
+        if (c->uring_closing)
+            continue;
+#endif
+#ifdef USE_ZEROCOPY
+        /* already closing, once the kernel lets go of its items */
+        if (c->zc_closing)
+            continue;
+#endif
+        if (current_time - c->last_cmd_time <= settings.idle_timeout)
+            continue;
+
+        if (settings.verbose > 1)
+            fprintf(stderr, "<%d closing idle connection\n", c->sfd);
+        THR_STATS_INCR(c, idle_kicks);
+        conn_close(c);
+    }
+}
+
 /*
  * Shrinks a connection's buffers if they're too big.  This prevents
  * periodic large "get" requests from permanently chewing lots of server
@@ -658,7 +1372,8 @@ static const char *state_text(enum conn_states state) {
                                        "conn_swallow",
                                        "conn_closing",
                                        "conn_mwrite",
-                                       "conn_closed" };
+                                       "conn_closed",
+                                       "conn_watch" };
     return statenames[state];
 }
 
@@ -879,6 +1594,34 @@ static void out_of_memory(conn *c, char *ascii_error) {
     }
 }
 
+/* Points the connection's value reads at the data of it. */
+static void conn_set_ritem(conn *c, item *it) {
+    if (it->it_flags & ITEM_CHUNKED) {
+        c->rchunk = ITEM_chunk(it);
+        c->ritem = c->rchunk->data;
+    } else {
+        c->rchunk = NULL;
+        c->ritem = ITEM_data(it);
+    }
+}
+
+/* Adds the first len bytes of the value of it to the response, one iovec
+ * per chunk for chunked items. */
+static int add_item_data_iov(conn *c, item *it, int len) {
+    item_chunk *chunk;
+
+    if ((it->it_flags & ITEM_CHUNKED) == 0)
+        return add_iov(c, ITEM_data(it), len);
+    for (chunk = ITEM_chunk(it); chunk != NULL && len > 0;
+         chunk = CHUNK_next(chunk)) {
+        int n = chunk->size < len ? chunk->size : len;
+        if (add_iov(c, chunk->data, n) != 0)
+            return -1;
+        len -= n;
+    }
+    return 0;
+}
+
 /*
  * we get here after reading the value in set/add/replace commands. The command
  * has been stored in c->cmd, and the item is ready in c->item.
@@ -889,12 +1632,12 @@ static void complete_nread_ascii(conn *c) {
     item *it = c->item;
     int comm = c->cmd;
     enum store_item_type ret;
+    char crlf[2];
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, slab_stats[it->slabs_clsid].set_cmds);
 
-    if (strncmp(ITEM_data(it) + it->nbytes - 2, "\r\n", 2) != 0) {
+    item_data_read(it, it->nbytes - 2, crlf, 2);
+    if (strncmp(crlf, "\r\n", 2) != 0) {
         out_string(c, "CLIENT_ERROR bad data chunk");
     } else {
       ret = store_item(it, comm, c);
@@ -1176,13 +1919,11 @@ static void complete_incr_bin(conn *c) {
                         "SERVER_ERROR Out of memory allocating new item");
             }
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
             if (c->cmd == PROTOCOL_BINARY_CMD_INCREMENT) {
-                c->thread->stats.incr_misses++;
+                THR_STATS_INCR(c, incr_misses);
             } else {
-                c->thread->stats.decr_misses++;
+                THR_STATS_INCR(c, decr_misses);
             }
-            pthread_mutex_unlock(&c->thread->stats.mutex);
 
             write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL, 0);
         }
@@ -1200,14 +1941,11 @@ static void complete_update_bin(conn *c) {
 
     item *it = c->item;
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, slab_stats[it->slabs_clsid].set_cmds);
 
     /* We don't actually receive the trailing two characters in the bin
      * protocol, so we're going to just set them here */
-    *(ITEM_data(it) + it->nbytes - 2) = '\r';
-    *(ITEM_data(it) + it->nbytes - 1) = '\n';
+    item_data_write(it, it->nbytes - 2, "\r\n", 2);
 
     ret = store_item(it, c->cmd, c);
 
@@ -1297,15 +2035,13 @@ static void process_bin_get_or_touch(conn *c) {
         uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
 
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (should_touch) {
-            c->thread->stats.touch_cmds++;
-            c->thread->stats.slab_stats[it->slabs_clsid].touch_hits++;
+            THR_STATS_INCR(c, touch_cmds);
+            THR_STATS_INCR(c, slab_stats[it->slabs_clsid].touch_hits);
         } else {
-            c->thread->stats.get_cmds++;
-            c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
+            THR_STATS_INCR(c, get_cmds);
+            THR_STATS_INCR(c, slab_stats[it->slabs_clsid].get_hits);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         if (should_touch) {
             MEMCACHED_COMMAND_TOUCH(c->sfd, ITEM_key(it), it->nkey,
@@ -1335,7 +2071,7 @@ static void process_bin_get_or_touch(conn *c) {
 
         if (should_return_value) {
             /* Add the data minus the CRLF */
-            add_iov(c, ITEM_data(it), it->nbytes - 2);
+            add_item_data_iov(c, it, it->nbytes - 2);
         }
 
         conn_set_state(c, conn_mwrite);
@@ -1343,15 +2079,13 @@ static void process_bin_get_or_touch(conn *c) {
         /* Remember this command so we can garbage collect it later */
         c->item = it;
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (should_touch) {
-            c->thread->stats.touch_cmds++;
-            c->thread->stats.touch_misses++;
+            THR_STATS_INCR(c, touch_cmds);
+            THR_STATS_INCR(c, touch_misses);
         } else {
-            c->thread->stats.get_cmds++;
-            c->thread->stats.get_misses++;
+            THR_STATS_INCR(c, get_cmds);
+            THR_STATS_INCR(c, get_misses);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         if (should_touch) {
             MEMCACHED_COMMAND_TOUCH(c->sfd, key, nkey, -1, 0);
@@ -1512,6 +2246,10 @@ static void process_bin_stat(conn *c) {
         stats_reset();
     } else if (strncmp(subcommand, "settings", 8) == 0) {
         process_stat_settings(&append_stats, c);
+    } else if (strncmp(subcommand, "locks", 5) == 0) {
+        process_stat_locks(&append_stats, c);
+    } else if (strncmp(subcommand, "threads", 7) == 0) {
+        threadlocal_stats_threads(&append_stats, c);
     } else if (strncmp(subcommand, "detail", 6) == 0) {
         char *subcmd_pos = subcommand + 6;
         if (strncmp(subcmd_pos, " dump", 5) == 0) {
@@ -1702,6 +2440,14 @@ static void process_bin_sasl_auth(conn *c) {
         return;
     }
 
+    /* The challenge is handed to SASL in place, so it can't be chunked */
+    if (it->it_flags & ITEM_CHUNKED) {
+        item_remove(it);
+        write_bin_error(c, PROTOCOL_BINARY_RESPONSE_EINVAL, NULL, vlen);
+        c->write_and_go = conn_swallow;
+        return;
+    }
+
     c->item = it;
     c->ritem = ITEM_data(it);
     c->rlbytes = vlen;
@@ -1763,9 +2509,7 @@ static void process_bin_complete_sasl_auth(conn *c) {
     case SASL_OK:
         c->authenticated = true;
         write_bin_response(c, "Authenticated", 0, 0, strlen("Authenticated"));
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, auth_cmds);
         break;
     case SASL_CONTINUE:
         add_bin_header(c, PROTOCOL_BINARY_RESPONSE_AUTH_CONTINUE, 0, 0, outlen);
@@ -1779,10 +2523,8 @@ static void process_bin_complete_sasl_auth(conn *c) {
         if (settings.verbose)
             fprintf(stderr, "Unknown sasl response:  %d\n", result);
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_AUTH_ERROR, NULL, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        c->thread->stats.auth_errors++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, auth_cmds);
+        THR_STATS_INCR(c, auth_errors);
     }
 }
 
@@ -2080,7 +2822,7 @@ static void process_bin_update(conn *c) {
     }
 
     c->item = it;
-    c->ritem = ITEM_data(it);
+    conn_set_ritem(c, it);
     c->rlbytes = vlen;
     conn_set_state(c, conn_nread);
     c->substate = bin_read_set_value;
@@ -2133,7 +2875,7 @@ static void process_bin_append_prepend(conn *c) {
     }
 
     c->item = it;
-    c->ritem = ITEM_data(it);
+    conn_set_ritem(c, it);
     c->rlbytes = vlen;
     conn_set_state(c, conn_nread);
     c->substate = bin_read_set_value;
@@ -2160,9 +2902,7 @@ static void process_bin_flush(conn *c) {
     }
     item_flush_expired();
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.flush_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, flush_cmds);
 
     write_bin_response(c, NULL, 0, 0, 0);
 }
@@ -2195,9 +2935,7 @@ static void process_bin_delete(conn *c) {
         uint64_t cas = ntohll(req->message.header.request.cas);
         if (cas == 0 || cas == ITEM_get_cas(it)) {
             MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[it->slabs_clsid].delete_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[it->slabs_clsid].delete_hits);
             item_unlink(it);
             write_bin_response(c, NULL, 0, 0, 0);
         } else {
@@ -2206,9 +2944,7 @@ static void process_bin_delete(conn *c) {
         item_remove(it);      /* release our reference */
     } else {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, delete_misses);
     }
 }
 
@@ -2276,6 +3012,7 @@ static void complete_nread(conn *c) {
     assert(c->protocol == ascii_prot
            || c->protocol == binary_prot);
 
+    c->rchunk = NULL;
     if (c->protocol == ascii_prot) {
         complete_nread_ascii(c);
     } else if (c->protocol == binary_prot) {
@@ -2309,24 +3046,18 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
         if(old_it == NULL) {
             // LRU expired
             stored = NOT_FOUND;
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.cas_misses++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, cas_misses);
         }
         else if (ITEM_get_cas(it) == ITEM_get_cas(old_it)) {
             // cas validates
             // it and old_it may belong to different classes.
             // I'm updating the stats for the one that's getting pushed out
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[old_it->slabs_clsid].cas_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[old_it->slabs_clsid].cas_hits);
 
             item_replace(old_it, it, hv);
             stored = STORED;
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[old_it->slabs_clsid].cas_badval++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[old_it->slabs_clsid].cas_badval);
 
             if(settings.verbose > 1) {
                 fprintf(stderr, "CAS:  failure: expected %llu, got %llu\n",
@@ -2370,12 +3101,12 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
                 /* copy data from it and old_it to new_it */
 
                 if (comm == NREAD_APPEND) {
-                    memcpy(ITEM_data(new_it), ITEM_data(old_it), old_it->nbytes);
-                    memcpy(ITEM_data(new_it) + old_it->nbytes - 2 /* CRLF */, ITEM_data(it), it->nbytes);
+                    item_data_copy(new_it, 0, old_it, old_it->nbytes);
+                    item_data_copy(new_it, old_it->nbytes - 2 /* CRLF */, it, it->nbytes);
                 } else {
                     /* NREAD_PREPEND */
-                    memcpy(ITEM_data(new_it), ITEM_data(it), it->nbytes);
-                    memcpy(ITEM_data(new_it) + it->nbytes - 2 /* CRLF */, ITEM_data(old_it), old_it->nbytes);
+                    item_data_copy(new_it, 0, it, it->nbytes);
+                    item_data_copy(new_it, it->nbytes - 2 /* CRLF */, old_it, old_it->nbytes);
                 }
 
                 it = new_it;
@@ -2620,9 +3351,55 @@ static void server_stats(ADD_STAT add_stats, conn *c) {
     if (settings.slab_reassign) {
         APPEND_STAT("slab_reassign_running", "%u", stats.slab_reassign_running);
         APPEND_STAT("slabs_moved", "%llu", stats.slabs_moved);
+        APPEND_STAT("slab_reassign_rescues", "%llu",
+                    (unsigned long long)stats.slab_reassign_rescues);
+        APPEND_STAT("slab_reassign_evictions", "%llu",
+                    (unsigned long long)stats.slab_reassign_evictions);
+    }
+    if (settings.zerocopy_min) {
+        APPEND_STAT("zerocopy_sends", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_sends);
+        APPEND_STAT("zerocopy_bytes", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_bytes);
+        APPEND_STAT("zerocopy_copied", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_copied);
+        APPEND_STAT("zerocopy_fallbacks", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_fallbacks);
+        APPEND_STAT("zerocopy_completions", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_completions);
+        APPEND_STAT("zerocopy_completion_usec", "%llu",
+                    (unsigned long long)thread_stats.zerocopy_completion_usec);
+    }
+    if (settings.io_uring) {
+        APPEND_STAT("io_uring_enters", "%llu",
+                    (unsigned long long)thread_stats.io_uring_enters);
+        APPEND_STAT("io_uring_completions", "%llu",
+                    (unsigned long long)thread_stats.io_uring_completions);
+    }
+    if (settings.conn_buffer_pool) {
+        int attached, pooled;
+        threadlocal_conn_buffers(&attached, &pooled);
+        APPEND_STAT("conn_buffer_bytes_attached", "%llu",
+                    (unsigned long long)attached * CONN_BUFS_BYTES);
+        APPEND_STAT("conn_buffer_bytes_pooled", "%llu",
+                    (unsigned long long)pooled * CONN_BUFS_BYTES);
+    }
+    if (settings.idle_timeout) {
+        APPEND_STAT("idle_kicks", "%llu",
+                    (unsigned long long)thread_stats.idle_kicks);
+    }
+    if (settings.busy_poll) {
+        APPEND_STAT("busy_poll_hits", "%llu",
+                    (unsigned long long)thread_stats.busy_poll_hits);
     }
     if (settings.lru_crawler) {
         APPEND_STAT("lru_crawler_running", "%u", stats.lru_crawler_running);
+        APPEND_STAT("lru_crawler_starts", "%llu",
+                    (unsigned long long)stats.lru_crawler_starts);
+        APPEND_STAT("lru_crawler_pass_usec", "%llu",
+                    (unsigned long long)stats.lru_crawler_pass_usec);
+        APPEND_STAT("lru_crawler_items_per_sec", "%llu",
+                    (unsigned long long)stats.lru_crawler_items_per_sec);
     }
     APPEND_STAT("malloc_fails", "%llu",
                 (unsigned long long)stats.malloc_fails);
@@ -2656,18 +3433,86 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
                 prot_text(settings.binding_protocol));
     APPEND_STAT("auth_enabled_sasl", "%s", settings.sasl ? "yes" : "no");
     APPEND_STAT("item_size_max", "%d", settings.item_size_max);
+    APPEND_STAT("slab_chunk_max", "%d", settings.slab_chunk_max);
+    APPEND_STAT("large_item_max", "%d", settings.large_item_max);
+    APPEND_STAT("large_pages", "%s", settings.large_pages ? "yes" : "no");
+    APPEND_STAT("numa_interleave", "%s",
+                settings.numa_interleave ? "yes" : "no");
+    APPEND_STAT("numa_local", "%s", settings.numa_local ? "yes" : "no");
+    APPEND_STAT("prefault_threads", "%d", settings.prefault_threads);
+    APPEND_STAT("reuseport", "%s", settings.reuseport ? "yes" : "no");
+    APPEND_STAT("conn_placement", "%s",
+                settings.conn_placement == PLACE_LEAST_LOADED ?
+                "load" : "roundrobin");
+    APPEND_STAT("conn_migrate", "%s", settings.conn_migrate ? "yes" : "no");
+    APPEND_STAT("udp_batch", "%d", settings.udp_batch);
+    APPEND_STAT("zerocopy_min", "%d", settings.zerocopy_min);
+    APPEND_STAT("io_uring", "%s", settings.io_uring ? "yes" : "no");
+    APPEND_STAT("conn_buffer_pool", "%s",
+                settings.conn_buffer_pool ? "yes" : "no");
+    APPEND_STAT("idle_timeout", "%d", settings.idle_timeout);
+    APPEND_STAT("worker_cpus", "%s",
+                settings.worker_cpus ? settings.worker_cpus : "NULL");
+    APPEND_STAT("housekeeping_cpus", "%s",
+                settings.housekeeping_cpus ? settings.housekeeping_cpus : "NULL");
+    APPEND_STAT("busy_poll", "%d", settings.busy_poll);
     APPEND_STAT("maxconns_fast", "%s", settings.maxconns_fast ? "yes" : "no");
     APPEND_STAT("hashpower_init", "%d", settings.hashpower_init);
     APPEND_STAT("slab_reassign", "%s", settings.slab_reassign ? "yes" : "no");
     APPEND_STAT("slab_automove", "%d", settings.slab_automove);
+    APPEND_STAT("slab_automove_ratio", "%.2f", settings.slab_automove_ratio);
+    APPEND_STAT("slab_automove_interval", "%d", settings.slab_automove_interval);
     APPEND_STAT("lru_crawler", "%s", settings.lru_crawler ? "yes" : "no");
     APPEND_STAT("lru_crawler_sleep", "%d", settings.lru_crawler_sleep);
     APPEND_STAT("lru_crawler_tocrawl", "%lu", (unsigned long)settings.lru_crawler_tocrawl);
+    APPEND_STAT("lru_crawler_autocrawl", "%s", settings.lru_crawler_autocrawl ? "yes" : "no");
+    APPEND_STAT("lru_crawler_budget", "%d", settings.lru_crawler_budget);
+    APPEND_STAT("lru_crawler_threads", "%d", settings.lru_crawler_threads);
+    APPEND_STAT("lock_profiler", "%s", lockprof_enabled ? "yes" : "no");
     APPEND_STAT("tail_repair_time", "%d", settings.tail_repair_time);
     APPEND_STAT("flush_enabled", "%s", settings.flush_enabled ? "yes" : "no");
     APPEND_STAT("hash_algorithm", "%s", settings.hash_algorithm);
 }
 
+/* Counters of the lock profiler. Histogram buckets are only listed once
+ * something has landed in them. */
+static void process_stat_locks(ADD_STAT add_stats, void *c) {
+    struct lockprof_stats ls;
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+    int id, b;
+
+    for (id = 0; id < LOCKPROF_COUNT; id++) {
+        const char *name = lockprof_name(id);
+        lockprof_get_stats(id, &ls);
+        APPEND_NUM_FMT_STAT("%s:%s", name, "acquires", "%llu",
+                            (unsigned long long)ls.acquires);
+        APPEND_NUM_FMT_STAT("%s:%s", name, "contended", "%llu",
+                            (unsigned long long)ls.contended);
+        APPEND_NUM_FMT_STAT("%s:%s", name, "wait_usec", "%llu",
+                            (unsigned long long)ls.wait_ns / 1000);
+        APPEND_NUM_FMT_STAT("%s:%s", name, "hold_usec", "%llu",
+                            (unsigned long long)ls.hold_ns / 1000);
+        for (b = 0; b < LOCKPROF_HISTO_BUCKETS; b++) {
+            char bucket[32];
+            if (b < LOCKPROF_HISTO_BUCKETS - 1) {
+                snprintf(bucket, sizeof(bucket), "lt_%luus", 1UL << b);
+            } else {
+                snprintf(bucket, sizeof(bucket), "ge_%luus", 1UL << (b - 1));
+            }
+            if (ls.wait_histo[b] != 0) {
+                APPEND_NUM_FMT_STAT("%s:wait_%s", name, bucket, "%llu",
+                                    (unsigned long long)ls.wait_histo[b]);
+            }
+            if (ls.hold_histo[b] != 0) {
+                APPEND_NUM_FMT_STAT("%s:hold_%s", name, bucket, "%llu",
+                                    (unsigned long long)ls.hold_histo[b]);
+            }
+        }
+    }
+}
+
 static void conn_to_str(const conn *c, char *buf) {
     char addr_text[MAXPATHLEN];
 
@@ -2801,6 +3646,10 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return ;
     } else if (strcmp(subcommand, "settings") == 0) {
         process_stat_settings(&append_stats, c);
+    } else if (strcmp(subcommand, "locks") == 0) {
+        process_stat_locks(&append_stats, c);
+    } else if (strcmp(subcommand, "threads") == 0) {
+        threadlocal_stats_threads(&append_stats, c);
     } else if (strcmp(subcommand, "cachedump") == 0) {
         char *buf;
         unsigned int bytes, id, limit = 0;
@@ -2944,7 +3793,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                       add_iov(c, ITEM_key(it), it->nkey) != 0 ||
                       add_iov(c, ITEM_suffix(it), it->nsuffix - 2) != 0 ||
                       add_iov(c, suffix, suffix_len) != 0 ||
-                      add_iov(c, ITEM_data(it), it->nbytes) != 0)
+                      add_item_data_iov(c, it, it->nbytes) != 0)
                       {
                           item_remove(it);
                           break;
@@ -2956,7 +3805,10 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                                         it->nbytes, ITEM_get_cas(it));
                   if (add_iov(c, "VALUE ", 6) != 0 ||
                       add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0)
+                      ((it->it_flags & ITEM_CHUNKED) == 0 ?
+                       add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) :
+                       (add_iov(c, ITEM_suffix(it), it->nsuffix) ||
+                        add_item_data_iov(c, it, it->nbytes))) != 0)
                       {
                           item_remove(it);
                           break;
@@ -2974,19 +3826,15 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 }
 
                 /* item_get() has incremented it->refcount for us */
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_INCR(c, slab_stats[it->slabs_clsid].get_hits);
+                THR_STATS_INCR(c, get_cmds);
                 item_update(it);
                 *(c->ilist + i) = it;
                 i++;
 
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.get_misses++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_INCR(c, get_misses);
+                THR_STATS_INCR(c, get_cmds);
                 MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
             }
 
@@ -3111,7 +3959,7 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
     ITEM_set_cas(it, req_cas_id);
 
     c->item = it;
-    c->ritem = ITEM_data(it);
+    conn_set_ritem(c, it);
     c->rlbytes = it->nbytes;
     c->cmd = comm;
     conn_set_state(c, conn_nread);
@@ -3143,18 +3991,14 @@ static void process_touch_command(conn *c, token_t *tokens, const size_t ntokens
     it = item_touch(key, nkey, realtime(exptime_int));
     if (it) {
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.slab_stats[it->slabs_clsid].touch_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, touch_cmds);
+        THR_STATS_INCR(c, slab_stats[it->slabs_clsid].touch_hits);
 
         out_string(c, "TOUCHED");
         item_remove(it);
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.touch_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, touch_cmds);
+        THR_STATS_INCR(c, touch_misses);
 
         out_string(c, "NOT_FOUND");
     }
@@ -3194,13 +4038,11 @@ static void process_arithmetic_command(conn *c, token_t *tokens, const size_t nt
         out_of_memory(c, "SERVER_ERROR out of memory");
         break;
     case DELTA_ITEM_NOT_FOUND:
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (incr) {
-            c->thread->stats.incr_misses++;
+            THR_STATS_INCR(c, incr_misses);
         } else {
-            c->thread->stats.decr_misses++;
+            THR_STATS_INCR(c, decr_misses);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         out_string(c, "NOT_FOUND");
         break;
@@ -3241,7 +4083,8 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
 
     ptr = ITEM_data(it);
 
-    if (!safe_strtoull(ptr, &value)) {
+    /* Chunked values are far too long to be numbers */
+    if ((it->it_flags & ITEM_CHUNKED) || !safe_strtoull(ptr, &value)) {
         do_item_remove(it);
         return NON_NUMERIC;
     }
@@ -3258,13 +4101,11 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
         MEMCACHED_COMMAND_DECR(c->sfd, ITEM_key(it), it->nkey, value);
     }
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
     if (incr) {
-        c->thread->stats.slab_stats[it->slabs_clsid].incr_hits++;
+        THR_STATS_INCR(c, slab_stats[it->slabs_clsid].incr_hits);
     } else {
-        c->thread->stats.slab_stats[it->slabs_clsid].decr_hits++;
+        THR_STATS_INCR(c, slab_stats[it->slabs_clsid].decr_hits);
     }
-    pthread_mutex_unlock(&c->thread->stats.mutex);
 
     snprintf(buf, INCR_MAX_STORAGE_LEN, "%llu", (unsigned long long)value);
     res = strlen(buf);
@@ -3274,9 +4115,9 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
     if (res + 2 <= it->nbytes && it->refcount == 2) { /* replace in-place */
         /* When changing the value without replacing the item, we
            need to update the CAS on the existing item. */
-        mutex_lock(&cache_lock); /* FIXME */
+        CACHE_LOCK(); /* FIXME */
         ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
-        mutex_unlock(&cache_lock);
+        CACHE_UNLOCK();
 
         memcpy(ITEM_data(it), buf, res);
         memset(ITEM_data(it) + res, ' ', it->nbytes - res - 2);
@@ -3349,24 +4190,38 @@ static void process_delete_command(conn *c, token_t *tokens, const size_t ntoken
     if (it) {
         MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.slab_stats[it->slabs_clsid].delete_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, slab_stats[it->slabs_clsid].delete_hits);
 
         item_unlink(it);
         item_remove(it);      /* release our reference */
         out_string(c, "DELETED");
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, delete_misses);
 
         out_string(c, "NOT_FOUND");
     }
 }
 
-static void process_verbosity_command(conn *c, token_t *tokens, const size_t ntokens) {
-    unsigned int level;
+static void process_memlimit_command(conn *c, token_t *tokens, const size_t ntokens) {
+    uint32_t memlimit;
+    assert(c != NULL);
+
+    set_noreply_maybe(c, tokens, ntokens);
+
+    if (!safe_strtoul(tokens[1].value, &memlimit)) {
+        out_string(c, "CLIENT_ERROR bad command line format");
+    } else if (memlimit < 8 || (uint64_t)memlimit * 1024 * 1024 > SIZE_MAX) {
+        out_string(c, "CLIENT_ERROR memory limit out of range");
+    } else if (!slabs_adjust_mem_limit((size_t)memlimit * 1024 * 1024)) {
+        out_string(c, "SERVER_ERROR can't grow a preallocated cache");
+    } else {
+        settings.maxbytes = (size_t)memlimit * 1024 * 1024;
+        out_string(c, "OK");
+    }
+}
+
+static void process_verbosity_command(conn *c, token_t *tokens, const size_t ntokens) {
+    unsigned int level;
 
     assert(c != NULL);
 
@@ -3388,7 +4243,7 @@ static void process_slabs_automove_command(conn *c, token_t *tokens, const size_
     level = strtoul(tokens[2].value, NULL, 10);
     if (level == 0) {
         settings.slab_automove = 0;
-    } else if (level == 1 || level == 2) {
+    } else if (level >= 1 && level <= 3) {
         settings.slab_automove = level;
     } else {
         out_string(c, "ERROR");
@@ -3473,9 +4328,7 @@ static void process_command(conn *c, char *command) {
 
         set_noreply_maybe(c, tokens, ntokens);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.flush_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, flush_cmds);
 
         if (!settings.flush_enabled) {
             // flush_all is not allowed but we log it on stats
@@ -3577,9 +4430,10 @@ static void process_command(conn *c, char *command) {
                 return;
             }
 
-            rv = lru_crawler_crawl(tokens[2].value);
+            rv = lru_crawler_crawl(tokens[2].value, CRAWLER_EXPIRED, NULL);
             switch(rv) {
             case CRAWLER_OK:
+            case CRAWLER_NOTSTARTED:
                 out_string(c, "OK");
                 break;
             case CRAWLER_RUNNING:
@@ -3590,6 +4444,37 @@ static void process_command(conn *c, char *command) {
                 break;
             }
             return;
+        } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "metadump") == 0) {
+            int rv;
+            if (settings.lru_crawler == false) {
+                out_string(c, "CLIENT_ERROR lru crawler disabled");
+                return;
+            }
+            if (IS_UDP(c->transport)) {
+                out_string(c, "CLIENT_ERROR metadump not available over UDP");
+                return;
+            }
+
+            rv = lru_crawler_crawl(tokens[2].value, CRAWLER_METADUMP, c);
+            switch(rv) {
+            case CRAWLER_OK:
+                /* The crawler writes the dump, including the final END,
+                 * straight to the socket and hands the connection back
+                 * when it is done. */
+                conn_set_state(c, conn_watch);
+                event_del(&c->event);
+                break;
+            case CRAWLER_NOTSTARTED:
+                out_string(c, "END");
+                break;
+            case CRAWLER_RUNNING:
+                out_string(c, "BUSY currently processing crawler request");
+                break;
+            case CRAWLER_BADCLASS:
+                out_string(c, "BADCLASS invalid class id");
+                break;
+            }
+            return;
         } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "tocrawl") == 0) {
             uint32_t tocrawl;
              if (!safe_strtoul(tokens[2].value, &tocrawl)) {
@@ -3612,6 +4497,30 @@ static void process_command(conn *c, char *command) {
             settings.lru_crawler_sleep = tosleep;
             out_string(c, "OK");
             return;
+        } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "autocrawl") == 0) {
+            if (strcmp(tokens[2].value, "1") == 0) {
+                lru_crawler_autocrawl_set(true);
+            } else if (strcmp(tokens[2].value, "0") == 0) {
+                lru_crawler_autocrawl_set(false);
+            } else {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+            out_string(c, "OK");
+            return;
+        } else if (ntokens == 4 && strcmp(tokens[COMMAND_TOKEN + 1].value, "budget") == 0) {
+            uint32_t budget;
+            if (!safe_strtoul(tokens[2].value, &budget)) {
+                out_string(c, "CLIENT_ERROR bad command line format");
+                return;
+            }
+            if (budget < 1 || budget > 100) {
+                out_string(c, "CLIENT_ERROR budget must be between 1 and 100");
+                return;
+            }
+            settings.lru_crawler_budget = budget;
+            out_string(c, "OK");
+            return;
         } else if (ntokens == 3) {
             if ((strcmp(tokens[COMMAND_TOKEN + 1].value, "enable") == 0)) {
                 if (start_item_crawler_thread() == 0) {
@@ -3632,6 +4541,18 @@ static void process_command(conn *c, char *command) {
         } else {
             out_string(c, "ERROR");
         }
+    } else if (ntokens == 3 && strcmp(tokens[COMMAND_TOKEN].value, "lock_profiler") == 0) {
+        if (strcmp(tokens[1].value, "1") == 0) {
+            lockprof_enabled = true;
+        } else if (strcmp(tokens[1].value, "0") == 0) {
+            lockprof_enabled = false;
+        } else {
+            out_string(c, "CLIENT_ERROR bad command line format");
+            return;
+        }
+        out_string(c, "OK");
+    } else if ((ntokens == 3 || ntokens == 4) && strcmp(tokens[COMMAND_TOKEN].value, "cache_memlimit") == 0) {
+        process_memlimit_command(c, tokens, ntokens);
     } else if ((ntokens == 3 || ntokens == 4) && (strcmp(tokens[COMMAND_TOKEN].value, "verbosity") == 0)) {
         process_verbosity_command(c, tokens, ntokens);
     } else {
@@ -3716,6 +4637,7 @@ static int try_read_command(conn *c) {
                 return 0;
             }
 
+            c->last_cmd_time = current_time;
             c->cmd = c->binary_header.request.opcode;
             c->keylen = c->binary_header.request.keylen;
             c->opaque = c->binary_header.request.opaque;
@@ -3778,33 +4700,193 @@ static int try_read_command(conn *c) {
 /*
  * read a UDP request.
  */
+#ifdef UDP_BATCHING
+/*
+ * Takes the next datagram from the connection's batch, reading a fresh
+ * batch with one recvmmsg() once it runs out. Returns its length, or -1
+ * when there's nothing to read.
+ */
+static int udp_batch_read(conn *c, unsigned char **buf) {
+    struct udp_batch *rx = c->udp_rx;
+    struct msghdr *m;
+    int i, res;
+
+    if (rx->curr == rx->used) {
+        for (i = 0; i < rx->size; i++)
+            rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->addrs[i]);
+        res = recvmmsg(c->sfd, rx->msgs, rx->size, 0, NULL);
+        rx->used = res > 0 ? res : 0;
+        rx->curr = 0;
+        if (res <= 0)
+            return -1;
+    }
+
+    m = &rx->msgs[rx->curr].msg_hdr;
+    memcpy(&c->request_addr, m->msg_name, m->msg_namelen);
+    c->request_addr_size = m->msg_namelen;
+    *buf = m->msg_iov->iov_base;
+    return rx->msgs[rx->curr++].msg_len;
+}
+#endif
+
+/* Every worker reads from each UDP socket, so the pieces of one request
+ * can land on different threads; they share one table. */
+static struct udp_partial *udp_partials = NULL;
+static pthread_mutex_t udp_partials_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Files a piece of a multi-datagram request under its sender and request
+ * id. Once the last piece is in, copies the whole request to the read
+ * buffer and returns its length. Returns 0 if more pieces are to come (or
+ * the piece was dropped), and -1 if the request is more than we take.
+ */
+static int do_udp_reassemble(conn *c, int seq, int total,
+                             const char *buf, int len) {
+    struct udp_partial *p = NULL, *oldest = NULL, *free_slot = NULL;
+    int i;
+
+    if (total > UDP_REASSEMBLY_PARTS)
+        return -1;
+    if (seq >= total)
+        return 0;
+
+    if (udp_partials == NULL) {
+        udp_partials = calloc(UDP_REASSEMBLY_MAX, sizeof(struct udp_partial));
+        if (udp_partials == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            return 0;
+        }
+    }
+
+    for (i = 0; i < UDP_REASSEMBLY_MAX; i++) {
+        struct udp_partial *q = &udp_partials[i];
+        if (q->addr_size != 0 &&
+            current_time - q->started > UDP_REASSEMBLY_TIMEOUT) {
+            /* the rest of it isn't coming */
+            udp_partial_clear(q);
+        }
+        if (q->addr_size == 0) {
+            if (free_slot == NULL)
+                free_slot = q;
+            continue;
+        }
+        if (q->request_id == c->request_id &&
+            q->addr_size == c->request_addr_size &&
+            memcmp(&q->addr, &c->request_addr, q->addr_size) == 0) {
+            p = q;
+        }
+        if (oldest == NULL || q->started < oldest->started)
+            oldest = q;
+    }
+
+    if (p != NULL && p->total != total) {
+        /* the id got reused for another request */
+        udp_partial_clear(p);
+        free_slot = p;
+        p = NULL;
+    }
+    if (p == NULL) {
+        p = free_slot ? free_slot : oldest;
+        udp_partial_clear(p);
+        memcpy(&p->addr, &c->request_addr, c->request_addr_size);
+        p->addr_size = c->request_addr_size;
+        p->request_id = c->request_id;
+        p->total = total;
+        p->got = 0;
+        p->started = current_time;
+        p->bytes = p->size = 0;
+        for (i = 0; i < total; i++)
+            p->off[i] = -1;
+    }
+
+    if (p->off[seq] >= 0)
+        return 0;   /* a duplicate */
+    if (p->bytes + len > c->rsize) {
+        udp_partial_clear(p);
+        return -1;
+    }
+    if (p->bytes + len > p->size) {
+        int size = p->size ? p->size * 2 : 2 * UDP_MAX_PAYLOAD_SIZE;
+        char *data;
+        while (size < p->bytes + len)
+            size *= 2;
+        if ((data = realloc(p->data, size)) == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            udp_partial_clear(p);
+            return 0;
+        }
+        p->data = data;
+        p->size = size;
+    }
+    memcpy(p->data + p->bytes, buf, len);
+    p->off[seq] = p->bytes;
+    p->len[seq] = len;
+    p->bytes += len;
+
+    if (++p->got < total)
+        return 0;
+
+    len = 0;
+    for (i = 0; i < total; i++) {
+        memcpy(c->rbuf + len, p->data + p->off[i], p->len[i]);
+        len += p->len[i];
+    }
+    udp_partial_clear(p);
+    return len;
+}
+
+static int udp_reassemble(conn *c, int seq, int total,
+                          const char *buf, int len) {
+    int ret;
+    pthread_mutex_lock(&udp_partials_lock);
+    ret = do_udp_reassemble(c, seq, total, buf, len);
+    pthread_mutex_unlock(&udp_partials_lock);
+    return ret;
+}
+
 static enum try_read_result try_read_udp(conn *c) {
+    unsigned char *buf = (unsigned char *)c->rbuf;
     int res;
 
     assert(c != NULL);
 
-    c->request_addr_size = sizeof(c->request_addr);
-    res = recvfrom(c->sfd, c->rbuf, c->rsize,
-                   0, (struct sockaddr *)&c->request_addr,
-                   &c->request_addr_size);
+#ifdef UDP_BATCHING
+    if (c->udp_rx != NULL) {
+        res = udp_batch_read(c, &buf);
+    } else
+#endif
+    {
+        c->request_addr_size = sizeof(c->request_addr);
+        res = recvfrom(c->sfd, c->rbuf, c->rsize,
+                       0, (struct sockaddr *)&c->request_addr,
+                       &c->request_addr_size);
+    }
     if (res > 8) {
-        unsigned char *buf = (unsigned char *)c->rbuf;
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.bytes_read += res;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_ADD(c, bytes_read, res);
 
         /* Beginning of UDP packet is the request ID; save it. */
         c->request_id = buf[0] * 256 + buf[1];
 
-        /* If this is a multi-packet request, drop it. */
-        if (buf[4] != 0 || buf[5] != 1) {
-            out_string(c, "SERVER_ERROR multi-packet request not supported");
-            return READ_NO_DATA_RECEIVED;
-        }
-
         /* Don't care about any of the rest of the header. */
         res -= 8;
-        memmove(c->rbuf, c->rbuf + 8, res);
+
+        if (buf[4] != 0 || buf[5] != 1) {
+            /* A piece of a multi-packet request */
+            res = udp_reassemble(c, buf[2] * 256 + buf[3],
+                                 buf[4] * 256 + buf[5], (char *)buf + 8, res);
+            if (res < 0) {
+                out_string(c, "SERVER_ERROR multi-packet request too large");
+                return READ_MEMORY_ERROR;
+            }
+            if (res == 0)
+                return READ_NO_DATA_RECEIVED;
+        } else {
+            memmove(c->rbuf, buf + 8, res);
+        }
 
         c->rbytes = res;
         c->rcurr = c->rbuf;
@@ -3813,6 +4895,32 @@ static enum try_read_result try_read_udp(conn *c) {
     return READ_NO_DATA_RECEIVED;
 }
 
+#ifdef USE_IO_URING
+/* try_read_network() for a connection on the ring, whose data is in */
+static enum try_read_result try_read_uring(conn *c) {
+    int res = c->uring_rres;
+
+    c->uring_rres = -EAGAIN;
+    if (res > 0)
+        return READ_DATA_RECEIVED;
+    if (res == -EAGAIN)
+        return READ_NO_DATA_RECEIVED;
+    if (res == -ENOMEM) {
+        STATS_LOCK();
+        stats.malloc_fails++;
+        STATS_UNLOCK();
+        if (settings.verbose > 0) {
+            fprintf(stderr, "Couldn't realloc input buffer\n");
+        }
+        c->rbytes = 0; /* ignore what we read */
+        out_of_memory(c, "SERVER_ERROR out of memory reading request");
+        c->write_and_go = conn_closing;
+        return READ_MEMORY_ERROR;
+    }
+    return READ_ERROR;
+}
+#endif
+
 /*
  * read from network as much as we can, handle buffer overflow and connection
  * close.
@@ -3831,6 +4939,14 @@ static enum try_read_result try_read_network(conn *c) {
     int num_allocs = 0;
     assert(c != NULL);
 
+#ifdef USE_IO_URING
+    if (c->uring) {
+        if (c->uring_rres != URING_READ_DIRECT)
+            return try_read_uring(c);
+        c->uring_rres = -EAGAIN;
+    }
+#endif
+
     if (c->rcurr != c->rbuf) {
         if (c->rbytes != 0) /* otherwise there's nothing to copy */
             memmove(c->rbuf, c->rcurr, c->rbytes);
@@ -3863,9 +4979,7 @@ static enum try_read_result try_read_network(conn *c) {
         int avail = c->rsize - c->rbytes;
         res = read(c->sfd, c->rbuf + c->rbytes, avail);
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_read += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_ADD(c, bytes_read, res);
             gotdata = READ_DATA_RECEIVED;
             c->rbytes += res;
             if (res == avail) {
@@ -3890,6 +5004,10 @@ static enum try_read_result try_read_network(conn *c) {
 static bool update_event(conn *c, const int new_flags) {
     assert(c != NULL);
 
+#ifdef USE_IO_URING
+    if (c->uring)
+        return conn_uring_wait(c, new_flags);
+#endif
     struct event_base *base = c->event.ev_base;
     if (c->ev_flags == new_flags)
         return true;
@@ -3901,24 +5019,59 @@ static bool update_event(conn *c, const int new_flags) {
     return true;
 }
 
+/*
+ * Adds a listener created on a worker thread, which accepts on it directly.
+ */
+void add_listen_conn(conn *c) {
+    pthread_mutex_lock(&conn_lock);
+    c->next = listen_conn;
+    listen_conn = c;
+    pthread_mutex_unlock(&conn_lock);
+}
+
+/*
+ * Runs on a worker thread to switch the events of the listeners it owns on
+ * or off, as the last do_accept_new_conns() asked.
+ */
+void update_listen_conns(LIBEVENT_THREAD *me) {
+    struct timeval t = {.tv_sec = 0, .tv_usec = 10000};
+    bool owner = false;
+    conn *next;
+
+    pthread_mutex_lock(&conn_lock);
+    for (next = listen_conn; next; next = next->next) {
+        if (next->thread == me) {
+            update_event(next, listen_conns_accepting ?
+                         EV_READ | EV_PERSIST : 0);
+            owner = true;
+        }
+    }
+    /* Poll until connections are closed and accepting can resume */
+    if (owner && !listen_conns_accepting && !me->listen_retry) {
+        me->listen_retry = true;
+        evtimer_set(&me->listen_retry_event, listen_retry_handler, me);
+        event_base_set(me->base, &me->listen_retry_event);
+        evtimer_add(&me->listen_retry_event, &t);
+    }
+    pthread_mutex_unlock(&conn_lock);
+}
+
 /*
  * Sets whether we are listening for new connections or not.
  */
 void do_accept_new_conns(const bool do_accept) {
     conn *next;
 
+    listen_conns_accepting = do_accept;
     for (next = listen_conn; next; next = next->next) {
-        if (do_accept) {
-            update_event(next, EV_READ | EV_PERSIST);
-            if (listen(next->sfd, settings.backlog) != 0) {
-                perror("listen");
-            }
+        if (next->thread != NULL) {
+            /* A worker's listener; only its own thread touches the event */
+            notify_listen_thread(next->thread);
+        } else {
+            update_event(next, do_accept ? EV_READ | EV_PERSIST : 0);
         }
-        else {
-            update_event(next, 0);
-            if (listen(next->sfd, 0) != 0) {
-                perror("listen");
-            }
+        if (listen(next->sfd, do_accept ? settings.backlog : 0) != 0) {
+            perror("listen");
         }
     }
 
@@ -3932,7 +5085,9 @@ void do_accept_new_conns(const bool do_accept) {
         stats.listen_disabled_num++;
         STATS_UNLOCK();
         allow_new_conns = false;
-        maxconns_handler(-42, 0, 0);
+        /* Workers poll from their own threads, see update_listen_conns() */
+        if (is_listen_thread())
+            maxconns_handler(-42, 0, 0);
     }
 }
 
@@ -3945,9 +5100,50 @@ void do_accept_new_conns(const bool do_accept) {
  *   TRANSMIT_SOFT_ERROR Can't write any more right now.
  *   TRANSMIT_HARD_ERROR Can't write (c->state is set to conn_closing)
  */
+#ifdef UDP_BATCHING
+/*
+ * Copies a UDP reply's datagrams, headers and all, into the connection's
+ * send batch, so the items and buffers behind them can be let go of now.
+ * udp_flush() sends them once the batch is full or there are no more
+ * requests waiting to be read.
+ */
+static enum transmit_result transmit_udp_batch(conn *c) {
+    struct udp_batch *tx = c->udp_tx;
+
+    for (; c->msgcurr < c->msgused; c->msgcurr++) {
+        struct msghdr *m = &c->msglist[c->msgcurr];
+        struct msghdr *out;
+        char *p;
+        int i;
+
+        if (tx->used == tx->size)
+            udp_flush(c);
+        out = &tx->msgs[tx->used].msg_hdr;
+        p = out->msg_iov->iov_base;
+        for (i = 0; i < m->msg_iovlen; i++) {
+            memcpy(p, m->msg_iov[i].iov_base, m->msg_iov[i].iov_len);
+            p += m->msg_iov[i].iov_len;
+        }
+        out->msg_iov->iov_len = p - (char *)out->msg_iov->iov_base;
+        out->msg_namelen = m->msg_namelen;
+        if (m->msg_namelen > 0)
+            memcpy(out->msg_name, m->msg_name, m->msg_namelen);
+        tx->used++;
+    }
+    if (tx->used == tx->size)
+        udp_flush(c);
+    return TRANSMIT_COMPLETE;
+}
+#endif
+
 static enum transmit_result transmit(conn *c) {
     assert(c != NULL);
 
+#ifdef UDP_BATCHING
+    if (c->udp_tx != NULL)
+        return transmit_udp_batch(c);
+#endif
+
     if (c->msgcurr < c->msgused &&
             c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
@@ -3957,11 +5153,30 @@ static enum transmit_result transmit(conn *c) {
         ssize_t res;
         struct msghdr *m = &c->msglist[c->msgcurr];
 
+#ifdef USE_IO_URING
+        if (c->uring && c->uring_wres == -EAGAIN &&
+            uring_sendmsg(c->thread->ring, c->sfd, m, c)) {
+            /* the completion brings us back here with the result */
+            c->uring_op = URING_OP_SEND;
+            return TRANSMIT_SOFT_ERROR;
+        }
+        if (c->uring && c->uring_wres != -EAGAIN) {
+            res = c->uring_wres;
+            c->uring_wres = -EAGAIN;
+            if (res < 0) {
+                errno = -res;
+                res = -1;
+            }
+        } else
+#endif
+#ifdef USE_ZEROCOPY
+        if (c->zerocopy)
+            res = zerocopy_sendmsg(c, m);
+        else
+#endif
         res = sendmsg(c->sfd, m, 0);
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_written += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_ADD(c, bytes_written, res);
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -4009,7 +5224,7 @@ static void drive_machine(conn *c) {
     socklen_t addrlen;
     struct sockaddr_storage addr;
     int nreqs = settings.reqs_per_event;
-    int res;
+    int res, toread;
     const char *str;
 #ifdef HAVE_ACCEPT4
     static int  use_accept4 = 1;
@@ -4019,6 +5234,11 @@ static void drive_machine(conn *c) {
 
     assert(c != NULL);
 
+    /* a pooling connection given its buffers back while idle */
+    if (c->rbuf == NULL && !conn_buffers_attach(c)) {
+        conn_set_state(c, conn_closing);
+    }
+
     while (!stop) {
 
         switch(c->state) {
@@ -4069,6 +5289,23 @@ static void drive_machine(conn *c) {
                 STATS_LOCK();
                 stats.rejected_conns++;
                 STATS_UNLOCK();
+            } else if (c->thread != NULL) {
+                /* Accepted on a worker's own listener, so it stays here */
+                conn *nc = conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                                    DATA_BUFFER_SIZE, tcp_transport,
+                                    c->thread->base);
+                if (nc == NULL) {
+                    close(sfd);
+                } else {
+                    nc->thread = c->thread;
+                    THR_CONNS_ADD(nc->thread, 1);
+                    conn_thread_link(nc);
+                    THR_STATS_INCR(nc, accepts);
+#ifdef USE_IO_URING
+                    if (nc->thread->ring != NULL)
+                        conn_uring_start(nc);
+#endif
+                }
             } else {
                 dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
                                      DATA_BUFFER_SIZE, tcp_transport);
@@ -4078,6 +5315,15 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_waiting:
+            if (UDP_RX_PENDING(c)) {
+                /* the last recvmmsg() brought more requests */
+                conn_set_state(c, conn_read);
+                break;
+            }
+            udp_flush(c);
+            if (settings.conn_buffer_pool && c->thread != NULL) {
+                conn_buffers_release(c);
+            }
             if (!update_event(c, EV_READ | EV_PERSIST)) {
                 if (settings.verbose > 0)
                     fprintf(stderr, "Couldn't update event\n");
@@ -4103,7 +5349,7 @@ static void drive_machine(conn *c) {
                 conn_set_state(c, conn_closing);
                 break;
             case READ_MEMORY_ERROR: /* Failed to allocate more memory */
-                /* State already set by try_read_network */
+                /* State already set by try_read_network or try_read_udp */
                 break;
             }
             break;
@@ -4112,6 +5358,8 @@ static void drive_machine(conn *c) {
             if (try_read_command(c) == 0) {
                 /* wee need more data! */
                 conn_set_state(c, conn_waiting);
+            } else {
+                THR_STATS_INCR(c, requests);
             }
 
             break;
@@ -4123,11 +5371,15 @@ static void drive_machine(conn *c) {
             --nreqs;
             if (nreqs >= 0) {
                 reset_cmd_handler(c);
+                /* Between requests is the one safe time to change threads */
+                if (c->state == conn_waiting && c->thread != NULL &&
+                    c->thread->migrate_to >= 0 && conn_migrate(c)) {
+                    stop = true;
+                }
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.conn_yields++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
-                if (c->rbytes > 0) {
+                THR_STATS_INCR(c, conn_yields);
+                udp_flush(c);
+                if (c->rbytes > 0 || UDP_RX_PENDING(c)) {
                     /* We have already read in data into the input buffer,
                        so libevent will most likely not signal read events
                        on the socket (unless more data is available. As a
@@ -4140,6 +5392,11 @@ static void drive_machine(conn *c) {
                         conn_set_state(c, conn_closing);
                         break;
                     }
+                } else if (c->uring &&
+                           !update_event(c, EV_READ | EV_PERSIST)) {
+                    /* the ring has no standing read event to come back on */
+                    conn_set_state(c, conn_closing);
+                    break;
                 }
                 stop = true;
             }
@@ -4160,9 +5417,20 @@ static void drive_machine(conn *c) {
                 break;
             }
 
+            /* Values of chunked items are read a chunk at a time */
+            toread = c->rlbytes;
+            if (c->rchunk != NULL) {
+                if (c->ritem == c->rchunk->data + c->rchunk->size) {
+                    c->rchunk = CHUNK_next(c->rchunk);
+                    c->ritem = c->rchunk->data;
+                }
+                if (toread > c->rchunk->data + c->rchunk->size - c->ritem)
+                    toread = c->rchunk->data + c->rchunk->size - c->ritem;
+            }
+
             /* first check if we have leftovers in the conn_read buffer */
             if (c->rbytes > 0) {
-                int tocopy = c->rbytes > c->rlbytes ? c->rlbytes : c->rbytes;
+                int tocopy = c->rbytes > toread ? toread : c->rbytes;
                 if (c->ritem != c->rcurr) {
                     memmove(c->ritem, c->rcurr, tocopy);
                 }
@@ -4170,17 +5438,16 @@ static void drive_machine(conn *c) {
                 c->rlbytes -= tocopy;
                 c->rcurr += tocopy;
                 c->rbytes -= tocopy;
-                if (c->rlbytes == 0) {
+                toread -= tocopy;
+                if (toread == 0) {
                     break;
                 }
             }
 
             /*  now try reading from the socket */
-            res = read(c->sfd, c->ritem, c->rlbytes);
+            res = read(c->sfd, c->ritem, toread);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_ADD(c, bytes_read, res);
                 if (c->rcurr == c->ritem) {
                     c->rcurr += res;
                 }
@@ -4233,9 +5500,7 @@ static void drive_machine(conn *c) {
             /*  now try reading from the socket */
             res = read(c->sfd, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_ADD(c, bytes_read, res);
                 c->sbytes -= res;
                 break;
             }
@@ -4317,10 +5582,12 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_closing:
-            if (IS_UDP(c->transport))
+            if (IS_UDP(c->transport)) {
                 conn_cleanup(c);
-            else
+                udp_flush(c);
+            } else {
                 conn_close(c);
+            }
             stop = true;
             break;
 
@@ -4329,6 +5596,11 @@ static void drive_machine(conn *c) {
             abort();
             break;
 
+        case conn_watch:
+            /* The LRU crawler owns the socket until it hands it back. */
+            stop = true;
+            break;
+
         case conn_max_state:
             assert(false);
             break;
@@ -4338,13 +5610,43 @@ static void drive_machine(conn *c) {
     return;
 }
 
+/*
+ * Puts a connection which another thread handed back (see redispatch_conn)
+ * under this worker's event loop again, and picks up any commands the client
+ * pipelined behind the one that handed it off.
+ */
+void conn_worker_readd(conn *c) {
+    /* a connection that migrated here joins this thread's list */
+    conn_thread_link(c);
+#ifdef USE_IO_URING
+    if (c->uring) {
+        conn_set_state(c, conn_new_cmd);
+        drive_machine(c);
+        return;
+    }
+#endif
+    c->ev_flags = EV_READ | EV_PERSIST;
+    event_set(&c->event, c->sfd, c->ev_flags, event_handler, (void *)c);
+    event_base_set(c->thread->base, &c->event);
+    if (event_add(&c->event, 0) == -1) {
+        perror("event_add");
+    }
+    conn_set_state(c, conn_new_cmd);
+    drive_machine(c);
+}
+
 void event_handler(const int fd, const short which, void *arg) {
     conn *c;
+    LIBEVENT_THREAD *t;
 
     c = (conn *)arg;
     assert(c != NULL);
+    /* drive_machine() may migrate the connection to another thread */
+    t = c->thread;
 
     c->which = which;
+    if (t != NULL)
+        t->events++;
 
     /* sanity */
     if (fd != c->sfd) {
@@ -4354,7 +5656,21 @@ void event_handler(const int fd, const short which, void *arg) {
         return;
     }
 
+#ifdef USE_ZEROCOPY
+    if (c->zc_closing) {
+        /* only here to see if the kernel is done with its sends */
+        conn_close(c);
+        return;
+    }
+    if (c->zc_holds_used > 0)
+        zerocopy_reap(c);
+#endif
     drive_machine(c);
+#ifdef USE_IO_URING
+    /* a worker's listener may have started connections on the ring */
+    if (t != NULL && t->ring != NULL)
+        thread_uring_submit(t);
+#endif
 
     /* wait for next event */
     return;
@@ -4412,6 +5728,69 @@ static void maximize_sndbuf(const int sfd) {
         fprintf(stderr, "<%d send buffer was %d, now %d\n", sfd, old_size, last_good);
 }
 
+/* Options every TCP listening socket gets before bind() */
+static void set_tcp_listen_options(int sfd) {
+    struct linger ling = {0, 0};
+    int flags = 1;
+    int error;
+
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+    if (settings.reuseport) {
+        error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags,
+                           sizeof(flags));
+        if (error != 0)
+            perror("setsockopt");
+    }
+#endif
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    if (error != 0)
+        perror("setsockopt");
+
+    error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
+    if (error != 0)
+        perror("setsockopt");
+}
+
+/*
+ * Opens one more listener on the address sfd is bound to, sharing it
+ * through SO_REUSEPORT, for a worker thread to accept on.
+ */
+static int reuseport_socket(struct addrinfo *ai, int sfd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int flags = 1;
+    int tfd;
+
+    if (getsockname(sfd, (struct sockaddr *)&addr, &len) != 0) {
+        perror("getsockname()");
+        return -1;
+    }
+    if ((tfd = new_socket(ai)) == -1)
+        return -1;
+#ifdef IPV6_V6ONLY
+    if (ai->ai_family == AF_INET6)
+        setsockopt(tfd, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &flags, sizeof(flags));
+#endif
+    set_tcp_listen_options(tfd);
+    if (bind(tfd, (struct sockaddr *)&addr, len) == -1) {
+        perror("bind()");
+        close(tfd);
+        return -1;
+    }
+    if (listen(tfd, settings.backlog) == -1) {
+        perror("listen()");
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
 /**
  * Create a socket and bind it to a specific port number
  * @param interface the interface to bind to
@@ -4426,7 +5805,6 @@ static int server_socket(const char *interface,
                          enum network_transport transport,
                          FILE *portnumber_file) {
     int sfd;
-    struct linger ling = {0, 0};
     struct addrinfo *ai;
     struct addrinfo *next;
     struct addrinfo hints = { .ai_flags = AI_PASSIVE,
@@ -4476,21 +5854,11 @@ static int server_socket(const char *interface,
         }
 #endif
 
-        setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
         if (IS_UDP(transport)) {
+            setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
             maximize_sndbuf(sfd);
         } else {
-            error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
-            if (error != 0)
-                perror("setsockopt");
-
-            error = setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
-            if (error != 0)
-                perror("setsockopt");
+            set_tcp_listen_options(sfd);
         }
 
         if (bind(sfd, next->ai_addr, next->ai_addrlen) == -1) {
@@ -4549,6 +5917,21 @@ static int server_socket(const char *interface,
                                   EV_READ | EV_PERSIST,
                                   UDP_READ_BUFFER_SIZE, transport);
             }
+        } else if (settings.reuseport) {
+            int t;
+
+            /* Each worker accepts on a listener of its own. The others
+             * bind where the first did, in case the port was picked for
+             * us, and round robin hands one to every thread as for UDP. */
+            for (t = 0; t < settings.num_threads; t++) {
+                int per_thread_fd = t ? reuseport_socket(next, sfd) : sfd;
+                if (per_thread_fd == -1) {
+                    fprintf(stderr, "failed to open a listener per thread\n");
+                    exit(EXIT_FAILURE);
+                }
+                dispatch_conn_new(per_thread_fd, conn_listening,
+                                  EV_READ | EV_PERSIST, 1, transport);
+            }
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                                              EV_READ | EV_PERSIST, 1,
@@ -4725,6 +6108,10 @@ static void clock_handler(const int fd, const short which, void *arg) {
     event_base_set(main_base, &clockevent);
     evtimer_add(&clockevent, &t);
 
+    threadlocal_load_update();
+    if (settings.idle_timeout > 0)
+        threadlocal_idle_scan();
+
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
     if (monotonic) {
         struct timespec ts;
@@ -4778,7 +6165,9 @@ static void usage(void) {
            "              the memory page size could reduce the number of TLB misses\n"
            "              and improve the performance. In order to get large pages\n"
            "              from the OS, memcached will allocate the total item-cache\n"
-           "              in one large chunk.\n");
+           "              in one large chunk. On Linux reserved huge pages are\n"
+           "              used if there are enough, else transparent huge pages\n"
+           "              are requested for the item-cache and hash table.\n");
     printf("-D <char>     Use <char> as the delimiter between key prefixes and IDs.\n"
            "              This is used for per-prefix stats reporting. The default is\n"
            "              \":\" (colon). If this option is specified, stats collection\n"
@@ -4809,15 +6198,112 @@ static void usage(void) {
            "                The default is 3 hours.\n"
            "              - hash_algorithm: The hash table algorithm\n"
            "                default is jenkins hash. options: jenkins, murmur3\n"
+           "              - slab_automove_ratio: With slab_automove 3, move a page\n"
+           "                once the youngest evicting LRU tail is younger than this\n"
+           "                fraction of the oldest. default is 0.8.\n"
+           "              - slab_automove_interval: With slab_automove 3, minimum\n"
+           "                seconds between page moves. default is 2.\n"
            "              - lru_crawler: Enable LRU Crawler background thread\n"
            "              - lru_crawler_sleep: Microseconds to sleep between items\n"
            "                default is 100.\n"
            "              - lru_crawler_tocrawl: Max items to crawl per slab per run\n"
            "                default is 0 (unlimited)\n"
-           );
+           "              - lru_crawler_autocrawl: Let the LRU crawler decide on its\n"
+           "                own which slab classes to crawl and how often.\n"
+           "              - lru_crawler_budget: Max percent of wall time the LRU\n"
+           "                crawler may spend working. default is 100.\n"
+           "              - lru_crawler_threads: Number of LRU crawler threads.\n"
+           "                Slab classes are split between them. default is 1.\n"
+           "              - lock_profiler: Record lock contention and hold times\n"
+           "                for \"stats locks\" from startup.\n"
+           "              - large_item_max: Store items up to this size (k/m\n"
+           "                suffixes allowed) as chains of slab chunks. default\n"
+           "                is 0 (disabled).\n"
+           "              - slab_chunk_max: Size of the largest slab class, and of\n"
+           "                the chunks of large items. default is half of -I with\n"
+           "                large_item_max, else -I.\n");
+    printf("              - numa_interleave: Spread the item-cache and hash table\n"
+           "                evenly over all NUMA nodes (Linux only).\n"
+           "              - numa_local: Split the item-cache into one part per\n"
+           "                NUMA node and give threads slab pages and free\n"
+           "                chunks from their own node first (Linux only).\n"
+           "              - slab_sizes: Colon separated chunk sizes to use instead\n"
+           "                of -f and -n, such as \"stats fragmentation\" suggests.\n"
+           "              - prefault: Allocate the item-cache up front and fault\n"
+           "                it and the hash table in at startup with this many\n"
+           "                threads. default is one per cpu.\n"
+           "              - reuseport: Give every worker thread its own\n"
+           "                SO_REUSEPORT listener to accept TCP connections on,\n"
+           "                instead of handing them out from the main thread.\n"
+           "              - conn_placement: How the main thread picks a worker\n"
+           "                for a new connection. roundrobin (default), or load\n"
+           "                to pick the least busy, then the fewest connections.\n"
+           "              - conn_migrate: Move connections, between requests,\n"
+           "                off workers much busier than the others.\n"
+           "              - udp_batch: UDP datagrams to read, and replies to\n"
+           "                send, with one system call. 1 turns batching off.\n"
+           "                default is %d.\n"
+           "              - zerocopy[=size]: Send values of at least size\n"
+           "                bytes (default 16k) over TCP with MSG_ZEROCOPY.\n"
+           "              - io_uring: Workers read and send for their TCP\n"
+           "                connections through io_uring, many at a time.\n"
+           "              - conn_buffer_pool: Idle client connections give\n"
+           "                their buffers to a per-thread pool until they\n"
+           "                have something to read.\n"
+           "              - idle_timeout: Close client connections that have\n"
+           "                sent no command for this many seconds. default is\n"
+           "                0 (disabled).\n",
+           UDP_BATCH_DEFAULT);
+    printf("              - worker_cpus: Colon separated cpus and ranges,\n"
+           "                like 2-5:8, to pin worker threads to, one each.\n"
+           "              - housekeeping_cpus: Cpus, listed the same way,\n"
+           "                for the main thread and every other thread.\n"
+           "              - busy_poll: Microseconds a worker polls for more\n"
+           "                work before it sleeps, and SO_BUSY_POLL for\n"
+           "                client sockets. default is 0 (disabled).\n");
     return;
 }
 
+/* Parses a size in bytes with an optional k or m suffix, as -I takes. */
+static int parse_size(const char *str) {
+    char *end;
+    long size;
+
+    if (str == NULL)
+        return -1;
+    size = strtol(str, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+    if (end == str || *end != '\0' || size < 0 || size > INT_MAX)
+        return -1;
+    return (int)size;
+}
+
+/* Parses the colon separated chunk sizes of -o slab_sizes into a zero
+ * terminated list. Sizes are checked once slab_chunk_max is known. */
+static bool parse_slab_sizes(char *str, uint32_t *sizes) {
+    char *b = NULL;
+    char *p;
+    int i = 0;
+
+    if (str == NULL)
+        return false;
+    for (p = strtok_r(str, ":", &b); p != NULL; p = strtok_r(NULL, ":", &b)) {
+        /* a 0 would end the list early, silently dropping the rest */
+        if (i >= MAX_NUMBER_OF_SLAB_CLASSES - 1 ||
+            !safe_strtoul(p, &sizes[i]) || sizes[i] == 0)
+            return false;
+        i++;
+    }
+    sizes[i] = 0;
+    return i > 0;
+}
+
 static void usage_license(void) {
     printf(PACKAGE " " VERSION "\n\n");
     printf(
@@ -4993,6 +6479,9 @@ static int enable_large_pages(void) {
     }
 
     return ret;
+#elif defined(__linux__) && defined(MAP_ANONYMOUS)
+    /* Huge pages are asked for when the item-cache is mapped */
+    return 0;
 #else
     return -1;
 #endif
@@ -5042,8 +6531,13 @@ int main (int argc, char **argv) {
     bool protocol_specified = false;
     bool tcp_specified = false;
     bool udp_specified = false;
+    bool start_lru_crawler = false;
     enum hashfunc_type hash_type = JENKINS_HASH;
     uint32_t tocrawl;
+    uint32_t prefault_threads;
+    uint32_t slab_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+    int cpu_list[CPU_LIST_MAX];
+    bool use_slab_sizes = false;
 
     char *subopts;
     char *subopts_value;
@@ -5052,22 +6546,68 @@ int main (int argc, char **argv) {
         HASHPOWER_INIT,
         SLAB_REASSIGN,
         SLAB_AUTOMOVE,
+        SLAB_AUTOMOVE_RATIO,
+        SLAB_AUTOMOVE_INTERVAL,
         TAIL_REPAIR_TIME,
         HASH_ALGORITHM,
         LRU_CRAWLER,
         LRU_CRAWLER_SLEEP,
-        LRU_CRAWLER_TOCRAWL
+        LRU_CRAWLER_TOCRAWL,
+        LRU_CRAWLER_AUTOCRAWL,
+        LRU_CRAWLER_BUDGET,
+        LRU_CRAWLER_THREADS,
+        LOCK_PROFILER,
+        LARGE_ITEM_MAX,
+        SLAB_CHUNK_MAX,
+        NUMA_INTERLEAVE,
+        NUMA_LOCAL,
+        SLAB_SIZES,
+        PREFAULT,
+        REUSEPORT,
+        CONN_PLACEMENT,
+        CONN_MIGRATE,
+        UDP_BATCH,
+        ZEROCOPY,
+        IO_URING,
+        CONN_BUFFER_POOL,
+        IDLE_TIMEOUT,
+        WORKER_CPUS,
+        HOUSEKEEPING_CPUS,
+        BUSY_POLL
     };
     char *const subopts_tokens[] = {
         [MAXCONNS_FAST] = "maxconns_fast",
         [HASHPOWER_INIT] = "hashpower",
         [SLAB_REASSIGN] = "slab_reassign",
         [SLAB_AUTOMOVE] = "slab_automove",
+        [SLAB_AUTOMOVE_RATIO] = "slab_automove_ratio",
+        [SLAB_AUTOMOVE_INTERVAL] = "slab_automove_interval",
         [TAIL_REPAIR_TIME] = "tail_repair_time",
         [HASH_ALGORITHM] = "hash_algorithm",
         [LRU_CRAWLER] = "lru_crawler",
         [LRU_CRAWLER_SLEEP] = "lru_crawler_sleep",
         [LRU_CRAWLER_TOCRAWL] = "lru_crawler_tocrawl",
+        [LRU_CRAWLER_AUTOCRAWL] = "lru_crawler_autocrawl",
+        [LRU_CRAWLER_BUDGET] = "lru_crawler_budget",
+        [LRU_CRAWLER_THREADS] = "lru_crawler_threads",
+        [LOCK_PROFILER] = "lock_profiler",
+        [LARGE_ITEM_MAX] = "large_item_max",
+        [SLAB_CHUNK_MAX] = "slab_chunk_max",
+        [NUMA_INTERLEAVE] = "numa_interleave",
+        [NUMA_LOCAL] = "numa_local",
+        [SLAB_SIZES] = "slab_sizes",
+        [PREFAULT] = "prefault",
+        [REUSEPORT] = "reuseport",
+        [CONN_PLACEMENT] = "conn_placement",
+        [CONN_MIGRATE] = "conn_migrate",
+        [UDP_BATCH] = "udp_batch",
+        [ZEROCOPY] = "zerocopy",
+        [IO_URING] = "io_uring",
+        [CONN_BUFFER_POOL] = "conn_buffer_pool",
+        [IDLE_TIMEOUT] = "idle_timeout",
+        [WORKER_CPUS] = "worker_cpus",
+        [HOUSEKEEPING_CPUS] = "housekeeping_cpus",
+        [BUSY_POLL] = "busy_poll",
         NULL
     };
 
@@ -5248,9 +6788,9 @@ int main (int argc, char **argv) {
         case 'L' :
             if (enable_large_pages() == 0) {
                 preallocate = true;
+                settings.large_pages = true;
             } else {
-                fprintf(stderr, "Cannot enable large pages on this system\n"
-                    "(There is no Linux support as of this version)\n");
+                fprintf(stderr, "Cannot enable large pages on this system\n");
                 return 1;
             }
             break;
@@ -5351,8 +6891,30 @@ int main (int argc, char **argv) {
                     break;
                 }
                 settings.slab_automove = atoi(subopts_value);
-                if (settings.slab_automove < 0 || settings.slab_automove > 2) {
-                    fprintf(stderr, "slab_automove must be between 0 and 2\n");
+                if (settings.slab_automove < 0 || settings.slab_automove > 3) {
+                    fprintf(stderr, "slab_automove must be between 0 and 3\n");
+                    return 1;
+                }
+                break;
+            case SLAB_AUTOMOVE_RATIO:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_automove_ratio argument\n");
+                    return 1;
+                }
+                settings.slab_automove_ratio = atof(subopts_value);
+                if (settings.slab_automove_ratio <= 0 || settings.slab_automove_ratio > 1) {
+                    fprintf(stderr, "slab_automove_ratio must be above 0 and at most 1\n");
+                    return 1;
+                }
+                break;
+            case SLAB_AUTOMOVE_INTERVAL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_automove_interval argument\n");
+                    return 1;
+                }
+                settings.slab_automove_interval = atoi(subopts_value);
+                if (settings.slab_automove_interval < 0) {
+                    fprintf(stderr, "slab_automove_interval cannot be negative\n");
                     return 1;
                 }
                 break;
@@ -5382,10 +6944,7 @@ int main (int argc, char **argv) {
                 }
                 break;
             case LRU_CRAWLER:
-                if (start_item_crawler_thread() != 0) {
-                    fprintf(stderr, "Failed to enable LRU crawler thread\n");
-                    return 1;
-                }
+                start_lru_crawler = true;
                 break;
             case LRU_CRAWLER_SLEEP:
                 settings.lru_crawler_sleep = atoi(subopts_value);
@@ -5401,6 +6960,202 @@ int main (int argc, char **argv) {
                 }
                 settings.lru_crawler_tocrawl = tocrawl;
                 break;
+            case LRU_CRAWLER_AUTOCRAWL:
+                settings.lru_crawler_autocrawl = true;
+                break;
+            case LRU_CRAWLER_BUDGET:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing lru_crawler_budget argument\n");
+                    return 1;
+                }
+                settings.lru_crawler_budget = atoi(subopts_value);
+                if (settings.lru_crawler_budget < 1 || settings.lru_crawler_budget > 100) {
+                    fprintf(stderr, "lru_crawler_budget must be between 1 and 100\n");
+                    return 1;
+                }
+                break;
+            case LRU_CRAWLER_THREADS:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing lru_crawler_threads argument\n");
+                    return 1;
+                }
+                settings.lru_crawler_threads = atoi(subopts_value);
+                if (settings.lru_crawler_threads < 1 ||
+                    settings.lru_crawler_threads > MAX_NUMBER_OF_SLAB_CLASSES) {
+                    fprintf(stderr, "lru_crawler_threads must be between 1 and %d\n",
+                            MAX_NUMBER_OF_SLAB_CLASSES);
+                    return 1;
+                }
+                break;
+            case LOCK_PROFILER:
+                lockprof_enabled = true;
+                break;
+            case LARGE_ITEM_MAX:
+                settings.large_item_max = parse_size(subopts_value);
+                if (settings.large_item_max <= 0 ||
+                    settings.large_item_max > 1024 * 1024 * 1024) {
+                    fprintf(stderr, "large_item_max must be between 1 byte and 1024 mb\n");
+                    return 1;
+                }
+                break;
+            case SLAB_CHUNK_MAX:
+                settings.slab_chunk_max = parse_size(subopts_value);
+                if (settings.slab_chunk_max <= 0) {
+                    fprintf(stderr, "Missing or bad slab_chunk_max argument\n");
+                    return 1;
+                }
+                break;
+            case NUMA_INTERLEAVE:
+#if defined(__linux__) && defined(SYS_mbind)
+                settings.numa_interleave = true;
+#else
+                fprintf(stderr, "numa_interleave is only supported on Linux\n");
+                return 1;
+#endif
+                break;
+            case NUMA_LOCAL:
+#if defined(__linux__) && defined(SYS_mbind)
+                settings.numa_local = true;
+#else
+                fprintf(stderr, "numa_local is only supported on Linux\n");
+                return 1;
+#endif
+                break;
+            case SLAB_SIZES:
+                if (!parse_slab_sizes(subopts_value, slab_sizes)) {
+                    fprintf(stderr, "Missing or bad slab_sizes argument\n");
+                    return 1;
+                }
+                use_slab_sizes = true;
+                break;
+            case PREFAULT:
+                if (subopts_value == NULL) {
+                    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    settings.prefault_threads = ncpus > 0 ? ncpus : 1;
+                    break;
+                }
+                if (!safe_strtoul(subopts_value, &prefault_threads) ||
+                    prefault_threads < 1 || prefault_threads > 256) {
+                    fprintf(stderr, "prefault threads must be between 1 and 256\n");
+                    return 1;
+                }
+                settings.prefault_threads = prefault_threads;
+                break;
+            case REUSEPORT:
+#ifdef SO_REUSEPORT
+                settings.reuseport = true;
+#else
+                fprintf(stderr, "reuseport isn't supported on this platform\n");
+                return 1;
+#endif
+                break;
+            case CONN_PLACEMENT:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing conn_placement argument\n");
+                    return 1;
+                }
+                if (strcmp(subopts_value, "roundrobin") == 0) {
+                    settings.conn_placement = PLACE_ROUND_ROBIN;
+                } else if (strcmp(subopts_value, "load") == 0) {
+                    settings.conn_placement = PLACE_LEAST_LOADED;
+                } else {
+                    fprintf(stderr, "Unknown conn_placement option (roundrobin, load)\n");
+                    return 1;
+                }
+                break;
+            case CONN_MIGRATE:
+                settings.conn_migrate = true;
+                break;
+            case UDP_BATCH:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing udp_batch argument\n");
+                    return 1;
+                }
+                settings.udp_batch = atoi(subopts_value);
+                if (settings.udp_batch < 1 ||
+                    settings.udp_batch > UDP_BATCH_MAX) {
+                    fprintf(stderr, "udp_batch must be between 1 and %d\n",
+                            UDP_BATCH_MAX);
+                    return 1;
+                }
+#ifndef UDP_BATCHING
+                if (settings.udp_batch > 1) {
+                    fprintf(stderr, "udp_batch needs recvmmsg and sendmmsg\n");
+                    return 1;
+                }
+#endif
+                break;
+            case ZEROCOPY:
+#ifndef USE_ZEROCOPY
+                fprintf(stderr, "zerocopy isn't supported on this platform\n");
+                return 1;
+#endif
+                if (subopts_value == NULL) {
+                    settings.zerocopy_min = 16 * 1024;
+                } else {
+                    settings.zerocopy_min = parse_size(subopts_value);
+                    if (settings.zerocopy_min <= 0) {
+                        fprintf(stderr, "Missing or bad zerocopy size\n");
+                        return 1;
+                    }
+                }
+                break;
+            case IO_URING:
+#ifndef USE_IO_URING
+                fprintf(stderr, "io_uring isn't supported on this platform\n");
+                return 1;
+#endif
+                settings.io_uring = true;
+                break;
+            case CONN_BUFFER_POOL:
+                settings.conn_buffer_pool = true;
+                break;
+            case IDLE_TIMEOUT:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing idle_timeout argument\n");
+                    return 1;
+                }
+                settings.idle_timeout = atoi(subopts_value);
+                if (settings.idle_timeout < 0) {
+                    fprintf(stderr, "idle_timeout cannot be negative\n");
+                    return 1;
+                }
+                break;
+            case WORKER_CPUS:
+#ifndef CPU_PINNING
+                fprintf(stderr, "worker_cpus isn't supported on this platform\n");
+                return 1;
+#endif
+                if (subopts_value == NULL ||
+                    parse_cpu_list(subopts_value, cpu_list, CPU_LIST_MAX) <= 0) {
+                    fprintf(stderr, "Missing or bad worker_cpus list\n");
+                    return 1;
+                }
+                settings.worker_cpus = strdup(subopts_value);
+                break;
+            case HOUSEKEEPING_CPUS:
+#ifndef CPU_PINNING
+                fprintf(stderr, "housekeeping_cpus isn't supported on this platform\n");
+                return 1;
+#endif
+                if (subopts_value == NULL ||
+                    parse_cpu_list(subopts_value, cpu_list, CPU_LIST_MAX) <= 0) {
+                    fprintf(stderr, "Missing or bad housekeeping_cpus list\n");
+                    return 1;
+                }
+                settings.housekeeping_cpus = strdup(subopts_value);
+                break;
+            case BUSY_POLL:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing busy_poll argument\n");
+                    return 1;
+                }
+                settings.busy_poll = atoi(subopts_value);
+                if (settings.busy_poll < 0) {
+                    fprintf(stderr, "busy_poll cannot be negative\n");
+                    return 1;
+                }
+                break;
             default:
                 printf("Illegal suboption \"%s\"\n", subopts_value);
                 return 1;
@@ -5414,6 +7169,72 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (settings.numa_interleave && settings.numa_local) {
+        fprintf(stderr, "numa_interleave and numa_local can't be combined\n");
+        return 1;
+    }
+    /* Both place a mapping of the whole item-cache */
+    if ((settings.numa_interleave || settings.numa_local) &&
+        settings.maxbytes == 0) {
+        fprintf(stderr, "NUMA placement needs a memory limit (-m)\n");
+        return 1;
+    }
+
+    if (settings.slab_chunk_max == 0) {
+        settings.slab_chunk_max = settings.large_item_max != 0 ?
+            settings.item_size_max / 2 : settings.item_size_max;
+    } else if (settings.large_item_max == 0) {
+        fprintf(stderr, "slab_chunk_max requires large_item_max\n");
+        return 1;
+    }
+    /* Chunks must keep the items of a page aligned, and the header of
+     * a chunked item has to fit in one with room to spare */
+    if (settings.large_item_max != 0 &&
+        (settings.slab_chunk_max > settings.item_size_max ||
+         settings.slab_chunk_max < 4096 ||
+         settings.slab_chunk_max % CHUNK_ALIGN_BYTES != 0)) {
+        fprintf(stderr, "slab_chunk_max must be a multiple of %d between "
+                "4096 and the item size max (-I)\n", CHUNK_ALIGN_BYTES);
+        return 1;
+    }
+    if (use_slab_sizes) {
+        uint32_t last = sizeof(item);
+        int i;
+        for (i = 0; slab_sizes[i] != 0; i++) {
+            if (slab_sizes[i] <= last) {
+                fprintf(stderr, "slab_sizes must be increasing and larger "
+                        "than an item header (%d bytes)\n", (int)sizeof(item));
+                return 1;
+            }
+            if (slab_sizes[i] % CHUNK_ALIGN_BYTES != 0) {
+                fprintf(stderr, "slab_sizes must be multiples of %d\n",
+                        CHUNK_ALIGN_BYTES);
+                return 1;
+            }
+            last = slab_sizes[i];
+        }
+        /* The largest class is always slab_chunk_max */
+        if (last >= (uint32_t)settings.slab_chunk_max) {
+            fprintf(stderr, "slab_sizes must be smaller than %d\n",
+                    settings.slab_chunk_max);
+            return 1;
+        }
+        if (i > POWER_LARGEST - 2) {
+            fprintf(stderr, "slab_sizes can't have more than %d classes\n",
+                    POWER_LARGEST - 2);
+            return 1;
+        }
+    }
+#ifdef COMPACT_ITEMS
+    /* Item links can't reach past the arena */
+    if (settings.maxbytes > ITEM_ARENA_MAX - LARGE_PAGE_SIZE) {
+        fprintf(stderr, "Cannot use more than %lu megabytes of memory with "
+                "compact items\n",
+                (unsigned long)(ITEM_ARENA_MAX / (1024 * 1024)) - 2);
+        return 1;
+    }
+#endif
+
     if (hash_init(hash_type) != 0) {
         fprintf(stderr, "Failed to initialize hash_algorithm!\n");
         exit(EX_USAGE);
@@ -5542,7 +7363,8 @@ int main (int argc, char **argv) {
     stats_init();
     assoc_init(settings.hashpower_init);
     conn_init();
-    slabs_init(settings.maxbytes, settings.factor, preallocate);
+    slabs_init(settings.maxbytes, settings.factor, preallocate,
+               use_slab_sizes ? slab_sizes : NULL);
 
     /*
      * ignore SIGPIPE signals; we can use errno == EPIPE if we
@@ -5568,7 +7390,15 @@ int main (int argc, char **argv) {
     }
 
     /* Run regardless of initializing it later */
-    init_lru_crawler();
+    if (init_lru_crawler() != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Started once all of its -o options have been parsed */
+    if (start_lru_crawler && start_item_crawler_thread() != 0) {
+        fprintf(stderr, "Failed to enable LRU crawler thread\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* initialise clock event */
     clock_handler(0, 0, 0);
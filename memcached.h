@@ -17,10 +17,13 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
 #include <stdio.h>	
 
 #include "protocol_binary.h"
 #include "cache.h"
+#include "lockprof.h"
+#include "uring.h"
 
 #include "sasl_defs.h"
 
@@ -34,6 +37,39 @@
 #define UDP_READ_BUFFER_SIZE 65536
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
+
+/* Datagrams a UDP connection reads or sends with one system call */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#define UDP_BATCHING 1
+#define UDP_BATCH_DEFAULT 32
+#else
+#define UDP_BATCH_DEFAULT 1
+#endif
+#define UDP_BATCH_MAX 1024
+
+/* Limits on requests that span several datagrams. Each can be as long as
+ * a UDP connection's read buffer. */
+#define UDP_REASSEMBLY_MAX 128     /* requests being put together at once */
+#define UDP_REASSEMBLY_PARTS 128   /* datagrams in one request */
+#define UDP_REASSEMBLY_TIMEOUT 2   /* seconds to wait for the rest */
+
+/* MSG_ZEROCOPY sends a connection may have in flight */
+#define ZEROCOPY_HOLDS_MAX 64
+/* How often a closing connection checks whether they're all done */
+#define ZEROCOPY_CLOSE_POLL_USEC 10000
+
+/* Each worker's io_uring, with -o io_uring */
+#define URING_ENTRIES 4096
+#define URING_BUFS 512          /* buffers for reads waiting on requests */
+#define URING_BUF_SIZE 4096
+
+/* Idle connections' buffer sets a worker keeps, with -o conn_buffer_pool */
+#define CONN_BUF_POOL_MAX 256
+
+/* Threads can be pinned, with -o worker_cpus and housekeeping_cpus */
+#if defined(__linux__) && defined(CPU_SET)
+#define CPU_PINNING 1
+#endif
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
 /* I'm told the max length of a 64-bit num converted to string is 20 bytes.
  * Plus a few for spaces, \r\n, \0 */
@@ -106,10 +142,54 @@
          + (item)->nsuffix \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
-#define ITEM_ntotal(item) (sizeof(struct _stritem) + (item)->nkey + 1 \
+/* Chunked items take exactly one chunk of the largest class for their
+ * header and the start of their value. */
+#define ITEM_ntotal(item) (((item)->it_flags & ITEM_CHUNKED) ? \
+         (size_t)settings.slab_chunk_max : \
+         sizeof(struct _stritem) + (item)->nkey + 1 \
          + (item)->nsuffix + (item)->nbytes \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
+/* First chunk of a chunked item, aligned after the suffix */
+#define ITEM_chunk(item) ((item_chunk *)(((uintptr_t)ITEM_data(item) + 7) \
+         & ~(uintptr_t)7))
+
+/*
+ * Links between items, and between the chunks of an item. Built with
+ * --enable-compact-items they are 32 bit offsets into the slab arena in
+ * CHUNK_ALIGN_BYTES units, plus one so that 0 is NULL, which takes an item
+ * header from 48 to 32 bytes. Links are only ever followed and set through
+ * these.
+ */
+#ifdef COMPACT_ITEMS
+#define ITEM_LINK(type) uint32_t
+extern char *item_arena;
+#define LINK_TO_PTR(l) ((l) ? \
+        (void *)(item_arena + ((size_t)((l) - 1) << 3)) : NULL)
+#define PTR_TO_LINK(p) ((p) ? \
+        (uint32_t)((((char *)(p) - item_arena) >> 3) + 1) : 0)
+/* All items and chunks must sit within this much of item_arena */
+#define ITEM_ARENA_MAX ((size_t)UINT32_MAX << 3)
+#else
+#define ITEM_LINK(type) type *
+#define LINK_TO_PTR(l) (l)
+#define PTR_TO_LINK(p) (p)
+#endif
+
+#define ITEM_next(it)   ((item *)LINK_TO_PTR((it)->next))
+#define ITEM_prev(it)   ((item *)LINK_TO_PTR((it)->prev))
+#define ITEM_h_next(it) ((item *)LINK_TO_PTR((it)->h_next))
+#define ITEM_set_next(it, p)   ((it)->next = PTR_TO_LINK(p))
+#define ITEM_set_prev(it, p)   ((it)->prev = PTR_TO_LINK(p))
+#define ITEM_set_h_next(it, p) ((it)->h_next = PTR_TO_LINK(p))
+
+#define CHUNK_next(ch) ((item_chunk *)LINK_TO_PTR((ch)->next))
+#define CHUNK_prev(ch) ((item_chunk *)LINK_TO_PTR((ch)->prev))
+#define CHUNK_head(ch) ((item *)LINK_TO_PTR((ch)->head))
+#define CHUNK_set_next(ch, p) ((ch)->next = PTR_TO_LINK(p))
+#define CHUNK_set_prev(ch, p) ((ch)->prev = PTR_TO_LINK(p))
+#define CHUNK_set_head(ch, p) ((ch)->head = PTR_TO_LINK(p))
+
 #define STAT_KEY_LEN 128
 #define STAT_VAL_LEN 128
 
@@ -159,6 +239,7 @@ enum conn_states {
     conn_closing,    /**< closing this connection */
     conn_mwrite,     /**< writing out many items sequentially */
     conn_closed,     /**< connection is closed */
+    conn_watch,      /**< handed over to the LRU crawler for a metadump */
     conn_max_state   /**< Max state value (used for assertion) */
 };
 
@@ -189,6 +270,11 @@ enum network_transport {
     udp_transport
 };
 
+enum conn_placement {
+    PLACE_ROUND_ROBIN = 0, /* take turns */
+    PLACE_LEAST_LOADED     /* least busy worker, then fewest connections */
+};
+
 enum item_lock_types {
     ITEM_LOCK_GRANULAR = 0,
     ITEM_LOCK_GLOBAL
@@ -227,10 +313,10 @@ struct slab_stats {
 };
 
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread. Only the owning worker thread ever writes these;
+ * see THR_STATS_ADD.
  */
 struct thread_stats {
-    pthread_mutex_t   mutex;
     uint64_t          get_cmds;
     uint64_t          get_misses;
     uint64_t          touch_cmds;
@@ -245,17 +331,63 @@ struct thread_stats {
     uint64_t          conn_yields; /* # of yields for connections (-R option)*/
     uint64_t          auth_cmds;
     uint64_t          auth_errors;
+    uint64_t          accepts;     /* TCP connections taken on */
+    uint64_t          requests;    /* commands read off connections */
+    uint64_t          migrations;  /* connections moved to another thread */
+    uint64_t          zerocopy_sends;     /* sendmsg() calls with MSG_ZEROCOPY */
+    uint64_t          zerocopy_bytes;     /* bytes they sent */
+    uint64_t          zerocopy_copied;    /* of those, ones the kernel copied */
+    uint64_t          zerocopy_fallbacks; /* big iovecs sent the usual way */
+    uint64_t          zerocopy_completions; /* sends the kernel was done with */
+    uint64_t          zerocopy_completion_usec; /* time from send to notice */
+    uint64_t          io_uring_enters;      /* io_uring_enter() calls */
+    uint64_t          io_uring_completions; /* requests they finished */
+    uint64_t          idle_kicks;   /* connections closed for idling */
+    uint64_t          busy_poll_hits; /* polls that found work, not sleeps */
     struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
 };
 
+/*
+ * The request path bumps its thread's counters without taking any lock:
+ * they are read racily by threadlocal_stats_aggregate(), so relaxed atomic
+ * loads and stores are enough to keep the compiler from tearing or caching
+ * an update, and compile to plain moves rather than locked instructions.
+ */
+#ifdef __ATOMIC_RELAXED
+#define THREAD_STATS_ADD(t, field, n) \
+    __atomic_store_n(&(t)->stats.field, \
+        __atomic_load_n(&(t)->stats.field, __ATOMIC_RELAXED) + (n), \
+        __ATOMIC_RELAXED)
+#else
+#define THREAD_STATS_ADD(t, field, n) ((t)->stats.field += (n))
+#endif
+#define THR_STATS_ADD(c, field, n) THREAD_STATS_ADD((c)->thread, field, n)
+#define THR_STATS_INCR(c, field) THR_STATS_ADD(c, field, 1)
+
+/* A thread's connection count changes on the thread placing a connection
+ * as well as on the owner, so it's the one per-thread load figure that
+ * needs a real atomic add. */
+#ifdef __ATOMIC_RELAXED
+#define THR_CONNS_ADD(t, n) __atomic_add_fetch(&(t)->conns, (n), __ATOMIC_RELAXED)
+#define THR_CONNS_READ(t) __atomic_load_n(&(t)->conns, __ATOMIC_RELAXED)
+#else
+#define THR_CONNS_ADD(t, n) __sync_add_and_fetch(&(t)->conns, (n))
+#define THR_CONNS_READ(t) ((t)->conns)
+#endif
+
+/* Keeps data written by different threads out of each other's cache lines */
+#define CACHE_LINE_SIZE 64
+#if defined(__GNUC__)
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+#else
+#define CACHE_ALIGNED
+#endif
+
 /**
  * Global stats.
  */
 struct stats {
     pthread_mutex_t mutex;
-    unsigned int  curr_items;
-    unsigned int  total_items;
-    uint64_t      curr_bytes;
     unsigned int  curr_conns;
     unsigned int  total_conns;
     uint64_t      rejected_conns;
@@ -281,7 +413,12 @@ struct stats {
     uint64_t      evicted_unfetched; /* items evicted but never touched */
     bool          slab_reassign_running; /* slab reassign in progress */
     uint64_t      slabs_moved;       /* times slabs were moved around */
+    uint64_t      slab_reassign_rescues; /* live items moved off a page */
+    uint64_t      slab_reassign_evictions; /* live items dropped instead */
     bool          lru_crawler_running; /* crawl in progress */
+    uint64_t      lru_crawler_starts; /* per-class crawls kicked off */
+    uint64_t      lru_crawler_pass_usec; /* duration of the last full crawl */
+    uint64_t      lru_crawler_items_per_sec; /* throughput of the last crawl */
 	uint64_t	  changes_after_last_snapshot;
 	uint64_t	  slabs_num;
 };
@@ -320,6 +457,25 @@ struct settings {
     bool lru_crawler;        /* Whether or not to enable the autocrawler thread */
     bool slab_reassign;     /* Whether or not slab reassignment is allowed */
     int slab_automove;     /* Whether or not to automatically move slabs */
+    double slab_automove_ratio; /* Youngest:oldest tail age that moves a page */
+    int slab_automove_interval; /* Min seconds between age balancer moves */
+    int slab_chunk_max;     /* Size of the largest slab class */
+    int large_item_max;     /* Max size of chunked items, 0 if disabled */
+    bool large_pages;       /* Back the item-cache with huge pages (-L) */
+    bool numa_interleave;   /* Spread big allocations over NUMA nodes */
+    bool numa_local;        /* Slab memory from the allocating thread's node */
+    int prefault_threads;   /* Fault in memory at startup, 0 if not */
+    bool reuseport;         /* Workers accept on SO_REUSEPORT listeners */
+    enum conn_placement conn_placement; /* How to pick a worker for a conn */
+    bool conn_migrate;      /* Move busy connections off overloaded workers */
+    int udp_batch;          /* Datagrams per recvmmsg/sendmmsg, 1 to not batch */
+    int zerocopy_min;       /* Send values this big with MSG_ZEROCOPY, 0 if not */
+    bool io_uring;          /* Workers do client i/o through io_uring */
+    bool conn_buffer_pool;  /* Idle connections give their buffers back */
+    int idle_timeout;       /* Close connections idle this long, 0 if not */
+    char *worker_cpus;      /* Cpus to pin workers to, one each, or NULL */
+    char *housekeeping_cpus; /* Cpus for every other thread, or NULL */
+    int busy_poll;          /* Microseconds workers poll before sleeping */
     int hashpower_init;     /* Starting hash power level */
     bool shutdown_command; /* allow shutdown command */
     int tail_repair_time;   /* LRU tail refcount leak repair time */
@@ -327,6 +483,9 @@ struct settings {
     char *hash_algorithm;     /* Hash algorithm in use */
     int lru_crawler_sleep;  /* Microsecond sleep between items */
     uint32_t lru_crawler_tocrawl; /* Number of items to crawl per run */
+    bool lru_crawler_autocrawl; /* Let the crawler schedule its own runs */
+    int lru_crawler_budget; /* Max percent of wall time spent crawling */
+    int lru_crawler_threads; /* Number of LRU crawler threads */
 
 	char *persisted_data_path; /* ־ûĿ¼ */
 	int change_num_need_snapshop; /* ĿС */
@@ -345,13 +504,18 @@ extern struct settings settings;
 
 #define ITEM_FETCHED 8
 
+/* The value is kept in a chain of item_chunk */
+#define ITEM_CHUNKED 16
+/* Not an item but an item_chunk of a chunked item */
+#define ITEM_CHUNK 32
+
 /**
  * Structure for storing items within memcached.
  */
 typedef struct _stritem {
-    struct _stritem *next;
-    struct _stritem *prev;
-    struct _stritem *h_next;    /* hash chain next */
+    ITEM_LINK(struct _stritem) next;
+    ITEM_LINK(struct _stritem) prev;
+    ITEM_LINK(struct _stritem) h_next; /* hash chain next */
     rel_time_t      time;       /* least recent access */
     rel_time_t      exptime;    /* expire time */
     int             nbytes;     /* size of data */
@@ -373,9 +537,9 @@ typedef struct _stritem {
 } item;
 
 typedef struct {
-    struct _stritem *next;
-    struct _stritem *prev;
-    struct _stritem *h_next;    /* hash chain next */
+    ITEM_LINK(struct _stritem) next;
+    ITEM_LINK(struct _stritem) prev;
+    ITEM_LINK(struct _stritem) h_next; /* hash chain next */
     rel_time_t      time;       /* least recent access */
     rel_time_t      exptime;    /* expire time */
     int             nbytes;     /* size of data */
@@ -385,18 +549,64 @@ typedef struct {
     uint8_t         slabs_clsid;/* which slab class we're in */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
     uint32_t        remaining;  /* Max keys to crawl per slab per invocation */
+#ifdef COMPACT_ITEMS
+    uint32_t        unused;     /* Keeps crawlers 8 byte aligned in the arena */
+#endif
 } crawler;
 
+/**
+ * A piece of the value of an item larger than slab_chunk_max. The first
+ * chunk sits in the item's own slab chunk, the others are chunks of the
+ * largest slab class of their own. Laid out like an item up to slabs_clsid
+ * so that code walking slab pages can tell chunks from items.
+ */
+typedef struct _strchunk {
+    ITEM_LINK(struct _strchunk) next; /* next chunk of the value */
+    ITEM_LINK(struct _strchunk) prev; /* previous chunk, NULL for the first */
+    ITEM_LINK(struct _stritem) head;  /* item the chunk belongs to */
+    int             size;       /* bytes of the value held here */
+    int             unused1;
+    int             unused2;
+    unsigned short  unused3;
+    uint8_t         unused4;
+    uint8_t         it_flags;   /* ITEM_CHUNK */
+    uint8_t         slabs_clsid;/* which slab class we're in */
+    char            data[];
+} item_chunk;
+
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
-    struct event notify_event;  /* listen event for notify pipe */
-    int notify_receive_fd;      /* receiving end of notify pipe */
-    int notify_send_fd;         /* sending end of notify pipe */
-    struct thread_stats stats;  /* Stats generated by this thread */
+    struct event notify_event;  /* listen event for notify fd */
+    int notify_receive_fd;      /* receiving end of notify pipe or eventfd */
+    int notify_send_fd;         /* sending end, the same fd for an eventfd */
+    struct thread_stats stats CACHE_ALIGNED; /* Stats generated by this thread */
+    struct thread_stats stats_base; /* stats as of the last "stats reset" */
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
     cache_t *suffix_cache;      /* suffix cache */
     uint8_t item_lock_type;     /* use fine-grained or global item lock */
+    struct event listen_retry_event; /* polls to resume accepting */
+    bool listen_retry;          /* listen_retry_event is pending */
+    /* Requests other threads leave before a wakeup */
+    volatile bool lock_type_switch; /* change to lock_type_wanted */
+    uint8_t lock_type_wanted;
+    volatile bool listen_update;    /* call update_listen_conns() */
+    /* Load, for placing and moving connections */
+    int conns;                  /* client connections owned or on the way */
+    unsigned int busy;          /* permille of a cpu used over the last second */
+    unsigned int rps;           /* requests over the last second */
+    volatile int migrate_to;    /* move one connection to this thread, or -1 */
+    uint64_t load_cpu_ns;       /* cpu time and requests at the last sample */
+    uint64_t load_requests;
+    struct uring *ring;         /* with -o io_uring, else NULL */
+    struct event ring_event;    /* the ring has completions */
+    /* With -o conn_buffer_pool; the owner changes these, stats reads them */
+    struct conn_bufs *buf_pool; /* buffer sets idle connections gave back */
+    int buf_pool_count;
+    int bufs_attached;          /* sets held by this thread's connections */
+    volatile bool idle_scan;    /* call conn_idle_scan() */
+    struct conn *conn_list;     /* client connections it owns; owner only */
+    uint64_t events;            /* callbacks run, for -o busy_poll */
 } LIBEVENT_THREAD;
 
 typedef struct {
@@ -434,6 +644,7 @@ struct conn {
 
     char   *ritem;  /** when we read in an item's value, it goes here */
     int    rlbytes;
+    item_chunk *rchunk; /** chunk ritem points into for chunked items */
 
     /* data for the nread state */
 
@@ -478,6 +689,18 @@ struct conn {
     socklen_t request_addr_size;
     unsigned char *hdrbuf; /* udp packet headers */
     int    hdrsize;   /* number of headers' worth of space is allocated */
+    struct udp_batch *udp_rx; /* udp: datagrams read but not yet handled */
+    struct udp_batch *udp_tx; /* udp: replies not yet sent */
+    bool   zerocopy;  /* socket takes MSG_ZEROCOPY */
+    uint32_t zc_seq;  /* number the kernel gives the next zerocopy send */
+    struct zerocopy_hold *zc_holds; /* items held for sends in flight */
+    int    zc_holds_used;
+    bool   zc_closing; /* shut down, closes once zc_holds_used is 0 */
+    bool   uring;     /* i/o goes through the thread's io_uring */
+    bool   uring_closing; /* close once the pending request finishes */
+    unsigned char uring_op; /* request the ring has on the socket */
+    int    uring_rres; /* what the last ring read brought, -EAGAIN if used */
+    int    uring_wres; /* result of the last ring send, -EAGAIN if used */
 
     bool   noreply;   /* True if the reply should not be sent. */
     /* current stats command */
@@ -496,6 +719,8 @@ struct conn {
     int keylen;
     conn   *next;     /* Used for generating a list of conn structures */
     LIBEVENT_THREAD *thread; /* Pointer to the thread object serving this connection */
+    conn   *thread_next; /* the thread's conn_list */
+    conn   *thread_prev;
 };
 
 /* array of conn structures, indexed by file descriptor */
@@ -523,12 +748,23 @@ extern struct slab_rebalance slab_rebal;
  * Functions
  */
 void do_accept_new_conns(const bool do_accept);
+void add_listen_conn(conn *c);
+void update_listen_conns(LIBEVENT_THREAD *me);
 enum delta_result_type do_add_delta(conn *c, const char *key,
                                     const size_t nkey, const bool incr,
                                     const int64_t delta, char *buf,
                                     uint64_t *cas, const uint32_t hv);
 enum store_item_type do_store_item(item *item, int comm, conn* c, const uint32_t hv);
 conn *conn_new(const int sfd, const enum conn_states init_state, const int event_flags, const int read_buffer_size, enum network_transport transport, struct event_base *base);
+void conn_worker_readd(conn *c);
+void conn_buffers_release(conn *c);
+void conn_thread_link(conn *c);
+void conn_thread_unlink(conn *c);
+void conn_idle_scan(LIBEVENT_THREAD *me);
+#ifdef USE_IO_URING
+void conn_uring_start(conn *c);
+void conn_uring_complete(void *data, int res, const char *buf);
+#endif
 extern int daemonize(int nochdir, int noclose);
 
 static inline int mutex_lock(pthread_mutex_t *mutex)
@@ -539,6 +775,15 @@ static inline int mutex_lock(pthread_mutex_t *mutex)
 
 #define mutex_unlock(x) pthread_mutex_unlock(x)
 
+/* cache_lock goes through the lock profiler. CACHE_LOCK() spins like
+ * mutex_lock(); CACHE_LOCK_BLOCKING() sleeps in pthread_mutex_lock(). */
+#define CACHE_LOCK() \
+    lockprof_lock(&cache_lock, LOCKPROF_CACHE_LOCK, NULL, true)
+#define CACHE_LOCK_BLOCKING() \
+    lockprof_lock(&cache_lock, LOCKPROF_CACHE_LOCK, NULL, false)
+#define CACHE_UNLOCK() \
+    lockprof_unlock(&cache_lock, LOCKPROF_CACHE_LOCK, NULL)
+
 #include "stats.h"
 #include "slabs.h"
 #include "assoc.h"
@@ -557,6 +802,12 @@ static inline int mutex_lock(pthread_mutex_t *mutex)
 void thread_init(int nthreads, struct event_base *main_base);
 int  dispatch_event_add(int thread, conn *c);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
+void redispatch_conn(conn *c);
+bool conn_migrate(conn *c);
+#ifdef USE_IO_URING
+void thread_uring_submit(LIBEVENT_THREAD *me);
+#endif
+void notify_listen_thread(LIBEVENT_THREAD *thread);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 enum delta_result_type add_delta(conn *c, const char *key,
@@ -594,6 +845,10 @@ void STATS_LOCK(void);
 void STATS_UNLOCK(void);
 void threadlocal_stats_reset(void);
 void threadlocal_stats_aggregate(struct thread_stats *stats);
+void threadlocal_stats_threads(ADD_STAT add_stats, void *c);
+void threadlocal_load_update(void);
+void threadlocal_conn_buffers(int *attached, int *pooled);
+void threadlocal_idle_scan(void);
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out);
 
 /* Stat processing functions */
@@ -620,6 +875,7 @@ extern void drop_privileges(void);
 typedef struct log_queue_item LQ_ITEM;
 struct log_queue_item {
  item        *item;
+ char         type;     /* 'l' log item, 's' snapshot start, 'd' done */
  LQ_ITEM	 *next;
 };
 
@@ -634,9 +890,9 @@ struct log_queue {
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
-    struct event notify_event;  /* listen event for notify pipe */
-    int notify_receive_fd;      /* receiving end of notify pipe */
-    int notify_send_fd;         /* sending end of notify pipe */
+    struct event notify_event;  /* listen event for notify fd */
+    int notify_receive_fd;      /* receiving end of notify pipe or eventfd */
+    int notify_send_fd;         /* sending end, the same fd for an eventfd */
     struct thread_stats stats;  /* Stats generated by this thread */
     struct log_queue *new_log_queue; /* queue of log item  to handle */
     cache_t *suffix_cache;      /* suffix cache */
@@ -649,7 +905,7 @@ typedef struct {
 
 
 LQ_ITEM *lqi_new(void);
-void lq_push(LQ *lq, LQ_ITEM *item);
+bool lq_push(LQ *lq, LQ_ITEM *item);
 void log_thread_init(struct event_base *main_base);
 void setup_log_thread(LIBEVENT_LOG_THREAD *me);
 void log_event_process(int fd, short which, void*arg);
@@ -8,10 +8,12 @@
  * memcached protocol.
  */
 #include "memcached.h"
+#include "slabs_lookup.h"
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/signal.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <errno.h>
@@ -27,8 +29,8 @@ typedef struct {
     unsigned int size;      /* sizes of items */
     unsigned int perslab;   /* how many items per slab */
 
-    void *slots;           /* list of item ptrs */
-    unsigned int sl_curr;   /* total free items in list */
+    void *slots[NUMA_NODES_MAX]; /* free items, by the node they are on */
+    unsigned int sl_curr;   /* total free items in the lists */
 
     unsigned int slabs;     /* how many slabs were allocated for this class */
 
@@ -44,21 +46,68 @@ static size_t mem_limit = 0;
 static size_t mem_malloced = 0;
 static int power_largest;
 
+/* size to class lookup, built by slabs_init */
+static slabs_lookup_t clsid_lookup;
+
 static void *mem_base = NULL;
 static void *mem_current = NULL;
 static size_t mem_avail = 0;
 
+/* With -o numa_local the arena is cut into one range per node. Pages are
+ * taken from the range of the node the allocating thread runs on, and free
+ * chunks are kept apart by node so they go back to threads on it. */
+static int numa_nodes = 1;
+static size_t numa_span;
+static struct {
+    char *current;
+    size_t avail;
+} numa_mem[NUMA_NODES_MAX];
+static int numa_node_of_cpu[NUMA_CPUS_MAX];
+/* Chunks handed to a thread from another node's free list */
+static uint64_t numa_remote_allocs = 0;
+
+#ifdef COMPACT_ITEMS
+/* Items link to each other by offset from here; it is mem_base */
+char *item_arena = NULL;
+#endif
+
+/* Pages handed back by a lowered cache_memlimit, linked through their first
+ * word. Reused before asking memory_allocate for more. */
+static void *spare_pages = NULL;
+static unsigned int spare_count = 0;
+/* Set while pages are being handed back to meet a lowered limit */
+static bool mem_reclaiming = false;
+
 /**
  * Access to the slab allocator is protected by this lock
  */
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SLABS_LOCK() \
+    lockprof_lock(&slabs_lock, LOCKPROF_SLABS_LOCK, NULL, false)
+#define SLABS_UNLOCK() \
+    lockprof_unlock(&slabs_lock, LOCKPROF_SLABS_LOCK, NULL)
+
+/* Number of one second samples the age balancer looks back over when
+ * deciding whether a class is evicting. */
+#define AUTOMOVE_AGE_WINDOW 30
+
+/* Inputs and outcome of the last age balancing pass. Guarded by slabs_lock
+ * and shown by "stats slabs". */
+static struct {
+    int age[MAX_NUMBER_OF_SLAB_CLASSES];
+    uint64_t evicted[MAX_NUMBER_OF_SLAB_CLASSES];
+    int oldest;
+    int youngest;
+    uint64_t moves;
+} automove_age;
+
 static pthread_mutex_t slabs_rebalance_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Forward Declarations
  */
-static int do_slabs_newslab(const unsigned int id);
-static void *memory_allocate(size_t size);
+static int do_slabs_newslab(const unsigned int id, const int node);
+static void *memory_allocate(size_t size, const int node);
 static void do_slabs_free(void *ptr, const size_t size, unsigned int id);
 
 /* Preallocate as many slab pages as possible (called from slabs_init)
@@ -78,29 +127,100 @@ static void slabs_preallocate (const unsigned int maxslabs);
  */
 
 unsigned int slabs_clsid(const size_t size) {
-    int res = POWER_SMALLEST;
+    return slabs_lookup(&clsid_lookup, size);
+}
+
+/*
+ * Fills in the chunk size of each class for a growth factor and minimum
+ * item space (-f and -n), returning the largest class id.
+ */
+static int slabs_layout(const double factor, const unsigned int chunk_size,
+                        unsigned int *sizes) {
+    int i = POWER_SMALLEST - 1;
+    unsigned int size = sizeof(item) + chunk_size;
+
+    /* The largest class is slab_chunk_max, which is the page size unless
+     * large items are stored in chunks of it */
+    while (++i < POWER_LARGEST && size <= settings.slab_chunk_max / factor) {
+        /* Make sure items are always n-byte aligned */
+        if (size % CHUNK_ALIGN_BYTES)
+            size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+
+        sizes[i] = size;
+        size *= factor;
+    }
+    sizes[i] = settings.slab_chunk_max;
+    return i;
+}
 
-    if (size == 0)
+/* The node whose memory the calling thread should get */
+static int slabs_thread_node(void) {
+#ifdef __linux__
+    int cpu;
+    if (numa_nodes == 1)
         return 0;
-    while (size > slabclass[res].size)
-        if (res++ == power_largest)     /* won't fit in the biggest slab */
-            return 0;
-    return res;
+    cpu = sched_getcpu();
+    return cpu >= 0 && cpu < NUMA_CPUS_MAX ? numa_node_of_cpu[cpu] : 0;
+#else
+    return 0;
+#endif
+}
+
+/* The node a chunk of the arena was placed on */
+static int slabs_chunk_node(const void *ptr) {
+    size_t node;
+    if (numa_nodes == 1)
+        return 0;
+    node = (size_t)((const char *)ptr - (const char *)mem_base) / numa_span;
+    return node < (size_t)numa_nodes ? (int)node : numa_nodes - 1;
+}
+
+/* Splits the arena into a range per node, each preferring its node */
+static void slabs_numa_init(void) {
+    /* for the test suite: faking more nodes than there are */
+    char *t_numa_nodes = getenv("T_MEMD_NUMA_NODES");
+    int i;
+
+    numa_nodes = mem_numa_topology(numa_node_of_cpu, NUMA_CPUS_MAX);
+    if (t_numa_nodes)
+        numa_nodes = atoi(t_numa_nodes);
+    if (numa_nodes > NUMA_NODES_MAX)
+        numa_nodes = NUMA_NODES_MAX;
+    /* Ranges are whole pages, and every node gets at least one */
+    numa_span = numa_nodes > 1 ? mem_limit / numa_nodes
+        / settings.item_size_max * settings.item_size_max : 0;
+    if (numa_span == 0) {
+        numa_nodes = 1;
+        return;
+    }
+
+    for (i = 0; i < numa_nodes; i++) {
+        numa_mem[i].current = (char *)mem_base + i * numa_span;
+        numa_mem[i].avail = i == numa_nodes - 1
+            ? mem_limit - i * numa_span : numa_span;
+        mem_prefer_node(numa_mem[i].current, numa_mem[i].avail, i);
+    }
 }
 
 /**
  * Determines the chunk sizes and initializes the slab class descriptors
  * accordingly.
  */
-void slabs_init(const size_t limit, const double factor, const bool prealloc) {
-    int i = POWER_SMALLEST - 1;
-    unsigned int size = sizeof(item) + settings.chunk_size;
+void slabs_init(const size_t limit, const double factor, const bool prealloc,
+                const uint32_t *slab_sizes) {
+    unsigned int sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+    int i;
 
     mem_limit = limit;
 
-    if (prealloc) {
-        /* Allocate everything in a big chunk with malloc */
-        mem_base = malloc(mem_limit);
+    if (prealloc || settings.prefault_threads) {
+        /* Allocate everything in a big chunk */
+        if (settings.large_pages)
+            mem_base = mem_map_large(mem_limit);
+        else if (settings.numa_interleave || settings.numa_local)
+            mem_base = mem_map(mem_limit);
+        else
+            mem_base = malloc(mem_limit);
         if (mem_base != NULL) {
             mem_current = mem_base;
             mem_avail = mem_limit;
@@ -110,28 +230,66 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
         }
     }
 
-    memset(slabclass, 0, sizeof(slabclass));
+    if (mem_base == NULL &&
+        (settings.numa_interleave || settings.numa_local)) {
+        /* Placing heap pages would also move their neighbours, so the
+         * cache gets a mapping of its own. It is only backed as used. */
+        if ((mem_base = mem_map(mem_limit)) == NULL) {
+            perror("Failed to map the item-cache");
+            exit(EXIT_FAILURE);
+        }
+        mem_current = mem_base;
+        mem_avail = mem_limit;
+    }
+    if (mem_base != NULL && settings.numa_interleave)
+        mem_interleave(mem_base, mem_limit);
+    if (mem_base != NULL && settings.numa_local)
+        slabs_numa_init();
 
-    while (++i < POWER_LARGEST && size <= settings.item_size_max / factor) {
-        /* Make sure items are always n-byte aligned */
-        if (size % CHUNK_ALIGN_BYTES)
-            size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+#ifdef COMPACT_ITEMS
+    if (mem_base == NULL) {
+        /* Pages still have to come from one arena for links to reach them,
+         * so reserve address space for the largest one and let the kernel
+         * back it as slab pages get used. */
+        mem_base = mmap(NULL, ITEM_ARENA_MAX, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem_base == MAP_FAILED) {
+            perror("Failed to reserve the item arena");
+            exit(EXIT_FAILURE);
+        }
+        mem_current = mem_base;
+        mem_avail = ITEM_ARENA_MAX;
+    }
+    item_arena = mem_base;
+#endif
+
+    memset(slabclass, 0, sizeof(slabclass));
 
-        slabclass[i].size = size;
+    if (slab_sizes != NULL) {
+        /* Checked at startup: increasing, aligned and below slab_chunk_max */
+        for (i = 0; slab_sizes[i] != 0; i++) {
+            sizes[POWER_SMALLEST + i] = slab_sizes[i];
+        }
+        power_largest = POWER_SMALLEST + i;
+        sizes[power_largest] = settings.slab_chunk_max;
+    } else {
+        power_largest = slabs_layout(factor, settings.chunk_size, sizes);
+    }
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        slabclass[i].size = sizes[i];
         slabclass[i].perslab = settings.item_size_max / slabclass[i].size;
-        size *= factor;
         if (settings.verbose > 1) {
             fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
                     i, slabclass[i].size, slabclass[i].perslab);
         }
     }
 
-    power_largest = i;
-    slabclass[power_largest].size = settings.item_size_max;
-    slabclass[power_largest].perslab = 1;
-    if (settings.verbose > 1) {
-        fprintf(stderr, "slab class %3d: chunk size %9u perslab %7u\n",
-                i, slabclass[i].size, slabclass[i].perslab);
+    {
+        unsigned int sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+        for (i = 0; i <= power_largest; i++) {
+            sizes[i] = slabclass[i].size;
+        }
+        slabs_lookup_init(&clsid_lookup, sizes, power_largest);
     }
 
     /* for the test suite:  faking of how much we've already malloc'd */
@@ -143,6 +301,12 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
 
     }
 
+    if (settings.prefault_threads && mem_base != NULL) {
+        mem_prefault(mem_current, mem_avail < mem_limit ? mem_avail : mem_limit,
+                     settings.prefault_threads,
+                     settings.verbose > 0 ? "slab memory" : NULL);
+    }
+
     if (prealloc) {
         slabs_preallocate(power_largest);
     }
@@ -162,7 +326,7 @@ static void slabs_preallocate (const unsigned int maxslabs) {
     for (i = POWER_SMALLEST; i <= POWER_LARGEST; i++) {
         if (++prealloc > maxslabs)
             return;
-        if (do_slabs_newslab(i) == 0) {
+        if (do_slabs_newslab(i, -1) == 0) {
             fprintf(stderr, "Error while preallocating slab memory!\n"
                 "If using -L or other prealloc options, max memory must be "
                 "at least %d megabytes.\n", power_largest);
@@ -193,7 +357,43 @@ static void split_slab_page_into_freelist(char *ptr, const unsigned int id) {
     }
 }
 
-static int do_slabs_newslab(const unsigned int id) {
+/* Gives a whole page back to the system, keeping only its first OS page
+ * (which links it into the spare list) resident. */
+static void spare_page_push(void *page) {
+#if defined(HAVE_MADVISE) && defined(MADV_DONTNEED)
+    uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)page + sizeof(void *) + pagesize - 1)
+        & ~(pagesize - 1);
+    uintptr_t end = ((uintptr_t)page + settings.item_size_max)
+        & ~(pagesize - 1);
+    if (end > start) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+#endif
+    *(void **)page = spare_pages;
+    spare_pages = page;
+    spare_count++;
+}
+
+/* Takes a spare page, from the given node unless that is -1 */
+static void *spare_page_pop(const int len, const int node) {
+    void **prev = &spare_pages;
+    void *page;
+    if (len != settings.item_size_max)
+        return NULL;
+    while ((page = *prev) != NULL) {
+        if (node < 0 || slabs_chunk_node(page) == node) {
+            *prev = *(void **)page;
+            spare_count--;
+            return page;
+        }
+        prev = (void **)page;
+    }
+    return NULL;
+}
+
+/* Adds a page to a class, from the given node's memory unless that is -1 */
+static int do_slabs_newslab(const unsigned int id, const int node) {
     slabclass_t *p = &slabclass[id];
     int len = settings.slab_reassign ? settings.item_size_max
         : p->size * p->perslab;
@@ -201,7 +401,8 @@ static int do_slabs_newslab(const unsigned int id) {
 
     if ((mem_limit && mem_malloced + len > mem_limit && p->slabs > 0) ||
         (grow_slab_list(id) == 0) ||
-        ((ptr = memory_allocate((size_t)len)) == 0)) {
+        ((ptr = spare_page_pop(len, node)) == NULL &&
+         (ptr = memory_allocate((size_t)len, node)) == 0)) {
 
         MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
         return 0;
@@ -217,11 +418,29 @@ static int do_slabs_newslab(const unsigned int id) {
     return 1;
 }
 
+/* Takes a free chunk off the given node's list, or off another node's
+ * when that one is empty. The class must have a free chunk. */
+static item *do_slabs_take(slabclass_t *p, int node) {
+    item *it;
+
+    if (p->slots[node] == NULL) {
+        for (node = 0; p->slots[node] == NULL; node++)
+            ;
+        numa_remote_allocs++;
+    }
+    it = (item *)p->slots[node];
+    assert(it->slabs_clsid == 0);
+    p->slots[node] = ITEM_next(it);
+    if (ITEM_next(it)) ITEM_set_prev(ITEM_next(it), 0);
+    p->sl_curr--;
+    return it;
+}
+
 /*@null@*/
 static void *do_slabs_alloc(const size_t size, unsigned int id) {
     slabclass_t *p;
     void *ret = NULL;
-    item *it = NULL;
+    int node;
 
     if (id < POWER_SMALLEST || id > power_largest) {
         MEMCACHED_SLABS_ALLOCATE_FAILED(size, 0);
@@ -229,20 +448,17 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
     }
 
     p = &slabclass[id];
-    assert(p->sl_curr == 0 || ((item *)p->slots)->slabs_clsid == 0);
+    node = slabs_thread_node();
 
-    /* fail unless we have space at the end of a recently allocated page,
-       we have something on our freelist, or we could allocate a new page */
-    if (! (p->sl_curr != 0 || do_slabs_newslab(id) != 0)) {
+    /* A page of local memory beats a free chunk on another node; any
+     * chunk or page beats failing. */
+    if (numa_nodes > 1 && p->slots[node] == NULL)
+        do_slabs_newslab(id, node);
+    if (! (p->sl_curr != 0 || do_slabs_newslab(id, -1) != 0)) {
         /* We don't have more memory available */
         ret = NULL;
-    } else if (p->sl_curr != 0) {
-        /* return off our freelist */
-        it = (item *)p->slots;
-        p->slots = it->next;
-        if (it->next) it->next->prev = 0;
-        p->sl_curr--;
-        ret = (void *)it;
+    } else {
+        ret = (void *)do_slabs_take(p, node);
     }
 
     if (ret) {
@@ -258,6 +474,7 @@ static void *do_slabs_alloc(const size_t size, unsigned int id) {
 static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     slabclass_t *p;
     item *it;
+    int node;
 
     assert(((item *)ptr)->slabs_clsid == 0);
     assert(id >= POWER_SMALLEST && id <= power_largest);
@@ -268,11 +485,12 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     p = &slabclass[id];
 
     it = (item *)ptr;
+    node = slabs_chunk_node(ptr);
     it->it_flags |= ITEM_SLABBED;
-    it->prev = 0;
-    it->next = p->slots;
-    if (it->next) it->next->prev = it;
-    p->slots = it;
+    ITEM_set_prev(it, 0);
+    ITEM_set_next(it, p->slots[node]);
+    if (p->slots[node]) ITEM_set_prev((item *)p->slots[node], it);
+    p->slots[node] = it;
 
     p->sl_curr++;
     p->requested -= size;
@@ -290,11 +508,6 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
     if (add_stats != NULL) {
         if (!stat_type) {
             /* prepare general statistics for the engine */
-            STATS_LOCK();
-            APPEND_STAT("bytes", "%llu", (unsigned long long)stats.curr_bytes);
-            APPEND_STAT("curr_items", "%u", stats.curr_items);
-            APPEND_STAT("total_items", "%u", stats.total_items);
-            STATS_UNLOCK();
             item_stats_totals(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "items") == 0) {
             item_stats(add_stats, c);
@@ -302,6 +515,8 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
             slabs_stats(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "sizes") == 0) {
             item_stats_sizes(add_stats, c);
+        } else if (nz_strcmp(nkey, stat_type, "fragmentation") == 0) {
+            slabs_fragmentation_stats(add_stats, c);
         } else {
             ret = false;
         }
@@ -358,6 +573,11 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
                     (unsigned long long)thread_stats.slab_stats[i].cas_badval);
             APPEND_NUM_STAT(i, "touch_hits", "%llu",
                     (unsigned long long)thread_stats.slab_stats[i].touch_hits);
+            if (settings.slab_automove == 3) {
+                APPEND_NUM_STAT(i, "tail_age", "%d", automove_age.age[i]);
+                APPEND_NUM_STAT(i, "evicted_window", "%llu",
+                                (unsigned long long)automove_age.evicted[i]);
+            }
             total++;
         }
     }
@@ -366,13 +586,43 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
 
     APPEND_STAT("active_slabs", "%d", total);
     APPEND_STAT("total_malloced", "%llu", (unsigned long long)mem_malloced);
+    APPEND_STAT("spare_pages", "%u", spare_count);
+    if (settings.numa_local) {
+        APPEND_STAT("numa_nodes", "%d", numa_nodes);
+        APPEND_STAT("numa_remote_allocs", "%llu",
+                    (unsigned long long)numa_remote_allocs);
+    }
+    if (settings.slab_automove == 3) {
+        APPEND_STAT("automove_oldest", "%d", automove_age.oldest);
+        APPEND_STAT("automove_youngest", "%d", automove_age.youngest);
+        APPEND_STAT("automove_moves", "%llu",
+                    (unsigned long long)automove_age.moves);
+    }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
-static void *memory_allocate(size_t size) {
+/* Takes memory from the given node's range of the arena, or from any node's
+ * when that is -1 */
+static void *memory_allocate(size_t size, const int node) {
     void *ret;
 
-    if (mem_base == NULL) {
+    if (numa_nodes > 1) {
+        int i;
+        if (size % CHUNK_ALIGN_BYTES) {
+            size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+        }
+        for (i = node < 0 ? 0 : node; i < numa_nodes; i++) {
+            if (size <= numa_mem[i].avail) {
+                ret = numa_mem[i].current;
+                numa_mem[i].current += size;
+                numa_mem[i].avail -= size;
+                return ret;
+            }
+            if (node >= 0)
+                break;
+        }
+        return NULL;
+    } else if (mem_base == NULL) {
         /* We are not using a preallocated large memory chunk */
         ret = malloc(size);
     } else {
@@ -398,30 +648,350 @@ static void *memory_allocate(size_t size) {
     return ret;
 }
 
+#ifdef COMPACT_ITEMS
+void *slabs_arena_reserve(size_t size) {
+    void *ret;
+
+    SLABS_LOCK();
+    ret = memory_allocate(size, -1);
+    SLABS_UNLOCK();
+    if (ret != NULL)
+        memset(ret, 0, size);
+    return ret;
+}
+#endif
+
 void *slabs_alloc(size_t size, unsigned int id) {
     void *ret;
 
-    pthread_mutex_lock(&slabs_lock);
+    SLABS_LOCK();
     ret = do_slabs_alloc(size, id);
-    pthread_mutex_unlock(&slabs_lock);
+    SLABS_UNLOCK();
     return ret;
 }
 
 void slabs_free(void *ptr, size_t size, unsigned int id) {
-    pthread_mutex_lock(&slabs_lock);
+    SLABS_LOCK();
     do_slabs_free(ptr, size, id);
-    pthread_mutex_unlock(&slabs_lock);
+    SLABS_UNLOCK();
+}
+
+/* Pages needed to hold the items of a size histogram with a class layout.
+ * Only whole pages count, so the rounding of items up to their chunk size,
+ * page tails and each class's partly used page are all paid for. */
+static uint64_t slabs_layout_cost(const unsigned int *sizes, const int largest,
+                                  const unsigned int *hsizes,
+                                  const unsigned int *hcounts,
+                                  const unsigned int nsizes) {
+    uint64_t pages = 0, items = 0;
+    int id = POWER_SMALLEST;
+    unsigned int i;
+
+    for (i = 0; i < nsizes; i++) {
+        while (id < largest && sizes[id] < hsizes[i]) {
+            unsigned int perslab = settings.item_size_max / sizes[id];
+            pages += (items + perslab - 1) / perslab;
+            items = 0;
+            id++;
+        }
+        items += hcounts[i];
+    }
+    if (items != 0) {
+        unsigned int perslab = settings.item_size_max / sizes[id];
+        pages += (items + perslab - 1) / perslab;
+    }
+    return pages;
+}
+
+/* Most entries the layout search runs over; a denser histogram is merged.
+ * It runs on the worker that got the command, so it has to stay cheap. */
+#define SUGGEST_MAX_SIZES 256
+
+/*
+ * Picks chunk sizes for -o slab_sizes tailored to a size histogram. The
+ * classes that hold the items in the fewest pages are found exactly, then
+ * gaps between them are filled at the growth factor so that sizes not seen
+ * yet still fit reasonably. Each class found costs an extra penalty pages,
+ * raised until the layout fits. Returns the number of sizes, or 0.
+ */
+static int slabs_suggest_sizes(const unsigned int *hsizes,
+                               const unsigned int *hcounts,
+                               const unsigned int nsizes,
+                               unsigned int *out) {
+    unsigned int size[SUGGEST_MAX_SIZES];
+    uint64_t items[SUGGEST_MAX_SIZES + 1];
+    uint64_t best[SUGGEST_MAX_SIZES + 1];
+    int from[SUGGEST_MAX_SIZES + 1];
+    unsigned int chosen[SUGGEST_MAX_SIZES];
+    unsigned int step = (nsizes + SUGGEST_MAX_SIZES - 1) / SUGGEST_MAX_SIZES;
+    unsigned int base = sizeof(item) + settings.chunk_size;
+    uint64_t penalty = 0;
+    int n = 0, nchosen, nout, i, j;
+    unsigned int k;
+
+    /* Each merged entry takes the largest size of its group, and only sizes
+     * below slab_chunk_max need a class of their own */
+    items[0] = 0;
+    for (k = 0; k < nsizes; k += step) {
+        unsigned int last = k + step < nsizes ? k + step : nsizes;
+        uint64_t count = 0;
+        unsigned int x;
+        for (x = k; x < last; x++)
+            count += hcounts[x];
+        if (hsizes[last - 1] >= (unsigned int)settings.slab_chunk_max)
+            break;
+        size[n] = hsizes[last - 1];
+        if (size[n] % CHUNK_ALIGN_BYTES)
+            size[n] += CHUNK_ALIGN_BYTES - (size[n] % CHUNK_ALIGN_BYTES);
+        if (size[n] <= sizeof(item))
+            size[n] = sizeof(item) + CHUNK_ALIGN_BYTES;
+        if (n > 0 && size[n] <= size[n - 1]) {
+            items[n] += count;
+            continue;
+        }
+        items[n + 1] = items[n] + count;
+        n++;
+    }
+    if (n == 0)
+        return 0;
+    if (base % CHUNK_ALIGN_BYTES)
+        base += CHUNK_ALIGN_BYTES - (base % CHUNK_ALIGN_BYTES);
+
+    for (;;) {
+        /* best[j]: pages for the j smallest sizes, class j - 1 the largest */
+        best[0] = 0;
+        for (j = 1; j <= n; j++) {
+            unsigned int perslab = settings.item_size_max / size[j - 1];
+            best[j] = UINT64_MAX;
+            for (i = 0; i < j; i++) {
+                uint64_t cost = best[i] + penalty +
+                    (items[j] - items[i] + perslab - 1) / perslab;
+                if (cost < best[j]) {
+                    best[j] = cost;
+                    from[j] = i;
+                }
+            }
+        }
+        nchosen = 0;
+        for (j = n; j > 0; j = from[j])
+            chosen[nchosen++] = size[j - 1];
+
+        /* Fill in below, between and above the chosen classes */
+        nout = 0;
+        {
+            unsigned int prev = 0;
+            for (i = nchosen; i >= 0; i--) {
+                unsigned int next = i > 0 ? chosen[i - 1]
+                    : (unsigned int)(settings.slab_chunk_max / settings.factor);
+                unsigned int x = prev == 0 ? base : prev * settings.factor;
+                while (x < next && nout < POWER_LARGEST) {
+                    if (x % CHUNK_ALIGN_BYTES)
+                        x += CHUNK_ALIGN_BYTES - (x % CHUNK_ALIGN_BYTES);
+                    if (x <= prev)
+                        x = prev + CHUNK_ALIGN_BYTES;
+                    if (x >= next)
+                        break;
+                    out[nout++] = prev = x;
+                    x = prev * settings.factor;
+                }
+                if (i > 0 && nout < POWER_LARGEST)
+                    out[nout++] = prev = next;
+            }
+        }
+        if (nout <= POWER_LARGEST - 2)
+            return nout;
+        if (nchosen == 1)
+            return 0;
+        penalty = penalty ? penalty * 2 : 1;
+    }
+}
+
+void slabs_fragmentation_stats(ADD_STAT add_stats, void *c) {
+    unsigned int counts[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int sizes[MAX_NUMBER_OF_SLAB_CLASSES];
+    unsigned int nbuckets, bucket, nsizes = 0;
+    uint64_t chunked;
+    unsigned int *histogram, *hcounts = NULL;
+    unsigned int header = sizeof(item) + (settings.use_cas ? sizeof(uint64_t) : 0);
+    uint64_t requested = 0, headers = 0, rounding = 0, free_bytes = 0;
+    uint64_t page_tails = 0, current_pages = 0, best_pages = 0;
+    uint64_t custom_pages = 0;
+    double best_factor = settings.factor;
+    unsigned int best_chunk_size = settings.chunk_size;
+    unsigned int suggested[POWER_LARGEST];
+    int nsuggested = 0;
+    int i, largest;
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+
+    memset(counts, 0, sizeof(counts));
+    histogram = item_stats_histogram(&nbuckets, &bucket, &chunked, counts);
+
+    /* Where memory goes in each class, as it is laid out now */
+    SLABS_LOCK();
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        slabclass_t *p = &slabclass[i];
+        uint64_t used = (uint64_t)p->slabs * p->perslab - p->sl_curr;
+        uint64_t tails = (uint64_t)p->slabs *
+            (settings.item_size_max - p->perslab * p->size);
+        uint64_t hbytes = (uint64_t)counts[i] * header;
+        sizes[i] = p->size;
+        if (p->slabs == 0)
+            continue;
+        /* requested counts whole items; the counts were taken unlocked */
+        if (hbytes > p->requested)
+            hbytes = p->requested;
+        APPEND_NUM_STAT(i, "chunk_size", "%u", p->size);
+        APPEND_NUM_STAT(i, "items", "%u", counts[i]);
+        APPEND_NUM_STAT(i, "item_bytes", "%llu",
+                        (unsigned long long)(p->requested - hbytes));
+        APPEND_NUM_STAT(i, "header_bytes", "%llu", (unsigned long long)hbytes);
+        APPEND_NUM_STAT(i, "rounding_waste", "%llu",
+                        (unsigned long long)(used * p->size - p->requested));
+        APPEND_NUM_STAT(i, "free_bytes", "%llu",
+                        (unsigned long long)p->sl_curr * p->size);
+        APPEND_NUM_STAT(i, "page_waste", "%llu", (unsigned long long)tails);
+        requested += p->requested - hbytes;
+        headers += hbytes;
+        rounding += used * p->size - p->requested;
+        free_bytes += (uint64_t)p->sl_curr * p->size;
+        page_tails += tails;
+    }
+    APPEND_STAT("total_malloced", "%llu", (unsigned long long)mem_malloced);
+    SLABS_UNLOCK();
+
+    APPEND_STAT("item_bytes", "%llu", (unsigned long long)requested);
+    APPEND_STAT("header_bytes", "%llu", (unsigned long long)headers);
+    APPEND_STAT("rounding_waste", "%llu", (unsigned long long)rounding);
+    APPEND_STAT("free_bytes", "%llu", (unsigned long long)free_bytes);
+    APPEND_STAT("page_waste", "%llu", (unsigned long long)page_tails);
+    APPEND_STAT("chunked_items", "%llu", (unsigned long long)chunked);
+
+    /* Compact the histogram to the sizes in use, and price the current
+     * layout against it. The search for a better -f/-n runs on a copy
+     * merged to at most SUGGEST_MAX_SIZES sizes, each group of buckets
+     * taking its largest, so that it stays cheap on the worker that got
+     * the command: every fifth factor first, then the ones around the best
+     * of those. What it finds is priced exactly again. */
+    if (histogram != NULL)
+        hcounts = malloc((nbuckets + SUGGEST_MAX_SIZES) * 2 *
+                         sizeof(unsigned int));
+    if (hcounts != NULL) {
+        unsigned int *hsizes = hcounts + nbuckets;
+        unsigned int *mcounts = hsizes + nbuckets;
+        unsigned int *msizes = mcounts + SUGGEST_MAX_SIZES;
+        unsigned int b, n, f, step, nmerged = 0;
+        unsigned int lo_n = 8, hi_n = 128, lo_f = 105, hi_f = 200;
+        uint64_t merged_best;
+        int fstep;
+        for (b = 0; b < nbuckets; b++) {
+            if (histogram[b] != 0) {
+                hsizes[nsizes] = b * bucket;
+                hcounts[nsizes++] = histogram[b];
+            }
+        }
+        step = nsizes > SUGGEST_MAX_SIZES ?
+            (nsizes + SUGGEST_MAX_SIZES - 1) / SUGGEST_MAX_SIZES : 1;
+        for (b = 0; b < nsizes; b++) {
+            if (b % step == 0)
+                mcounts[nmerged++] = 0;
+            msizes[nmerged - 1] = hsizes[b];
+            mcounts[nmerged - 1] += hcounts[b];
+        }
+
+        current_pages = best_pages =
+            slabs_layout_cost(sizes, power_largest, hsizes, hcounts, nsizes);
+        merged_best = slabs_layout_cost(sizes, power_largest, msizes, mcounts,
+                                        nmerged);
+        for (fstep = 5; fstep > 0; fstep -= 4) {
+            for (n = lo_n; n <= hi_n; n += 8) {
+                for (f = lo_f; f <= hi_f; f += fstep) {
+                    uint64_t pages;
+                    largest = slabs_layout(f / 100.0, n, sizes);
+                    pages = slabs_layout_cost(sizes, largest, msizes, mcounts,
+                                              nmerged);
+                    if (pages < merged_best) {
+                        merged_best = pages;
+                        best_factor = f / 100.0;
+                        best_chunk_size = n;
+                    }
+                }
+            }
+            /* then every factor within a step of the best, and its -n */
+            f = (unsigned int)(best_factor * 100 + 0.5);
+            lo_n = hi_n = best_chunk_size;
+            lo_f = f - 4 < 105 ? 105 : f - 4;
+            hi_f = f + 4 > 200 ? 200 : f + 4;
+        }
+        largest = slabs_layout(best_factor, best_chunk_size, sizes);
+        best_pages = slabs_layout_cost(sizes, largest, hsizes, hcounts, nsizes);
+        if (best_pages > current_pages) {
+            /* merging misled it; nothing found beats what's running */
+            best_pages = current_pages;
+            best_factor = settings.factor;
+            best_chunk_size = settings.chunk_size;
+        }
+        nsuggested = slabs_suggest_sizes(msizes, mcounts, nmerged, suggested);
+        if (nsuggested > 0) {
+            for (i = 0; i < nsuggested; i++)
+                sizes[POWER_SMALLEST + i] = suggested[i];
+            sizes[POWER_SMALLEST + nsuggested] = settings.slab_chunk_max;
+            custom_pages = slabs_layout_cost(sizes, POWER_SMALLEST + nsuggested,
+                                             hsizes, hcounts, nsizes);
+        }
+        free(hcounts);
+    }
+    free(histogram);
+
+    APPEND_STAT("layout_bytes", "%llu",
+                (unsigned long long)current_pages * settings.item_size_max);
+    APPEND_STAT("suggested_growth_factor", "%.2f", best_factor);
+    APPEND_STAT("suggested_chunk_size", "%u", best_chunk_size);
+    APPEND_STAT("suggested_layout_bytes", "%llu",
+                (unsigned long long)best_pages * settings.item_size_max);
+    if (nsuggested > 0) {
+        /* Too long for APPEND_STAT's buffer */
+        char *list = malloc(nsuggested * 11);
+        if (list != NULL) {
+            int len = 0;
+            for (i = 0; i < nsuggested; i++) {
+                len += sprintf(list + len, "%s%u", i ? ":" : "", suggested[i]);
+            }
+            add_stats("suggested_slab_sizes", strlen("suggested_slab_sizes"),
+                      list, len, c);
+            free(list);
+        }
+        APPEND_STAT("suggested_slab_sizes_bytes", "%llu",
+                    (unsigned long long)custom_pages * settings.item_size_max);
+    }
+    add_stats(NULL, 0, NULL, 0, c);
 }
 
 void slabs_stats(ADD_STAT add_stats, void *c) {
-    pthread_mutex_lock(&slabs_lock);
+    SLABS_LOCK();
     do_slabs_stats(add_stats, c);
-    pthread_mutex_unlock(&slabs_lock);
+    SLABS_UNLOCK();
+}
+
+bool slabs_adjust_mem_limit(size_t new_mem_limit) {
+    bool ret = true;
+    SLABS_LOCK();
+    /* A preallocated cache can't grow past what it was given at startup */
+    if (mem_base != NULL && new_mem_limit >
+        (size_t)((char *)mem_current - (char *)mem_base) + mem_avail) {
+        ret = false;
+    } else {
+        mem_limit = new_mem_limit;
+        mem_reclaiming = mem_limit && mem_malloced > mem_limit;
+    }
+    SLABS_UNLOCK();
+    return ret;
 }
 
 void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal)
 {
-    pthread_mutex_lock(&slabs_lock);
+    SLABS_LOCK();
     slabclass_t *p;
     if (id < POWER_SMALLEST || id > power_largest) {
         fprintf(stderr, "Internal error! Invalid slab class\n");
@@ -430,7 +1000,7 @@ void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal)
 
     p = &slabclass[id];
     p->requested = p->requested - old + ntotal;
-    pthread_mutex_unlock(&slabs_lock);
+    SLABS_UNLOCK();
 }
 
 static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
@@ -445,19 +1015,21 @@ static int slab_rebalance_start(void) {
     slabclass_t *s_cls;
     int no_go = 0;
 
-    pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
+    CACHE_LOCK_BLOCKING();
+    SLABS_LOCK();
 
+    /* A d_clsid of 0 releases the page instead of moving it */
     if (slab_rebal.s_clsid < POWER_SMALLEST ||
         slab_rebal.s_clsid > power_largest  ||
-        slab_rebal.d_clsid < POWER_SMALLEST ||
-        slab_rebal.d_clsid > power_largest  ||
+        (slab_rebal.d_clsid != 0 &&
+         (slab_rebal.d_clsid < POWER_SMALLEST ||
+          slab_rebal.d_clsid > power_largest)) ||
         slab_rebal.s_clsid == slab_rebal.d_clsid)
         no_go = -2;
 
     s_cls = &slabclass[slab_rebal.s_clsid];
 
-    if (!grow_slab_list(slab_rebal.d_clsid)) {
+    if (slab_rebal.d_clsid != 0 && !grow_slab_list(slab_rebal.d_clsid)) {
         no_go = -1;
     }
 
@@ -465,8 +1037,8 @@ static int slab_rebalance_start(void) {
         no_go = -3;
 
     if (no_go != 0) {
-        pthread_mutex_unlock(&slabs_lock);
-        pthread_mutex_unlock(&cache_lock);
+        SLABS_UNLOCK();
+        CACHE_UNLOCK();
         return no_go; /* Should use a wrapper function... */
     }
 
@@ -485,8 +1057,8 @@ static int slab_rebalance_start(void) {
         fprintf(stderr, "Started a slab rebalance\n");
     }
 
-    pthread_mutex_unlock(&slabs_lock);
-    pthread_mutex_unlock(&cache_lock);
+    SLABS_UNLOCK();
+    CACHE_UNLOCK();
 
     STATS_LOCK();
     stats.slab_reassign_running = true;
@@ -499,6 +1071,103 @@ enum move_status {
     MOVE_PASS=0, MOVE_DONE, MOVE_BUSY, MOVE_LOCKED
 };
 
+/* Takes a free chunk of the class being drained, outside of the page being
+ * moved, for a live item to be rescued into. Free chunks found inside the
+ * page are cleared on the way, as the mover would when reaching them. Never
+ * allocates a new page. */
+static item *slab_rebalance_alloc(const size_t size) {
+    slabclass_t *s_cls = &slabclass[slab_rebal.s_clsid];
+    item *new_it;
+
+    while (s_cls->sl_curr != 0) {
+        new_it = do_slabs_take(s_cls, slabs_thread_node());
+        if ((void *)new_it < slab_rebal.slab_start ||
+            (void *)new_it >= slab_rebal.slab_end) {
+            s_cls->requested += size;
+            return new_it;
+        }
+        new_it->refcount = 0;
+        new_it->it_flags = 0;
+        new_it->slabs_clsid = 255;
+    }
+    return NULL;
+}
+
+/* Whether an item would be reclaimed on its next fetch anyway. */
+static bool slab_rebalance_dead(item *it) {
+    return (it->exptime != 0 && it->exptime <= current_time) ||
+        (settings.oldest_live != 0 &&
+         settings.oldest_live <= current_time &&
+         it->time <= settings.oldest_live);
+}
+
+/* Gives back the chunks of an item unlinked by the mover, except for keep,
+ * which leaves with the page. */
+static void slab_rebalance_free_chunks(item *it, item_chunk *keep) {
+    item_chunk *chunk, *next;
+
+    for (chunk = CHUNK_next(ITEM_chunk(it)); chunk != NULL; chunk = next) {
+        unsigned int clsid = chunk->slabs_clsid;
+        next = CHUNK_next(chunk);
+        if (chunk == keep)
+            continue;
+        chunk->it_flags = 0;
+        chunk->slabs_clsid = 0;
+        do_slabs_free(chunk, sizeof(item_chunk) + chunk->size, clsid);
+    }
+    CHUNK_set_next(ITEM_chunk(it), NULL);
+    it->it_flags &= ~ITEM_CHUNKED;
+}
+
+/* A chunk found in the page being moved is copied to a free chunk outside
+ * of it, or its whole item is evicted. Busy items are retried later. */
+static enum move_status slab_rebalance_move_chunk(item_chunk *chunk,
+        uint64_t *rescues, uint64_t *evictions) {
+    slabclass_t *s_cls = &slabclass[slab_rebal.s_clsid];
+    item *head = CHUNK_head(chunk);
+    size_t ntotal = sizeof(item_chunk) + chunk->size;
+    uint32_t hv = hash(ITEM_key(head), head->nkey);
+    void *hold_lock;
+    enum move_status status = MOVE_BUSY;
+
+    if ((hold_lock = item_trylock(hv)) == NULL)
+        return MOVE_LOCKED;
+    if (refcount_incr(&head->refcount) == 2 &&
+        (head->it_flags & ITEM_LINKED) != 0) {
+        item_chunk *new_chunk = NULL;
+        if (!slab_rebalance_dead(head)) {
+            new_chunk = (item_chunk *)slab_rebalance_alloc(ntotal);
+        }
+        if (new_chunk != NULL) {
+            memcpy(new_chunk, chunk, ntotal);
+            CHUNK_set_next(CHUNK_prev(new_chunk), new_chunk);
+            if (CHUNK_next(new_chunk))
+                CHUNK_set_prev(CHUNK_next(new_chunk), new_chunk);
+            (*rescues)++;
+            refcount_decr(&head->refcount);
+        } else {
+            unsigned int clsid = head->slabs_clsid;
+            if (!slab_rebalance_dead(head))
+                (*evictions)++;
+            do_item_unlink_nolock(head, hv);
+            /* Nobody else can reach it now; free it in place of
+             * do_item_remove(), which would need the slabs lock */
+            slab_rebalance_free_chunks(head, chunk);
+            head->refcount = 0;
+            head->it_flags = 0;
+            head->slabs_clsid = 0;
+            do_slabs_free(head, settings.slab_chunk_max, clsid);
+        }
+        s_cls->requested -= ntotal;
+        status = MOVE_DONE;
+    } else {
+        refcount_decr(&head->refcount);
+    }
+    item_trylock_unlock(hold_lock);
+    /* The chunk's own refcount is never taken */
+    return status == MOVE_BUSY ? MOVE_LOCKED : status;
+}
+
 /* refcount == 0 is safe since nobody can incr while cache_lock is held.
  * refcount != 0 is impossible since flags/etc can be modified in other
  * threads. instead, note we found a busy one and bail. logic in do_item_get
@@ -509,17 +1178,21 @@ static int slab_rebalance_move(void) {
     int x;
     int was_busy = 0;
     int refcount = 0;
+    uint64_t rescues = 0, evictions = 0;
     enum move_status status = MOVE_PASS;
 
-    pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
+    CACHE_LOCK_BLOCKING();
+    SLABS_LOCK();
 
     s_cls = &slabclass[slab_rebal.s_clsid];
 
     for (x = 0; x < slab_bulk_check; x++) {
         item *it = slab_rebal.slab_pos;
         status = MOVE_PASS;
-        if (it->slabs_clsid != 255) {
+        if (it->slabs_clsid != 255 && (it->it_flags & ITEM_CHUNK)) {
+            status = slab_rebalance_move_chunk((item_chunk *)it,
+                                               &rescues, &evictions);
+        } else if (it->slabs_clsid != 255) {
             void *hold_lock = NULL;
             uint32_t hv = hash(ITEM_key(it), it->nkey);
             if ((hold_lock = item_trylock(hv)) == NULL) {
@@ -529,11 +1202,14 @@ static int slab_rebalance_move(void) {
                 if (refcount == 1) { /* item is unlinked, unused */
                     if (it->it_flags & ITEM_SLABBED) {
                         /* remove from slab freelist */
-                        if (s_cls->slots == it) {
-                            s_cls->slots = it->next;
+                        int node = slabs_chunk_node(it);
+                        if (s_cls->slots[node] == it) {
+                            s_cls->slots[node] = ITEM_next(it);
                         }
-                        if (it->next) it->next->prev = it->prev;
-                        if (it->prev) it->prev->next = it->next;
+                        if (ITEM_next(it))
+                            ITEM_set_prev(ITEM_next(it), ITEM_prev(it));
+                        if (ITEM_prev(it))
+                            ITEM_set_next(ITEM_prev(it), ITEM_next(it));
                         s_cls->sl_curr--;
                         status = MOVE_DONE;
                     } else {
@@ -541,7 +1217,26 @@ static int slab_rebalance_move(void) {
                     }
                 } else if (refcount == 2) { /* item is linked but not busy */
                     if ((it->it_flags & ITEM_LINKED) != 0) {
-                        do_item_unlink_nolock(it, hv);
+                        /* Live items are copied to a free chunk elsewhere
+                         * in their class, and only evicted if there is
+                         * none. Either way the old chunk leaves with the
+                         * page, so it no longer counts as requested. */
+                        size_t ntotal = ITEM_ntotal(it);
+                        item *new_it = NULL;
+                        if (!slab_rebalance_dead(it)) {
+                            new_it = slab_rebalance_alloc(ntotal);
+                        }
+                        if (new_it != NULL) {
+                            do_item_relocate_nolock(it, new_it, hv);
+                            rescues++;
+                        } else {
+                            if (!slab_rebalance_dead(it))
+                                evictions++;
+                            do_item_unlink_nolock(it, hv);
+                            if (it->it_flags & ITEM_CHUNKED)
+                                slab_rebalance_free_chunks(it, NULL);
+                        }
+                        s_cls->requested -= ntotal;
                         status = MOVE_DONE;
                     } else {
                         /* refcount == 1 + !ITEM_LINKED means the item is being
@@ -591,8 +1286,15 @@ static int slab_rebalance_move(void) {
         }
     }
 
-    pthread_mutex_unlock(&slabs_lock);
-    pthread_mutex_unlock(&cache_lock);
+    SLABS_UNLOCK();
+    CACHE_UNLOCK();
+
+    if (rescues || evictions) {
+        STATS_LOCK();
+        stats.slab_reassign_rescues += rescues;
+        stats.slab_reassign_evictions += evictions;
+        STATS_UNLOCK();
+    }
 
     return was_busy;
 }
@@ -600,9 +1302,10 @@ static int slab_rebalance_move(void) {
 static void slab_rebalance_finish(void) {
     slabclass_t *s_cls;
     slabclass_t *d_cls;
+    bool released = slab_rebal.d_clsid == 0;
 
-    pthread_mutex_lock(&cache_lock);
-    pthread_mutex_lock(&slabs_lock);
+    CACHE_LOCK_BLOCKING();
+    SLABS_LOCK();
 
     s_cls = &slabclass[slab_rebal.s_clsid];
     d_cls   = &slabclass[slab_rebal.d_clsid];
@@ -613,11 +1316,17 @@ static void slab_rebalance_finish(void) {
     s_cls->slabs--;
     s_cls->killing = 0;
 
-    memset(slab_rebal.slab_start, 0, (size_t)settings.item_size_max);
+    if (released) {
+        spare_page_push(slab_rebal.slab_start);
+        if (mem_malloced >= (size_t)settings.item_size_max)
+            mem_malloced -= settings.item_size_max;
+    } else {
+        memset(slab_rebal.slab_start, 0, (size_t)settings.item_size_max);
 
-    d_cls->slab_list[d_cls->slabs++] = slab_rebal.slab_start;
-    split_slab_page_into_freelist(slab_rebal.slab_start,
-        slab_rebal.d_clsid);
+        d_cls->slab_list[d_cls->slabs++] = slab_rebal.slab_start;
+        split_slab_page_into_freelist(slab_rebal.slab_start,
+            slab_rebal.d_clsid);
+    }
 
     slab_rebal.done       = 0;
     slab_rebal.s_clsid    = 0;
@@ -628,16 +1337,18 @@ static void slab_rebalance_finish(void) {
 
     slab_rebalance_signal = 0;
 
-    pthread_mutex_unlock(&slabs_lock);
-    pthread_mutex_unlock(&cache_lock);
+    SLABS_UNLOCK();
+    CACHE_UNLOCK();
 
     STATS_LOCK();
     stats.slab_reassign_running = false;
-    stats.slabs_moved++;
+    if (!released)
+        stats.slabs_moved++;
     STATS_UNLOCK();
 
     if (settings.verbose > 1) {
-        fprintf(stderr, "finished a slab move\n");
+        fprintf(stderr, released ? "released a slab page\n"
+                                 : "finished a slab move\n");
     }
 }
 
@@ -668,11 +1379,11 @@ static int slab_automove_decision(int *src, int *dst) {
     }
 
     item_stats_evictions(evicted_new);
-    pthread_mutex_lock(&cache_lock);
+    CACHE_LOCK_BLOCKING();
     for (i = POWER_SMALLEST; i < power_largest; i++) {
         total_pages[i] = slabclass[i].slabs;
     }
-    pthread_mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 
     /* Find a candidate source; something with zero evicts 3+ times */
     for (i = POWER_SMALLEST; i < power_largest; i++) {
@@ -709,6 +1420,110 @@ static int slab_automove_decision(int *src, int *dst) {
     return 0;
 }
 
+/* Age balancing automover (slab_automove 3).
+ * Moves a page from the class whose LRU tail is the oldest to the evicting
+ * class whose tail is the youngest, once the youngest age falls below
+ * slab_automove_ratio of the oldest. Classes with pages but nothing in their
+ * LRU count as the oldest. At most one page is moved every
+ * slab_automove_interval seconds. Return 1 means a decision was reached.
+ */
+static int slab_automove_age_decision(int *src, int *dst) {
+    static uint64_t evicted_old[MAX_NUMBER_OF_SLAB_CLASSES];
+    static uint64_t evicted_win[AUTOMOVE_AGE_WINDOW][MAX_NUMBER_OF_SLAB_CLASSES];
+    static unsigned int win_pos = 0;
+    static rel_time_t next_move;
+    uint64_t evicted_new[MAX_NUMBER_OF_SLAB_CLASSES];
+    int ages[MAX_NUMBER_OF_SLAB_CLASSES];
+    int oldest = 0, youngest = 0;
+    int i, w;
+
+    /* The LRUs only know about classes below POWER_LARGEST */
+    evicted_new[POWER_LARGEST] = 0;
+    ages[POWER_LARGEST] = -1;
+    item_stats_evictions(evicted_new);
+    item_stats_tail_ages(ages);
+
+    SLABS_LOCK();
+    for (i = POWER_SMALLEST; i <= power_largest; i++) {
+        uint64_t recent = 0;
+        evicted_win[win_pos][i] = evicted_new[i] - evicted_old[i];
+        evicted_old[i] = evicted_new[i];
+        for (w = 0; w < AUTOMOVE_AGE_WINDOW; w++) {
+            recent += evicted_win[w][i];
+        }
+        automove_age.age[i] = ages[i];
+        automove_age.evicted[i] = recent;
+
+        if (slabclass[i].slabs == 0)
+            continue;
+        /* Keep a couple of pages in every class, as the old mover did */
+        if (slabclass[i].slabs > 2 && (oldest == 0 || ages[i] == -1 ||
+            (ages[oldest] != -1 && ages[i] > ages[oldest]))) {
+            oldest = i;
+        }
+        if (recent != 0 && ages[i] != -1 &&
+            (youngest == 0 || ages[i] < ages[youngest])) {
+            youngest = i;
+        }
+    }
+    win_pos = (win_pos + 1) % AUTOMOVE_AGE_WINDOW;
+    automove_age.oldest = oldest;
+    automove_age.youngest = youngest;
+    SLABS_UNLOCK();
+
+    if (current_time < next_move || oldest == 0 || youngest == 0 ||
+        oldest == youngest) {
+        return 0;
+    }
+    if (ages[oldest] != -1 &&
+        ages[youngest] >= ages[oldest] * settings.slab_automove_ratio) {
+        return 0;
+    }
+
+    next_move = current_time + settings.slab_automove_interval;
+    *src = oldest;
+    *dst = youngest;
+    return 1;
+}
+
+/* While more memory is malloc'd than a lowered limit allows, picks a class to
+ * give a page back from. Prefers the class with the most free memory so items are
+ * only evicted once there is none left to hand back.
+ */
+static bool slab_reclaim_decision(int *src) {
+    size_t free_best = 0;
+    unsigned int pages_best = 1;
+    int free_src = -1, pages_src = -1;
+    int i;
+
+    SLABS_LOCK();
+    if (mem_reclaiming && mem_malloced > mem_limit) {
+        for (i = POWER_SMALLEST; i <= power_largest; i++) {
+            slabclass_t *p = &slabclass[i];
+            size_t free_bytes = (size_t)p->sl_curr * p->size;
+            if (p->slabs < 2)
+                continue;
+            if (p->sl_curr >= p->perslab && free_bytes > free_best) {
+                free_best = free_bytes;
+                free_src = i;
+            }
+            if (p->slabs > pages_best) {
+                pages_best = p->slabs;
+                pages_src = i;
+            }
+        }
+    }
+    *src = free_src != -1 ? free_src : pages_src;
+    /* Pages every class needs may keep it above the limit; stop there */
+    if (*src == -1)
+        mem_reclaiming = false;
+    SLABS_UNLOCK();
+
+    return *src != -1;
+}
+
+static enum reassign_result_type slabs_release_page(int src);
+
 /* Slab rebalancer thread.
  * Does not use spinlocks since it is not timing sensitive. Burn less CPU and
  * go to sleep if locks are contended
@@ -717,12 +1532,24 @@ static void *slab_maintenance_thread(void *arg) {
     int src, dest;
 
     while (do_run_slab_thread) {
-        if (settings.slab_automove == 1) {
+        if (slab_reclaim_decision(&src)) {
+            /* Shrinking to a lowered limit takes priority over balancing */
+            slabs_release_page(src);
+            usleep(10000);
+        } else if (settings.slab_automove == 1) {
             if (slab_automove_decision(&src, &dest) == 1) {
                 /* Blind to the return codes. It will retry on its own */
                 slabs_reassign(src, dest);
             }
             sleep(1);
+        } else if (settings.slab_automove == 3) {
+            if (slab_automove_age_decision(&src, &dest) == 1 &&
+                slabs_reassign(src, dest) == REASSIGN_OK) {
+                SLABS_LOCK();
+                automove_age.moves++;
+                SLABS_UNLOCK();
+            }
+            sleep(1);
         } else {
             /* Don't wake as often if we're not enabled.
              * This is lazier than setting up a condition right now. */
@@ -827,6 +1654,30 @@ enum reassign_result_type slabs_reassign(int src, int dst) {
     return ret;
 }
 
+/* Starts handing a page of class src back to the system rather than to
+ * another class. */
+static enum reassign_result_type slabs_release_page(int src) {
+    enum reassign_result_type ret;
+    if (pthread_mutex_trylock(&slabs_rebalance_lock) != 0) {
+        return REASSIGN_RUNNING;
+    }
+    if (slab_rebalance_signal != 0) {
+        ret = REASSIGN_RUNNING;
+    } else if (src < POWER_SMALLEST || src > power_largest) {
+        ret = REASSIGN_BADCLASS;
+    } else if (slabclass[src].slabs < 2) {
+        ret = REASSIGN_NOSPARE;
+    } else {
+        slab_rebal.s_clsid = src;
+        slab_rebal.d_clsid = 0;
+        slab_rebalance_signal = 1;
+        pthread_cond_signal(&slab_rebalance_cond);
+        ret = REASSIGN_OK;
+    }
+    pthread_mutex_unlock(&slabs_rebalance_lock);
+    return ret;
+}
+
 /* If we hold this lock, rebalancer can't wake up or move */
 void slabs_rebalancer_pause(void) {
     pthread_mutex_lock(&slabs_rebalance_lock);
@@ -871,11 +1722,11 @@ int start_slab_maintenance_thread(void) {
 }
 
 void stop_slab_maintenance_thread(void) {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_run_slab_thread = 0;
     do_run_slab_rebalance_thread = 0;
     pthread_cond_signal(&maintenance_cond);
-    pthread_mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 
     /* Wait for the maintenance thread to stop */
     pthread_join(maintenance_tid, NULL);
@@ -921,7 +1772,8 @@ void snapshot_slab(int id, FILE *fp) {
 		slabclass_p = &slabclass[id];
 	    for (x = 0; x < slabclass_p->perslab; x++) {
 			it = (item *)ptr;
-			if ((it->it_flags & ITEM_LINKED) != 0) {
+			/* Chunked items are not persisted */
+			if ((it->it_flags & (ITEM_LINKED | ITEM_CHUNKED)) == ITEM_LINKED) {
 				fwrite(it, ITEM_ntotal(it), 1, fp);
 			}
 	        ptr += slabclass_p->size;
@@ -7,8 +7,11 @@
     size equal to the previous slab's chunk size times this factor.
     3rd argument specifies if the slab allocator should allocate all memory
     up front (if true), or allocate memory in chunks as it is needed (if false)
+    4th argument, if not NULL, is a zero terminated list of chunk sizes to
+    use instead of the growth factor
 */
-void slabs_init(const size_t limit, const double factor, const bool prealloc);
+void slabs_init(const size_t limit, const double factor, const bool prealloc,
+                const uint32_t *slab_sizes);
 
 
 /**
@@ -18,12 +21,23 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc);
 
 unsigned int slabs_clsid(const size_t size);
 
+#ifdef COMPACT_ITEMS
+/** Carve memory that items may link to, such as the LRU crawlers, out of
+    the slab arena. It does not count against the memory limit. */
+void *slabs_arena_reserve(size_t size);
+#endif
+
 /** Allocate object of given length. 0 on error */ /*@null@*/
 void *slabs_alloc(const size_t size, unsigned int id);
 
 /** Free previously allocated object */
 void slabs_free(void *ptr, size_t size, unsigned int id);
 
+/** Change the limit on bytes to allocate. Lowering it has the maintenance
+    thread hand pages back when slab_reassign is enabled. false if the limit
+    can't be honoured. */
+bool slabs_adjust_mem_limit(size_t new_mem_limit);
+
 /** Adjust the stats for memory requested */
 void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal);
 
@@ -33,6 +47,9 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c);
 /** Fill buffer with stats */ /*@null@*/
 void slabs_stats(ADD_STAT add_stats, void *c);
 
+/** Where slab memory goes, and a -f/-n that would waste less of it */
+void slabs_fragmentation_stats(ADD_STAT add_stats, void *c);
+
 int start_slab_maintenance_thread(void);
 void stop_slab_maintenance_thread(void);
 
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Size to slab class lookup table. See slabs_lookup.h.
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "slabs_lookup.h"
+
+/* Smallest class whose chunks hold at least size bytes. */
+static unsigned int first_fit(const slabs_lookup_t *t, size_t size) {
+    unsigned int res = 1;
+    while (res < t->largest && size > t->sizes[res])
+        res++;
+    return res;
+}
+
+void slabs_lookup_init(slabs_lookup_t *t, const unsigned int *sizes,
+                       unsigned int largest) {
+    unsigned int i;
+
+    assert(largest > 0 && largest < SLABS_LOOKUP_MAX_CLASSES);
+    memset(t, 0, sizeof(*t));
+    t->largest = largest;
+    for (i = 1; i <= largest; i++) {
+        t->sizes[i] = sizes[i];
+    }
+
+    /* direct[i] covers sizes (i << shift, (i + 1) << shift] */
+    for (i = 0; i < sizeof(t->direct); i++) {
+        size_t lo = ((size_t)i << SLABS_LOOKUP_DIRECT_SHIFT) + 1;
+        t->direct[i] = first_fit(t, lo);
+    }
+
+    /* log[i] starts at its leading bit plus the sub-bucket below it */
+    for (i = 0; i < SLABS_LOOKUP_LOG_ENTRIES; i++) {
+        unsigned int bit = SLABS_LOOKUP_DIRECT_BITS +
+            (i >> SLABS_LOOKUP_SUBBITS);
+        unsigned int sub = i & ((1 << SLABS_LOOKUP_SUBBITS) - 1);
+        size_t lo = ((size_t)1 << bit) |
+            ((size_t)sub << (bit - SLABS_LOOKUP_SUBBITS));
+        t->log[i] = first_fit(t, lo);
+    }
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef SLABS_LOOKUP_H
+#define SLABS_LOOKUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constant time lookup of the slab class for an item size.
+ *
+ * Sizes up to SLABS_LOOKUP_DIRECT_MAX are looked up in a table with one
+ * entry per 8 bytes. Larger sizes are bucketed by their leading bit and the
+ * SLABS_LOOKUP_SUBBITS bits below it, so every bucket spans about 1.5% of
+ * its size. Each entry holds the smallest class that can fit the smallest
+ * size of its range. The classes stepped over from there are the ones whose
+ * sizes fall inside that range: none in the direct table, since sizes are
+ * multiples of 8, and one or two for the default factor. A factor below
+ * about 1.015, or a dense -o slab_sizes list, can put many in one range.
+ */
+
+#define SLABS_LOOKUP_MAX_CLASSES 256
+#define SLABS_LOOKUP_DIRECT_SHIFT 3
+#define SLABS_LOOKUP_DIRECT_BITS 14
+#define SLABS_LOOKUP_DIRECT_MAX (1 << SLABS_LOOKUP_DIRECT_BITS)
+#define SLABS_LOOKUP_SUBBITS 6
+/* Sizes above the direct table up to 2^32 */
+#define SLABS_LOOKUP_LOG_ENTRIES \
+    ((32 - SLABS_LOOKUP_DIRECT_BITS) << SLABS_LOOKUP_SUBBITS)
+
+typedef struct {
+    /* chunk size of each class, 0 for the unused class 0 */
+    unsigned int sizes[SLABS_LOOKUP_MAX_CLASSES];
+    unsigned int largest;
+    uint8_t direct[SLABS_LOOKUP_DIRECT_MAX >> SLABS_LOOKUP_DIRECT_SHIFT];
+    uint8_t log[SLABS_LOOKUP_LOG_ENTRIES];
+} slabs_lookup_t;
+
+/**
+ * Build the lookup for classes 1 to largest, where sizes[i] is the chunk
+ * size of class i and sizes only grow with i.
+ */
+void slabs_lookup_init(slabs_lookup_t *t, const unsigned int *sizes,
+                       unsigned int largest);
+
+static inline unsigned int slabs_lookup_bucket(size_t size) {
+    unsigned int bit;
+#if defined(__GNUC__)
+    bit = 31 - __builtin_clz((unsigned int)size);
+#else
+    bit = SLABS_LOOKUP_DIRECT_BITS;
+    while ((size >> (bit + 1)) != 0)
+        bit++;
+#endif
+    return ((bit - SLABS_LOOKUP_DIRECT_BITS) << SLABS_LOOKUP_SUBBITS) |
+        ((size >> (bit - SLABS_LOOKUP_SUBBITS)) &
+         ((1 << SLABS_LOOKUP_SUBBITS) - 1));
+}
+
+/* The first class to try for size, which must be within the largest class. */
+static inline unsigned int slabs_lookup_hint(const slabs_lookup_t *t,
+                                             size_t size) {
+    if (size <= SLABS_LOOKUP_DIRECT_MAX)
+        return t->direct[(size - 1) >> SLABS_LOOKUP_DIRECT_SHIFT];
+    return t->log[slabs_lookup_bucket(size)];
+}
+
+/* Returns the class for size, or 0 if it doesn't fit in any class. */
+static inline unsigned int slabs_lookup(const slabs_lookup_t *t,
+                                        size_t size) {
+    unsigned int res;
+
+    if (size == 0 || size > t->sizes[t->largest])
+        return 0;
+    res = slabs_lookup_hint(t, size);
+    while (size > t->sizes[res])
+        res++;
+    return res;
+}
+
+#endif
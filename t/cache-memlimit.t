@@ -0,0 +1,54 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 32 -o slab_reassign');
+my $sock = $server->sock;
+
+print $sock "cache_memlimit 4\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "limit below 8MB refused");
+print $sock "cache_memlimit fish\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "limit must be a number");
+
+# Fill the cache across a few classes
+my $big = 'x' x 50000;
+my $small = 'y' x 2000;
+for my $i (1 .. 400) {
+    print $sock "set big$i 0 0 50000 noreply\r\n", $big, "\r\n";
+    print $sock "set small$i 0 0 2000 noreply\r\n", $small, "\r\n";
+}
+mem_get_is($sock, "small400", $small, "cache filled");
+
+my $slabs = mem_stats($sock, "slabs");
+cmp_ok($slabs->{total_malloced}, '>', 16 * 1024 * 1024, "memory in use");
+is($slabs->{spare_pages}, 0, "nothing handed back yet");
+
+print $sock "cache_memlimit 12\r\n";
+is(scalar <$sock>, "OK\r\n", "lowered the limit");
+is(mem_stats($sock)->{limit_maxbytes}, 12 * 1024 * 1024,
+   "limit_maxbytes follows");
+
+for (1 .. 20) {
+    sleep 1;
+    $slabs = mem_stats($sock, "slabs");
+    last if $slabs->{total_malloced} <= 12 * 1024 * 1024;
+}
+cmp_ok($slabs->{total_malloced}, '<=', 12 * 1024 * 1024, "cache shrank");
+cmp_ok($slabs->{spare_pages}, '>', 0, "pages handed back");
+mem_get_is($sock, "small400", $small, "recent items survive");
+
+# Growing again reuses the released pages
+print $sock "cache_memlimit 32\r\n";
+is(scalar <$sock>, "OK\r\n", "raised the limit");
+my $spare = $slabs->{spare_pages};
+for my $i (1 .. 200) {
+    print $sock "set big$i 0 0 50000 noreply\r\n", $big, "\r\n";
+}
+mem_get_is($sock, "big200", $big, "stored more");
+cmp_ok(mem_stats($sock, "slabs")->{spare_pages}, '<', $spare,
+       "spare pages reused");
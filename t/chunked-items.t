@@ -0,0 +1,64 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    new_memcached('-o slab_chunk_max=262144');
+};
+ok($@ && $@ =~ m/^Failed/, "slab_chunk_max needs large_item_max");
+
+my $server = new_memcached('-m 64 -o large_item_max=8m,slab_reassign');
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{large_item_max}, 8 * 1024 * 1024, "large_item_max set");
+    is($stats->{slab_chunk_max}, 512 * 1024, "chunks are half a page");
+}
+
+# Values around and well above a page
+for my $len (524288, 1024 * 1024, 5 * 1024 * 1024 + 13) {
+    my $val = join('', map { chr(65 + ($_ % 26)) } 0 .. 1023) x
+        int($len / 1024);
+    $val .= 'z' x ($len - length($val));
+    print $sock "set big$len 0 0 $len\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored $len bytes");
+    mem_get_is($sock, "big$len", $val, "got $len bytes back");
+}
+
+my $toobig = 9 * 1024 * 1024;
+print $sock "set toobig 0 0 $toobig\r\n", 'x' x $toobig, "\r\n";
+is(scalar <$sock>, "SERVER_ERROR object too large for cache\r\n",
+   "above large_item_max is refused");
+
+{
+    my $val = 'a' x (2 * 1024 * 1024);
+    print $sock "set ap 0 0 ", length($val), "\r\n$val\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored chunked item");
+    print $sock "append ap 0 0 3\r\nend\r\n";
+    is(scalar <$sock>, "STORED\r\n", "appended to it");
+    print $sock "prepend ap 0 0 5\r\nstart\r\n";
+    is(scalar <$sock>, "STORED\r\n", "prepended to it");
+    mem_get_is($sock, "ap", "start" . $val . "end", "append and prepend");
+    print $sock "incr ap 1\r\n";
+    like(scalar <$sock>, qr/^CLIENT_ERROR/, "chunked values aren't numbers");
+}
+
+# Chunks moved along with their page are rescued or evicted whole
+{
+    my $val = 'q' x (3 * 1024 * 1024);
+    print $sock "set moved 0 0 ", length($val), "\r\n$val\r\n";
+    scalar <$sock>;
+    my $slabs = mem_stats($sock, "slabs");
+    my ($clsid) = grep { $slabs->{"$_:chunk_size"} &&
+        $slabs->{"$_:chunk_size"} == 512 * 1024 } 1 .. 200;
+    print $sock "slabs reassign $clsid 1\r\n";
+    is(scalar <$sock>, "OK\r\n", "moving a chunk page");
+    sleep 2;
+    mem_get_is($sock, "moved", $val, "item intact after the move");
+}
@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o conn_buffer_pool');
+my $sock = $server->sock;
+
+is(mem_stats($sock, ' settings')->{conn_buffer_pool}, 'yes',
+   "conn_buffer_pool set");
+
+# Only the connection asking holds buffers while the stats are made
+my $stats = mem_stats($sock);
+my $set = $stats->{conn_buffer_bytes_attached};
+cmp_ok($set, '>', 0, "the stats connection holds a set of buffers");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "fooval");
+
+# Waits for the buffers held by connections to come to $want
+sub attached_is {
+    my ($want, $msg) = @_;
+    for (1 .. 20) {
+        $stats = mem_stats($sock);
+        last if $stats->{conn_buffer_bytes_attached} == $want;
+        select(undef, undef, undef, 0.1);
+    }
+    is($stats->{conn_buffer_bytes_attached}, $want, $msg);
+}
+
+# Half a request keeps a connection's buffers; idle ones give them back
+my @socks = map { $server->new_sock } 1 .. 20;
+attached_is($set, "idle connections hold no buffers");
+print $_ "get fo" for @socks;
+attached_is(21 * $set, "half read requests hold theirs");
+print $_ "o\r\n" for @socks;
+is(scalar(grep { <$_> eq "VALUE foo 0 6\r\n" } @socks), 20,
+   "every connection answered");
+<$_>, <$_> for @socks;
+attached_is($set, "and give them back once answered");
+cmp_ok($stats->{conn_buffer_bytes_pooled}, '>=', 20 * $set,
+       "to the pools");
+
+# values and pipelines much bigger than the starting buffers
+my $big = 'x' x 300_000;
+print $sock "set big 0 0 300000\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a large value");
+mem_get_is($sock, "big", $big);
+
+print $sock join('', map { "get foo\r\n" } 1 .. 500);
+my $ok = 1;
+for (1 .. 500) {
+    $ok = 0 unless <$sock> eq "VALUE foo 0 6\r\n" && <$sock> eq "fooval\r\n"
+        && <$sock> eq "END\r\n";
+}
+ok($ok, "pipelined gets answered in order");
+
+# the binary protocol
+my $bin = $server->new_sock;
+print $bin pack("CCnCCnNNNN", 0x80, 0x00, 3, 0, 0, 0, 3, 0, 0, 0) . "foo";
+read($bin, my $hdr, 24);
+my $blen = (unpack("CCnCCnNNNN", $hdr))[6];
+read($bin, my $body, $blen);
+is(substr($body, 4), "fooval", "binary get");
@@ -0,0 +1,54 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub connect_all {
+    my ($server, $n) = @_;
+    my @socks = map { $server->new_sock } 1 .. $n;
+    for my $s (@socks) {
+        print $s "version\r\n";
+        scalar <$s>;
+    }
+    return @socks;
+}
+
+sub curr_conns {
+    my $threads = mem_stats(shift, "threads");
+    return map { $threads->{"$_:curr_connections"} } 0 .. 3;
+}
+
+my $server = new_memcached('-t 4 -o conn_placement=load');
+my $sock = $server->sock;
+my $settings = mem_stats($sock, ' settings');
+is($settings->{conn_placement}, "load", "conn_placement set");
+is($settings->{conn_migrate}, "no", "conn_migrate off by default");
+
+# Idle workers all tie on load, so connections are spread evenly
+my @socks = connect_all($server, 7);
+my @conns = curr_conns($sock);
+is($conns[$_], 2, "thread $_ has two") for 0 .. 3;
+
+# The first of those went to thread 1 and so did the fifth. Once they're
+# gone, new connections fill thread 1 back up rather than taking turns.
+close($_) for @socks[0, 4];
+my $total;
+for (1 .. 50) {
+    $total = 0;
+    $total += $_ for curr_conns($sock);
+    last if $total == 6;
+    select(undef, undef, undef, 0.1);
+}
+is($total, 6, "closed connections are no longer counted");
+push @socks, connect_all($server, 2);
+@conns = curr_conns($sock);
+is($conns[$_], 2, "thread $_ evened out") for 0 .. 3;
+
+my $threads = mem_stats($sock, "threads");
+ok(defined $threads->{"0:busy_percent"} &&
+   defined $threads->{"0:requests_per_sec"}, "load reported");
+is($threads->{"0:migrations"}, 0, "nothing migrated");
@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# cpu 0 is the one cpu every host has
+my $server = eval {
+    new_memcached('-t 4 -o worker_cpus=0,housekeeping_cpus=0,busy_poll=1000')
+};
+if (!$server) {
+    plan skip_all => 'pinning threads not supported';
+    exit 0;
+}
+plan tests => 11;
+
+for my $bad ('fish', '3-1', '0:', '1024') {
+    eval {
+        new_memcached("-o worker_cpus=$bad");
+    };
+    ok($@ && $@ =~ m/^Failed/, "worker_cpus=$bad refused");
+}
+
+my $sock = $server->sock;
+my $settings = mem_stats($sock, ' settings');
+is($settings->{worker_cpus}, '0', "worker_cpus set");
+is($settings->{housekeeping_cpus}, '0', "housekeeping_cpus set");
+is($settings->{busy_poll}, 1000, "busy_poll set");
+
+SKIP: {
+    my $pid = mem_stats($sock)->{pid};
+    skip "no /proc", 1 unless -d "/proc/$pid/task";
+    my @free;
+    for my $task (glob("/proc/$pid/task/*")) {
+        open(my $fh, '<', "$task/status") or next;
+        while (<$fh>) {
+            push @free, $task if /^Cpus_allowed_list:\s+(\S+)/ && $1 ne '0';
+        }
+    }
+    is(scalar @free, 0, "every thread pinned to cpu 0");
+}
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+
+# Each request goes out as soon as the last answer is in, well inside the
+# time a worker keeps polling
+my $ok = 1;
+for (1 .. 200) {
+    print $sock "get foo\r\n";
+    $ok = 0 unless <$sock> eq "VALUE foo 0 6\r\n" && <$sock> eq "fooval\r\n"
+        && <$sock> eq "END\r\n";
+}
+ok($ok, "gets answered while busy polling");
+cmp_ok(mem_stats($sock)->{busy_poll_hits}, '>', 0,
+       "polling picked up requests");
@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o idle_timeout=2');
+my $sock = $server->sock;
+
+is(mem_stats($sock, ' settings')->{idle_timeout}, 2, "idle_timeout set");
+is(mem_stats($sock)->{idle_kicks}, 0, "nothing closed yet");
+
+my $idle = $server->new_sock;
+my $half = $server->new_sock;
+my $bin = $server->new_sock;
+print $idle "version\r\n";
+like(scalar <$idle>, qr/^VERSION /, "idle connection works");
+print $half "set foo 0 0 6\r\nfoo";
+
+# Binary no-ops and ascii commands every second keep those two open
+for (1 .. 5) {
+    print $sock "version\r\n";
+    <$sock>;
+    print $bin pack("CCnCCnNNNN", 0x80, 0x0a, 0, 0, 0, 0, 0, 0, 0, 0);
+    read($bin, my $hdr, 24);
+    sleep(1);
+}
+
+is(scalar <$idle>, undef, "idle connection closed");
+is(scalar <$half>, undef, "connection stuck in a value closed");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "busy connection still open");
+mem_get_is($sock, "foo", "fooval");
+
+print $bin pack("CCnCCnNNNN", 0x80, 0x0a, 0, 0, 0, 0, 0, 0, 0, 0);
+is(read($bin, my $hdr, 24), 24, "busy binary connection still open");
+
+is(mem_stats($sock)->{idle_kicks}, 2, "idle kicks counted");
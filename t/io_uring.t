@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# -R 2 makes connections yield often, which they do differently on the ring
+my $server = eval { new_memcached('-o io_uring -R 2') };
+if (!$server) {
+    plan skip_all => 'io_uring not available';
+    exit 0;
+}
+plan tests => 12;
+
+my $sock = $server->sock;
+is(mem_stats($sock, ' settings')->{io_uring}, 'yes', "io_uring set");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "fooval");
+
+# values much bigger than the ring's read buffers
+my $big = join('', map { chr(65 + $_ % 26) } 0 .. 299_999);
+print $sock "set big 0 0 300000\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a large value");
+mem_get_is($sock, "big", $big);
+
+# a long pipeline arrives over many reads and yields
+print $sock join('', map { "set k$_ 0 0 1 noreply\r\n$_\r\n" } 0 .. 9);
+print $sock join('', map { "get k" . ($_ % 10) . "\r\n" } 1 .. 1000);
+my $ok = 1;
+for my $i (1 .. 1000) {
+    my $n = $i % 10;
+    $ok = 0 unless <$sock> eq "VALUE k$n 0 1\r\n" && <$sock> eq "$n\r\n"
+        && <$sock> eq "END\r\n";
+}
+ok($ok, "pipelined gets answered in order");
+
+# the binary protocol
+my $bin = $server->new_sock;
+print $bin pack("CCnCCnNNNN", 0x80, 0x00, 3, 0, 0, 0, 3, 0, 0, 0) . "foo";
+read($bin, my $hdr, 24);
+my $blen = (unpack("CCnCCnNNNN", $hdr))[6];
+read($bin, my $body, $blen);
+is(substr($body, 4), "fooval", "binary get");
+
+# many connections at once, each with a request in flight
+my @socks = map { $server->new_sock } 1 .. 20;
+print $_ "get foo\r\n" for @socks;
+is(scalar(grep { <$_> eq "VALUE foo 0 6\r\n" } @socks), 20,
+   "every connection answered");
+<$_>, <$_> for @socks;
+
+my $conns = mem_stats($sock)->{curr_connections};
+close($_) for @socks;
+my $stats;
+for (1 .. 20) {
+    $stats = mem_stats($sock);
+    last if $stats->{curr_connections} == $conns - 20;
+    select(undef, undef, undef, 0.1);
+}
+is($stats->{curr_connections}, $conns - 20, "closed connections let go of");
+
+cmp_ok($stats->{io_uring_enters}, '>', 0, "requests went through the ring");
+cmp_ok($stats->{io_uring_completions}, '>', 0, "and came back");
+
+print $sock "quit\r\n";
+is(scalar <$sock>, undef, "quit closes");
@@ -0,0 +1,33 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if ($^O ne 'linux') {
+    plan skip_all => 'Huge pages and NUMA placement are Linux only';
+    exit 0;
+}
+
+plan tests => 5;
+
+my $server = new_memcached('-m 64 -L -o numa_interleave');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{large_pages}, "yes", "large pages enabled");
+is($stats->{numa_interleave}, "yes", "numa interleave enabled");
+
+my $val = 'x' x 100000;
+print $sock "set foo 0 0 100000\r\n$val\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored into preallocated memory");
+mem_get_is($sock, "foo", $val, "got it back");
+
+# Grow the hash table a couple of times
+for my $i (1 .. 200000) {
+    print $sock "set k$i 0 0 1 noreply\r\n1\r\n";
+}
+cmp_ok(mem_stats($sock)->{hash_power_level}, '>', 16, "hash table grew");
@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 72;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 32 -o lru_crawler,lru_crawler_autocrawl,lru_crawler_budget=50');
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{lru_crawler_autocrawl}, "yes");
+    is($stats->{lru_crawler_budget}, 50);
+}
+
+# Immortal items and short expiring items. Nobody asks for a crawl; the
+# autocrawler has to find the expired ones on its own.
+for (1 .. 30) {
+    print $sock "set ifoo$_ 0 0 2\r\nok\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key");
+}
+for (1 .. 30) {
+    print $sock "set sfoo$_ 0 2 2\r\nok\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored key");
+}
+
+my $items;
+for (1 .. 30) {
+    sleep 1;
+    $items = mem_stats($sock, "items");
+    last if $items->{"items:1:crawler_reclaimed"} == 30;
+}
+is($items->{"items:1:crawler_reclaimed"}, 30, "autocrawler reclaimed 30 items");
+ok($items->{"items:1:crawler_items_checked"} >= 60, "autocrawler checked items");
+ok(exists $items->{"items:1:crawler_next_crawl"}, "next crawl is reported");
+
+{
+    my $stats = mem_stats($sock);
+    ok($stats->{lru_crawler_starts} > 0, "crawls were started");
+    my $slabs = mem_stats($sock, "slabs");
+    is($slabs->{"1:used_chunks"}, 30, "slab1 now has 30 used chunks");
+}
+
+print $sock "lru_crawler budget 0\r\n";
+is(scalar <$sock>, "CLIENT_ERROR budget must be between 1 and 100\r\n",
+   "budget bounds are checked");
+print $sock "lru_crawler budget 10\r\n";
+is(scalar <$sock>, "OK\r\n", "set crawler budget");
+
+print $sock "lru_crawler autocrawl 0\r\n";
+is(scalar <$sock>, "OK\r\n", "disabled autocrawler");
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{lru_crawler_autocrawl}, "no");
+    is($stats->{lru_crawler_budget}, 10);
+}
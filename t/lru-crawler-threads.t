@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 16;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 32 -o lru_crawler,lru_crawler_threads=4,lru_crawler_sleep=0');
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{lru_crawler_threads}, 4, "running four crawler threads");
+}
+
+# Short expiring items spread over enough classes that every thread has
+# something to crawl, plus immortal ones which must survive.
+my @sizes = (10, 200, 600, 1500, 4000, 9000);
+for my $size (@sizes) {
+    my $val = "x" x $size;
+    for (1 .. 50) {
+        print $sock "set sfoo${size}_$_ 0 1 $size\r\n$val\r\n";
+        scalar <$sock>;
+        print $sock "set ifoo${size}_$_ 0 0 $size\r\n$val\r\n";
+        scalar <$sock>;
+    }
+}
+
+sleep 3;
+
+print $sock "lru_crawler crawl all\r\n";
+is(scalar <$sock>, "OK\r\n", "kicked lru crawler");
+my $stats;
+while (1) {
+    $stats = mem_stats($sock);
+    last unless $stats->{lru_crawler_running};
+}
+
+# A few short expiring items may already have been reused by later sets,
+# so count what is left rather than what the crawler freed.
+my $items = mem_stats($sock, "items");
+my ($number, $checked) = (0, 0);
+for my $k (keys %$items) {
+    $number += $items->{$k} if $k =~ /:number$/;
+    $checked += $items->{$k} if $k =~ /:crawler_items_checked$/;
+}
+is($number, 50 * @sizes, "all short expiring items are gone");
+ok($checked > 50 * @sizes, "crawler checked the items");
+ok($stats->{lru_crawler_starts} >= @sizes, "crawled every class");
+ok($stats->{lru_crawler_pass_usec} > 0, "pass time recorded");
+ok($stats->{lru_crawler_items_per_sec} > 0, "throughput recorded");
+is($stats->{crawler_items_checked}, $checked, "totals match classes");
+
+for my $size (@sizes) {
+    my $val = "x" x $size;
+    mem_get_is($sock, "sfoo${size}_1", undef);
+    mem_get_is($sock, "ifoo${size}_50", $val) if $size == 10;
+}
+
+print $sock "lru_crawler disable\r\n";
+is(scalar <$sock>, "OK\r\n", "disabled lru crawler threads");
@@ -2,7 +2,7 @@
 
 use strict;
 use warnings;
-use Test::More tests => 189;
+use Test::More tests => 194;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -65,6 +65,25 @@ for (1 .. 30) {
     mem_get_is($sock, "sfoo$_", undef);
 }
 
+# Dump what is left: the immortal and the long expiring items.
+print $sock "lru_crawler metadump all\r\n";
+{
+    my %keys;
+    while (<$sock>) {
+        last if /^END\r\n/;
+        if (/^key=(\S+) exp=(-?\d+) la=(\d+) cls=(\d+) size=(\d+)$/) {
+            $keys{$1} = $2;
+        }
+    }
+    is(scalar keys %keys, 60, "metadump listed 60 live items");
+    is($keys{ifoo1}, -1, "immortal item has no exptime");
+    ok($keys{lfoo1} > time(), "long expiring item has an exptime");
+}
+mem_get_is($sock, "ifoo1", "ok", "connection works after metadump");
+
+print $sock "lru_crawler metadump 40\r\n";
+is(scalar <$sock>, "END\r\n", "metadump of an empty class");
+
 print $sock "lru_crawler disable\r\n";
 is(scalar <$sock>, "OK\r\n", "disabled lru crawler");
 {
@@ -0,0 +1,54 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if ($^O ne 'linux') {
+    plan skip_all => 'NUMA placement is Linux only';
+    exit 0;
+}
+
+plan tests => 10;
+
+eval {
+    new_memcached('-o numa_local,numa_interleave');
+};
+ok($@ && $@ =~ m/^Failed/, "numa_local and numa_interleave are exclusive");
+
+eval {
+    new_memcached('-m 0 -o numa_local');
+};
+ok($@ && $@ =~ m/^Failed/, "numa_local needs a memory limit");
+
+# Pretend there are two nodes, so the cache is split in two 8MB ranges
+$ENV{T_MEMD_NUMA_NODES} = 2;
+my $server = new_memcached('-m 16 -t 1 -o numa_local');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{numa_local}, "yes", "numa_local enabled");
+
+$stats = mem_stats($sock, ' slabs');
+is($stats->{numa_nodes}, 2, "cache split over two nodes");
+is($stats->{numa_remote_allocs}, 0, "nothing taken from another node yet");
+
+my $val = 'x' x 1000;
+print $sock "set foo 0 0 1000\r\n$val\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored");
+mem_get_is($sock, "foo", $val, "got it back");
+
+# The worker's node runs out first, then the other range is used
+for my $i (1 .. 30000) {
+    print $sock "set k$i 0 0 1000 noreply\r\n$val\r\n";
+}
+mem_get_is($sock, "k30000", $val, "last item stored");
+
+$stats = mem_stats($sock, ' slabs');
+cmp_ok($stats->{total_malloced}, '>', 12 * 1024 * 1024,
+       "both ranges handed out pages");
+cmp_ok($stats->{numa_remote_allocs}, '>', 0,
+       "chunks came from the other node once the local one was full");
@@ -0,0 +1,37 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+eval {
+    new_memcached('-o prefault=0');
+};
+ok($@ && $@ =~ m/^Failed/, "prefault needs at least one thread");
+
+for my $bad ('abc', '4x') {
+    eval {
+        new_memcached("-o prefault=$bad");
+    };
+    ok($@ && $@ =~ m/^Failed/, "prefault=$bad is refused");
+}
+
+my $server = new_memcached('-m 64 -o prefault=3');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, ' settings');
+is($stats->{prefault_threads}, 3, "prefault threads set");
+
+my $val = 'x' x 100000;
+print $sock "set foo 0 0 100000\r\n$val\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored into prefaulted memory");
+mem_get_is($sock, "foo", $val, "got it back");
+
+# Faulting doesn't take pages away from the slab classes
+for my $i (1 .. 500) {
+    print $sock "set big$i 0 0 100000 noreply\r\n$val\r\n";
+}
+mem_get_is($sock, "big500", $val, "whole cache usable");
@@ -0,0 +1,45 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if ($^O ne 'linux') {
+    plan skip_all => 'SO_REUSEPORT balancing is tested on Linux only';
+    exit 0;
+}
+
+plan tests => 8;
+
+# The main thread hands connections out round robin
+sub connect_all {
+    my ($server, $n) = @_;
+    my @socks = map { $server->new_sock } 1 .. $n;
+    for my $s (@socks) {
+        print $s "version\r\n";
+        scalar <$s>;
+    }
+    return @socks;
+}
+
+my $server = new_memcached('-t 4');
+my $sock = $server->sock;
+my @socks = connect_all($server, 7);
+my $threads = mem_stats($sock, "threads");
+is(scalar(grep { /:accepts$/ } keys %$threads), 4, "a line per thread");
+is($threads->{"$_:accepts"}, 2, "thread $_ took two") for 0 .. 3;
+
+$server = new_memcached('-t 4 -o reuseport');
+$sock = $server->sock;
+is(mem_stats($sock, ' settings')->{reuseport}, "yes", "reuseport set");
+
+@socks = connect_all($server, 40);
+$threads = mem_stats($sock, "threads");
+my @accepts = map { $threads->{"$_:accepts"} } 0 .. 3;
+my $total = 0;
+$total += $_ for @accepts;
+is($total, 41, "every connection accepted by a worker");
+cmp_ok(scalar(grep { $_ > 0 } @accepts), '>', 1, "spread over the workers");
@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 14;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+for my $bad ('96:90:200', '96:100:201', '96:2097152', 'fish', '96:0:200',
+             '0:96') {
+    eval {
+        new_memcached("-o slab_sizes=$bad");
+    };
+    ok($@ && $@ =~ m/^Failed/, "slab_sizes=$bad refused");
+}
+
+my $server = new_memcached('-m 64');
+my $sock = $server->sock;
+
+# Values clustered around a couple of sizes
+for my $i (1 .. 3000) {
+    my $len = $i % 2 ? 130 : 610;
+    print $sock "set key$i 0 0 $len noreply\r\n", 'x' x $len, "\r\n";
+}
+mem_get_is($sock, "key3000", 'x' x 610, "stored the profile");
+
+my $frag = mem_stats($sock, "fragmentation");
+my $sizes = $frag->{suggested_slab_sizes};
+like($sizes, qr/^\d+(:\d+)+$/, "a layout is suggested");
+cmp_ok($frag->{suggested_slab_sizes_bytes}, '<=', $frag->{layout_bytes},
+       "it needs no more pages than the current one");
+
+# Start a server with the suggested layout
+$server = new_memcached("-m 64 -o slab_sizes=$sizes");
+$sock = $server->sock;
+for my $i (1 .. 3000) {
+    my $len = $i % 2 ? 130 : 610;
+    print $sock "set key$i 0 0 $len noreply\r\n", 'x' x $len, "\r\n";
+}
+mem_get_is($sock, "key2999", 'x' x 130, "stored with custom classes");
+
+my $slabs = mem_stats($sock, "slabs");
+my @want = split /:/, $sizes;
+my @got = map { $slabs->{"$_:chunk_size"} }
+    grep { defined $slabs->{"$_:chunk_size"} } 1 .. 200;
+ok(@got >= 2, "classes in use");
+my %want = map { $_ => 1 } @want;
+is(scalar(grep { !$want{$_} } @got), 0, "only the given sizes are used");
+
+$frag = mem_stats($sock, "fragmentation");
+is($frag->{layout_bytes}, $frag->{suggested_slab_sizes_bytes},
+   "layout priced the same once in use");
+cmp_ok($frag->{rounding_waste}, '<',
+       mem_stats($sock, "fragmentation")->{item_bytes} / 10,
+       "little lost to rounding");
@@ -0,0 +1,62 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 12;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Age balancing automover, moving pages as fast as it likes
+my $server = new_memcached('-o slab_reassign,slab_automove=3,slab_automove_ratio=0.5,slab_automove_interval=0 -m 4');
+my $sock = $server->sock;
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{slab_automove}, 3, "age balancer enabled");
+    is($stats->{slab_automove_ratio}, "0.50", "ratio set");
+    is($stats->{slab_automove_interval}, 0, "interval set");
+}
+
+# Fill memory with large items, then let them age
+my $bigdata = 'x' x 70000; # slab 31
+for my $i (1 .. 60) {
+    print $sock "set bfoo$i 0 0 70000\r\n", $bigdata, "\r\n";
+    scalar <$sock>;
+}
+sleep 3;
+
+my $slabs_before = mem_stats($sock, "slabs");
+ok(defined $slabs_before->{"31:tail_age"}, "tail age is reported");
+ok(defined $slabs_before->{"31:evicted_window"}, "recent evictions reported");
+is($slabs_before->{automove_moves}, 0, "nothing moved yet");
+
+# A smaller class now evicts with a young tail
+my $smalldata = 'y' x 20000; # slab 25
+for my $i (1 .. 60) {
+    print $sock "set sfoo$i 0 0 20000\r\n", $smalldata, "\r\n";
+    scalar <$sock>;
+}
+
+my $slabs_after;
+for (1 .. 10) {
+    sleep 1;
+    # Keep the small class evicting
+    for my $i (1 .. 10) {
+        print $sock "set sfoo$i 0 0 20000\r\n", $smalldata, "\r\n";
+        scalar <$sock>;
+    }
+    $slabs_after = mem_stats($sock, "slabs");
+    last if $slabs_after->{automove_moves} > 0;
+}
+
+cmp_ok($slabs_after->{"31:tail_age"}, '>=', 3, "large class tail is old");
+cmp_ok($slabs_after->{"25:evicted_window"}, '>', 0, "small class evicting");
+is($slabs_after->{automove_oldest}, 31, "large class is the source");
+is($slabs_after->{automove_youngest}, 25, "small class is the destination");
+cmp_ok($slabs_after->{automove_moves}, '>', 0, "a page was moved");
+
+sleep 1;
+$slabs_after = mem_stats($sock, "slabs");
+cmp_ok($slabs_after->{"25:total_pages"}, '>',
+       $slabs_before->{"25:total_pages"} || 0, "small class gained pages");
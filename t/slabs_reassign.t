@@ -2,7 +2,7 @@
 
 use strict;
 use warnings;
-use Test::More tests => 130;
+use Test::More tests => 136;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
@@ -71,3 +71,45 @@ print $sock "set sfoo51 0 0 20000\r\n", $smalldata, "\r\n";
 is(scalar <$sock>, "STORED\r\n", "stored key");
 
 # Do need to come up with better automated tests for this.
+
+# Live items in a moved page are rescued into free chunks of their class.
+$server = new_memcached('-o slab_reassign -m 16');
+$sock = $server->sock;
+
+my $count = 0;
+for (1 .. 48) {
+    print $sock "set rfoo$_ 0 0 70000\r\n", $bigdata, "\r\n";
+    $count++ if scalar <$sock> eq "STORED\r\n";
+}
+is($count, 48, "stored items over several pages");
+
+# Free up the most recently written items, which sit in the last page.
+my $freed = 0;
+for (33 .. 48) {
+    print $sock "delete rfoo$_\r\n";
+    $freed++ if scalar <$sock> eq "DELETED\r\n";
+}
+is($freed, 16, "deleted the newest items");
+
+my %cas;
+for my $i (1 .. 32) {
+    ($cas{$i}) = mem_gets($sock, "rfoo$i");
+}
+
+my $slabs = mem_stats($sock, "slabs");
+my ($clsid) = map { /^(\d+):total_pages$/ ? $1 : () }
+    grep { /^\d+:total_pages$/ && $slabs->{$_} > 2 } keys %$slabs;
+print $sock "slabs reassign $clsid 1\r\n";
+is(scalar <$sock>, "OK\r\n", "moving a page away from class $clsid");
+sleep 2;
+
+$stats = mem_stats($sock);
+cmp_ok($stats->{slab_reassign_rescues}, '>', 0, "live items were rescued");
+is($stats->{slab_reassign_evictions}, 0, "nothing was evicted");
+
+my $found = 0;
+for my $i (1 .. 32) {
+    my ($cas, $val) = mem_gets($sock, "rfoo$i");
+    $found++ if $val eq $bigdata && $cas == $cas{$i};
+}
+is($found, 32, "every live item is still there, with its CAS");
@@ -0,0 +1,53 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 13;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 64');
+my $sock = $server->sock;
+
+my $frag = mem_stats($sock, "fragmentation");
+is($frag->{item_bytes}, 0, "nothing stored yet");
+is($frag->{suggested_growth_factor}, "1.25", "defaults kept when empty");
+
+# Item sizes that sit just past the default class boundaries
+for my $i (1 .. 2000) {
+    my $len = (130, 610, 1500)[$i % 3];
+    print $sock "set key$i 0 0 $len noreply\r\n", 'x' x $len, "\r\n";
+}
+print $sock "delete key1\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted one");
+
+my $slabs = mem_stats($sock, "slabs");
+$frag = mem_stats($sock, "fragmentation");
+my ($requested, $items, $pages) = (0, 0, 0);
+for my $id (grep { defined $frag->{"$_:items"} } 1 .. 200) {
+    $requested += $slabs->{"$id:mem_requested"};
+    $pages += $slabs->{"$id:total_pages"};
+    $items += $frag->{"$id:items"};
+}
+is($frag->{item_bytes} + $frag->{header_bytes}, $requested,
+   "item and header bytes make up mem_requested");
+is($frag->{item_bytes} + $frag->{header_bytes} + $frag->{rounding_waste} +
+   $frag->{free_bytes} + $frag->{page_waste}, $pages * 1024 * 1024,
+   "breakdown adds up to the pages");
+is($items, 1999, "items counted per class");
+cmp_ok($frag->{header_bytes}, '>', 0, "header overhead reported");
+cmp_ok($frag->{rounding_waste}, '>', 0, "rounding waste reported");
+cmp_ok($frag->{suggested_layout_bytes}, '<=', $frag->{layout_bytes},
+       "suggestion is no worse");
+ok($frag->{suggested_growth_factor} >= 1.05 &&
+   $frag->{suggested_growth_factor} <= 2, "suggested -f in range");
+ok($frag->{suggested_chunk_size} >= 8 &&
+   $frag->{suggested_chunk_size} <= 128, "suggested -n in range");
+
+# stats sizes now comes from the same incremental histogram
+my $sizes = mem_stats($sock, "sizes");
+my $total = 0;
+$total += $_ for values %$sizes;
+is($total, 1999, "stats sizes counts every item");
+ok(!grep({ $_ % 32 } keys %$sizes), "in 32 byte buckets");
@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 19;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+my @locks = qw(cache_lock item_locks slabs_lock stats_lock cache_t);
+
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{lock_profiler}, "no", "lock profiler starts disabled");
+}
+
+# Nothing is recorded while the profiler is off.
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+{
+    my $stats = mem_stats($sock, ' locks');
+    is($stats->{'cache_lock:acquires'}, 0, "no cache_lock acquires yet");
+    is($stats->{'item_locks:acquires'}, 0, "no item lock acquires yet");
+}
+
+print $sock "lock_profiler 2\r\n";
+like(scalar <$sock>, qr/^CLIENT_ERROR/, "bad lock_profiler argument");
+print $sock "lock_profiler 1\r\n";
+is(scalar <$sock>, "OK\r\n", "lock profiler enabled");
+{
+    my $stats = mem_stats($sock, ' settings');
+    is($stats->{lock_profiler}, "yes", "stats settings shows it enabled");
+}
+
+for (1 .. 20) {
+    print $sock "set foo$_ 0 0 3\r\nbar\r\n";
+    scalar <$sock>;
+}
+mem_get_is($sock, "foo20", "bar");
+{
+    my $stats = mem_stats($sock, ' locks');
+    for my $lock (@locks) {
+        ok(defined $stats->{"$lock:acquires"}, "$lock is reported");
+    }
+    cmp_ok($stats->{'item_locks:acquires'}, '>=', 20,
+           "item lock acquires counted");
+    cmp_ok($stats->{'cache_lock:acquires'}, '>=', 20,
+           "cache_lock acquires counted");
+    ok(grep(/^cache_lock:hold_(lt|ge)_\d+us$/, keys %$stats),
+       "cache_lock hold histogram reported");
+}
+
+print $sock "lock_profiler 0\r\n";
+is(scalar <$sock>, "OK\r\n", "lock profiler disabled");
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "stats reset");
+{
+    my $stats = mem_stats($sock, ' locks');
+    is($stats->{'cache_lock:acquires'}, 0, "reset clears lock stats");
+}
@@ -0,0 +1,61 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Sends a burst of requests without waiting, then gathers every datagram
+# that comes back, keyed by request id and sequence number.
+sub burst {
+    my ($sock, $cmd, @ids) = @_;
+    send($sock, pack("nnnn", $_, 0, 1, 0) . $cmd, 0) for @ids;
+    my %got;
+    my $rin = '';
+    vec($rin, fileno($sock), 1) = 1;
+    while (select(my $rout = $rin, undef, undef, 1.5)) {
+        $sock->recv(my $pkt, 1500, 0);
+        my ($id, $seq, $total) = unpack("nnn", $pkt);
+        $got{$id}{$seq} = $pkt;
+    }
+    return \%got;
+}
+
+my $server = new_memcached('-o udp_batch=8');
+my $sock = $server->sock;
+is(mem_stats($sock, ' settings')->{udp_batch}, 8, "udp_batch set");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+my $big = 'x' x 5000;
+print $sock "set big 0 0 5000\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+
+# More requests than fit in a batch, from two clients at once
+my @usocks = map { $server->new_udp_sock } 1 .. 2;
+send($usocks[0], pack("nnnn", $_, 0, 1, 0) . "get foo\r\n", 0) for 1 .. 20;
+my $got = burst($usocks[1], "get foo\r\n", 101 .. 120);
+is_deeply([sort { $a <=> $b } keys %$got], [101 .. 120],
+          "second client got its own replies");
+is(scalar(grep { substr($_->{0}, 8) eq "VALUE foo 0 6\r\nfooval\r\nEND\r\n" }
+          values %$got), 20, "all of them right");
+$got = burst($usocks[0], "get foo\r\n");
+is_deeply([sort { $a <=> $b } keys %$got], [1 .. 20],
+          "first client got its own replies");
+
+# Replies spanning several datagrams
+$got = burst($usocks[0], "get big\r\n", 200 .. 202);
+is(scalar(map { keys %$_ } values %$got), 12, "three replies of 4 datagrams");
+my $value = join('', map { substr($got->{201}{$_}, 8) } 0 .. 3);
+is($value, "VALUE big 0 5000\r\n$big\r\nEND\r\n", "reassembled in order");
+
+$server = new_memcached('-o udp_batch=1');
+$got = burst($server->new_udp_sock, "version\r\n", 7);
+like(substr($got->{7}{0}, 8), qr/^VERSION /, "works unbatched");
+
+eval {
+    new_memcached('-o udp_batch=0');
+};
+ok($@ && $@ =~ m/^Failed/, "udp_batch=0 refused");
@@ -0,0 +1,86 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Splits a request into datagrams of at most $size bytes of payload
+sub pieces {
+    my ($id, $req, $size) = @_;
+    my @chunks = unpack("(a$size)*", $req);
+    return map { pack("nnnn", $id, $_, scalar(@chunks), 0) . $chunks[$_] }
+        0 .. $#chunks;
+}
+
+# Collects a reply, which may itself span several datagrams
+sub reply {
+    my ($sock, $id) = @_;
+    my (%got, $total);
+    my $rin = '';
+    vec($rin, fileno($sock), 1) = 1;
+    while (!defined($total) || keys(%got) < $total) {
+        last unless select(my $rout = $rin, undef, undef, 1.5);
+        $sock->recv(my $pkt, 1500, 0);
+        my ($rid, $seq, $n) = unpack("nnn", $pkt);
+        next unless $rid == $id;
+        $total = $n;
+        $got{$seq} = substr($pkt, 8);
+    }
+    return undef unless defined $total;
+    return join('', map { $got{$_} } sort { $a <=> $b } keys %got);
+}
+
+my $server = new_memcached();
+my $sock = $server->sock;
+my $usock = $server->new_udp_sock;
+
+my @keys = map { sprintf("key_with_a_fairly_long_name_%04d", $_) } 1 .. 300;
+for my $k (@keys[0 .. 9]) {
+    print $sock "set $k 0 0 2 noreply\r\nhi\r\n";
+}
+
+# A multiget too big for one datagram, its pieces sent out of order
+my $get = "get " . join(' ', @keys) . "\r\n";
+my @pkts = pieces(10, $get, 1400);
+ok(@pkts > 5, "request spans " . scalar(@pkts) . " datagrams");
+send($usock, $_, 0) for reverse @pkts;
+my $expect = join('', map { "VALUE $_ 0 2\r\nhi\r\n" } @keys[0 .. 9]) .
+    "END\r\n";
+is(reply($usock, 10), $expect, "multiget answered");
+
+# A set whose value doesn't fit in one datagram
+my $val = 'v' x 3000;
+send($usock, $_, 0) for pieces(11, "set big 0 0 3000\r\n$val\r\n", 1000);
+is(reply($usock, 11), "STORED\r\n", "multi-packet set");
+mem_get_is($sock, "big", $val, "whole value stored");
+
+# Two clients using the same request id at once
+my $usock2 = $server->new_udp_sock;
+my @a = pieces(12, "get $keys[0] $keys[1]\r\n", 30);
+my @b = pieces(12, "get $keys[2]\r\n", 30);
+send($usock, $a[0], 0);
+send($usock2, $b[0], 0);
+send($usock2, $_, 0) for @b[1 .. $#b];
+send($usock, $_, 0) for @a[1 .. $#a];
+is(reply($usock2, 12), "VALUE $keys[2] 0 2\r\nhi\r\nEND\r\n",
+   "kept apart by sender");
+is(reply($usock, 12),
+   "VALUE $keys[0] 0 2\r\nhi\r\nVALUE $keys[1] 0 2\r\nhi\r\nEND\r\n",
+   "both answered");
+
+# More datagrams than we take
+@pkts = pieces(13, "get " . ('k ' x 2000) . "\r\n", 20);
+send($usock, $pkts[0], 0);
+is(reply($usock, 13), "SERVER_ERROR multi-packet request too large\r\n",
+   "too many datagrams refused");
+
+# A piece that never shows up
+@pkts = pieces(14, "get $keys[0]\r\n", 10);
+send($usock, $pkts[0], 0);
+is(reply($usock, 14), undef, "no reply to half a request");
+sleep(4);
+send($usock, $pkts[1], 0);
+is(reply($usock, 14), undef, "first half timed out");
@@ -0,0 +1,82 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = eval { new_memcached('-o zerocopy=64k') };
+if (!$server) {
+    plan skip_all => 'MSG_ZEROCOPY not supported';
+    exit 0;
+}
+plan tests => 12;
+
+my $sock = $server->sock;
+is(mem_stats($sock, ' settings')->{zerocopy_min}, 65536, "zerocopy_min set");
+
+my $big = join('', map { chr(65 + $_ % 26) } 0 .. 199_999);
+print $sock "set big 0 0 200000\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a large value");
+print $sock "set small 0 0 5\r\nhello\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a small value");
+
+mem_get_is($sock, "small", "hello", "small values are sent as before");
+is(mem_stats($sock)->{zerocopy_sends}, 0, "without zero-copy");
+
+my $ok = 1;
+for (1 .. 10) {
+    print $sock "get small big\r\n";
+    my %got;
+    while (my $line = <$sock>) {
+        last if $line eq "END\r\n";
+        my ($key, $len) = $line =~ /^VALUE (\S+) \d+ (\d+)/ or last;
+        read($sock, my $data, $len + 2);
+        $got{$key} = substr($data, 0, $len);
+    }
+    $ok = 0 unless ($got{big} // '') eq $big && ($got{small} // '') eq 'hello';
+}
+ok($ok, "large values arrive intact");
+
+# binary protocol gets send the value from the item too
+my $bin = $server->new_sock;
+print $bin pack("CCnCCnNNNN", 0x80, 0x00, 3, 0, 0, 0, 3, 0, 0, 0) . "big";
+read($bin, my $hdr, 24);
+my $blen = (unpack("CCnCCnNNNN", $hdr))[6];
+read($bin, my $body, $blen);
+is(substr($body, 4), $big, "binary get intact");
+
+my $stats = mem_stats($sock);
+cmp_ok($stats->{zerocopy_sends}, '>', 0, "values went out with MSG_ZEROCOPY");
+
+# the kernel reports completions once the data is acked
+for (1 .. 20) {
+    last if $stats->{zerocopy_completions} == $stats->{zerocopy_sends};
+    select(undef, undef, undef, 0.1);
+    # notices are read as the connection next wakes up
+    print $sock "version\r\n";
+    <$sock>;
+    $stats = mem_stats($sock);
+}
+is($stats->{zerocopy_completions}, $stats->{zerocopy_sends},
+   "every send completed");
+
+# a client that hangs up mid-reply; its sends still complete before the
+# items go back, and the connection closes once they have
+my $before = mem_stats($sock)->{curr_connections};
+my $rude = $server->new_sock;
+print $rude "get big big big big big big big big\r\n";
+read($rude, my $partial, 1000);
+close($rude);
+for (1 .. 20) {
+    $stats = mem_stats($sock);
+    last if $stats->{curr_connections} == $before &&
+            $stats->{zerocopy_completions} == $stats->{zerocopy_sends};
+    select(undef, undef, undef, 0.1);
+}
+is($stats->{curr_connections}, $before, "hung up connection closed");
+is($stats->{zerocopy_completions}, $stats->{zerocopy_sends},
+   "its sends completed too");
+mem_get_is($sock, "big", $big, "large value still intact");
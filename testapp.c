@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -21,6 +22,7 @@
 #include "config.h"
 #include "cache.h"
 #include "util.h"
+#include "slabs_lookup.h"
 #include "protocol_binary.h"
 
 #define TMP_TEMPLATE "/tmp/test_file.XXXXXXX"
@@ -182,6 +184,98 @@ static enum test_return cache_redzone_test(void)
 #endif
 }
 
+/* Chunk sizes the way slabs_init() lays them out for a growth factor. */
+static unsigned int slabs_lookup_sizes(unsigned int *sizes, double factor,
+                                       unsigned int item_size_max) {
+    unsigned int i = 0;
+    unsigned int size = 96;
+
+    while (++i < SLABS_LOOKUP_MAX_CLASSES - 1 &&
+           size <= item_size_max / factor) {
+        if (size % 8)
+            size += 8 - (size % 8);
+        sizes[i] = size;
+        size *= factor;
+    }
+    sizes[i] = item_size_max;
+    return i;
+}
+
+static unsigned int slabs_linear_clsid(const unsigned int *sizes,
+                                       unsigned int largest, size_t size) {
+    unsigned int res = 1;
+
+    if (size == 0)
+        return 0;
+    while (size > sizes[res])
+        if (res++ == largest)
+            return 0;
+    return res;
+}
+
+static uint64_t slabs_lookup_usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Checks the lookup table against a linear walk of the classes, and that it
+ * never steps over more than two classes whatever the factor. Also times
+ * both, so the table can be seen staying flat while the walk grows.
+ */
+static enum test_return test_slabs_lookup(void) {
+    const double factors[] = { 1.05, 1.25, 2.0 };
+    const unsigned int item_size_max = 1024 * 1024;
+    const int lookups = 1000000;
+    static slabs_lookup_t t;
+    unsigned int sizes[SLABS_LOOKUP_MAX_CLASSES];
+    size_t *probe = malloc(lookups * sizeof(size_t));
+    int f, i;
+
+    assert(probe != NULL);
+    srand(42);
+    for (i = 0; i < lookups; i++) {
+        probe[i] = (size_t)(rand() % item_size_max) + 1;
+    }
+
+    for (f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        unsigned int largest = slabs_lookup_sizes(sizes, factors[f],
+                                                  item_size_max);
+        size_t size;
+        uint64_t start, table_usec, linear_usec;
+        unsigned int sum = 0;
+
+        slabs_lookup_init(&t, sizes, largest);
+        assert(slabs_lookup(&t, 0) == 0);
+        assert(slabs_lookup(&t, item_size_max + 1) == 0);
+        for (size = 1; size <= item_size_max; size++) {
+            unsigned int res = slabs_lookup(&t, size);
+            assert(res == slabs_linear_clsid(sizes, largest, size));
+            assert(res - slabs_lookup_hint(&t, size) <= 2);
+        }
+
+        start = slabs_lookup_usec();
+        for (i = 0; i < lookups; i++) {
+            sum += slabs_lookup(&t, probe[i]);
+        }
+        table_usec = slabs_lookup_usec() - start;
+        start = slabs_lookup_usec();
+        for (i = 0; i < lookups; i++) {
+            sum -= slabs_linear_clsid(sizes, largest, probe[i]);
+        }
+        linear_usec = slabs_lookup_usec() - start;
+        assert(sum == 0);
+
+        printf("# factor %.2f: %u classes, table %.1f ns, linear %.1f ns "
+               "per lookup\n", factors[f], largest,
+               table_usec * 1000.0 / lookups, linear_usec * 1000.0 / lookups);
+    }
+
+    free(probe);
+    return TEST_PASS;
+}
+
 static enum test_return test_safe_strtoul(void) {
     uint32_t val;
     assert(safe_strtoul("123", &val));
@@ -253,6 +347,22 @@ static enum test_return test_safe_strtoll(void) {
     assert(val == 123);
     return TEST_PASS;
 }
+static enum test_return test_parse_cpu_list(void) {
+    int cpus[8];
+    assert(parse_cpu_list("3", cpus, 8) == 1);
+    assert(cpus[0] == 3);
+    assert(parse_cpu_list("4-6:1", cpus, 8) == 4);
+    assert(cpus[0] == 4 && cpus[1] == 5 && cpus[2] == 6 && cpus[3] == 1);
+    assert(parse_cpu_list("0-7", cpus, 8) == 8);
+    assert(parse_cpu_list("0-8", cpus, 8) == -1);  // too many
+    assert(parse_cpu_list("", cpus, 8) == -1);  // empty
+    assert(parse_cpu_list("2:", cpus, 8) == -1);
+    assert(parse_cpu_list("5-2", cpus, 8) == -1);  // backwards
+    assert(parse_cpu_list("1,2", cpus, 8) == -1);  // wrong separator
+    assert(parse_cpu_list("-1", cpus, 8) == -1);
+    assert(parse_cpu_list("1024", cpus, 8) == -1);  // past CPU_LIST_MAX
+    return TEST_PASS;
+}
 
 static enum test_return test_safe_strtol(void) {
     int32_t val;
@@ -1889,10 +1999,12 @@ struct testcase testcases[] = {
     { "cache_reuse", cache_reuse_test },
     { "cache_redzone", cache_redzone_test },
     { "issue_161", test_issue_161 },
+    { "slabs_lookup", test_slabs_lookup },
     { "strtol", test_safe_strtol },
     { "strtoll", test_safe_strtoll },
     { "strtoul", test_safe_strtoul },
     { "strtoull", test_safe_strtoull },
+    { "cpu_list", test_parse_cpu_list },
     { "issue_44", test_issue_44 },
     { "vperror", test_vperror },
     { "issue_101", test_issue_101 },
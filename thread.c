@@ -10,6 +10,10 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <fcntl.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 
 #ifdef __sun
 #include <atomic.h>
@@ -25,6 +29,10 @@ struct conn_queue_item {
     int               event_flags;
     int               read_buffer_size;
     enum network_transport     transport;
+    /* Connection being handed back, or NULL for a new one. The type has
+     * to travel with the item: pushes and wakeups from several threads
+     * can interleave, so a wakeup says nothing about which item it's for. */
+    conn             *c;
     CQ_ITEM          *next;
 };
 
@@ -54,6 +62,8 @@ static CQ_ITEM *cqi_freelist;
 static pthread_mutex_t cqi_freelist_lock;
 
 static pthread_mutex_t *item_locks;
+/* when each item lock was taken, for the lock profiler */
+static uint64_t *item_locks_at;
 /* size of the item lock hash table */
 static uint32_t item_lock_count;
 static unsigned int item_lock_hashpower;
@@ -67,8 +77,9 @@ static pthread_key_t item_lock_type_key;
 static LIBEVENT_DISPATCHER_THREAD dispatcher_thread;
 
 /*
- * Each libevent instance has a wakeup pipe, which other threads
- * can use to signal that they've put a new connection on its queue.
+ * Each libevent instance has a wakeup eventfd (or pipe), which other
+ * threads can use to signal that they've put a new connection on its
+ * queue.
  */
 static LIBEVENT_THREAD *threads;
 
@@ -84,6 +95,10 @@ static pthread_cond_t init_cond;
 
 
 static void thread_libevent_process(int fd, short which, void *arg);
+#ifdef USE_IO_URING
+static void thread_uring_process(int fd, short which, void *arg);
+#endif
+static bool notify_send(int send_fd);
 
 unsigned short refcount_incr(unsigned short *refcount) {
 #ifdef HAVE_GCC_ATOMICS
@@ -117,19 +132,21 @@ unsigned short refcount_decr(unsigned short *refcount) {
 
 /* Convenience functions for calling *only* when in ITEM_LOCK_GLOBAL mode */
 void item_lock_global(void) {
-    mutex_lock(&item_global_lock);
+    lockprof_lock(&item_global_lock, LOCKPROF_ITEM_LOCKS, NULL, true);
 }
 
 void item_unlock_global(void) {
-    mutex_unlock(&item_global_lock);
+    lockprof_unlock(&item_global_lock, LOCKPROF_ITEM_LOCKS, NULL);
 }
 
 void item_lock(uint32_t hv) {
     uint8_t *lock_type = pthread_getspecific(item_lock_type_key);
     if (likely(*lock_type == ITEM_LOCK_GRANULAR)) {
-        mutex_lock(&item_locks[hv & hashmask(item_lock_hashpower)]);
+        uint32_t lock = hv & hashmask(item_lock_hashpower);
+        lockprof_lock(&item_locks[lock], LOCKPROF_ITEM_LOCKS,
+                      &item_locks_at[lock], true);
     } else {
-        mutex_lock(&item_global_lock);
+        item_lock_global();
     }
 }
 
@@ -155,9 +172,11 @@ void item_trylock_unlock(void *lock) {
 void item_unlock(uint32_t hv) {
     uint8_t *lock_type = pthread_getspecific(item_lock_type_key);
     if (likely(*lock_type == ITEM_LOCK_GRANULAR)) {
-        mutex_unlock(&item_locks[hv & hashmask(item_lock_hashpower)]);
+        uint32_t lock = hv & hashmask(item_lock_hashpower);
+        lockprof_unlock(&item_locks[lock], LOCKPROF_ITEM_LOCKS,
+                        &item_locks_at[lock]);
     } else {
-        mutex_unlock(&item_global_lock);
+        item_unlock_global();
     }
 }
 
@@ -175,26 +194,19 @@ static void register_thread_initialized(void) {
 }
 
 void switch_item_lock_type(enum item_lock_types type) {
-    char buf[1];
     int i;
 
-    switch (type) {
-        case ITEM_LOCK_GRANULAR:
-            buf[0] = 'l';
-            break;
-        case ITEM_LOCK_GLOBAL:
-            buf[0] = 'g';
-            break;
-        default:
-            fprintf(stderr, "Unknown lock type: %d\n", type);
-            assert(1 == 0);
-            break;
+    if (type != ITEM_LOCK_GRANULAR && type != ITEM_LOCK_GLOBAL) {
+        fprintf(stderr, "Unknown lock type: %d\n", type);
+        assert(1 == 0);
     }
 
     pthread_mutex_lock(&init_lock);
     init_count = 0;
     for (i = 0; i < settings.num_threads; i++) {
-        if (write(threads[i].notify_send_fd, buf, 1) != 1) {
+        threads[i].lock_type_wanted = type;
+        threads[i].lock_type_switch = true;
+        if (!notify_send(threads[i].notify_send_fd)) {
             perror("Failed writing to notify pipe");
             /* TODO: This is a fatal problem. Can it ever happen temporarily? */
         }
@@ -233,18 +245,23 @@ static CQ_ITEM *cq_pop(CQ *cq) {
 }
 
 /*
- * Adds an item to a connection queue.
+ * Adds an item to a connection queue. Returns true if the queue was empty,
+ * when its thread needs a wakeup; otherwise one is already on its way, and
+ * the thread takes everything queued when it comes.
  */
-static void cq_push(CQ *cq, CQ_ITEM *item) {
+static bool cq_push(CQ *cq, CQ_ITEM *item) {
+    bool was_empty;
     item->next = NULL;
 
     pthread_mutex_lock(&cq->lock);
-    if (NULL == cq->tail)
+    was_empty = (NULL == cq->tail);
+    if (was_empty)
         cq->head = item;
     else
         cq->tail->next = item;
     cq->tail = item;
     pthread_mutex_unlock(&cq->lock);
+    return was_empty;
 }
 
 /*
@@ -285,6 +302,8 @@ static CQ_ITEM *cqi_new(void) {
         pthread_mutex_unlock(&cqi_freelist_lock);
     }
 
+    /* a recycled item must not carry a stale handoff */
+    item->c = NULL;
     return item;
 }
 
@@ -300,21 +319,120 @@ static void cqi_free(CQ_ITEM *item) {
 }
 
 
+/*
+ * Opens the fds a thread is woken through. An eventfd needs just one, and
+ * wakeups sent before the thread gets to it are read back as one. Where
+ * there is none, a pipe is used and all of it is read at once.
+ */
+static void notify_open(int *receive_fd, int *send_fd) {
+    int fds[2];
+
+#ifdef HAVE_EVENTFD
+    if ((fds[0] = eventfd(0, EFD_NONBLOCK)) != -1) {
+        *receive_fd = *send_fd = fds[0];
+        return;
+    }
+#endif
+    if (pipe(fds)) {
+        perror("Can't create notify pipe");
+        exit(1);
+    }
+    if (fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) < 0) {
+        perror("setting O_NONBLOCK");
+        exit(1);
+    }
+    *receive_fd = fds[0];
+    *send_fd = fds[1];
+}
+
+/* Wakes the thread. An eventfd takes exactly eight bytes; a pipe doesn't
+ * mind. */
+static bool notify_send(int send_fd) {
+    uint64_t u = 1;
+    return write(send_fd, &u, sizeof(u)) == sizeof(u);
+}
+
+/* Consumes every wakeup sent so far */
+static void notify_drain(int receive_fd) {
+    char buf[64];
+    while (read(receive_fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
 /*
  * Creates a worker thread.
  */
-static void create_worker(void *(*func)(void *), void *arg) {
+#ifdef CPU_PINNING
+/* Worker n runs on worker_cpus[n % nworker_cpus], with -o worker_cpus */
+static int worker_cpus[CPU_LIST_MAX];
+static int nworker_cpus;
+/* The cpus the process could use before housekeeping_cpus narrowed them */
+static cpu_set_t default_cpus;
+
+/*
+ * Pins the calling thread to -o housekeeping_cpus. Called before it starts
+ * any other thread, so all of them but the workers inherit the set.
+ */
+static void thread_pin_init(void) {
+    int cpus[CPU_LIST_MAX];
+    cpu_set_t set;
+    int i, n, ret;
+
+    CPU_ZERO(&default_cpus);
+    pthread_getaffinity_np(pthread_self(), sizeof(default_cpus),
+                           &default_cpus);
+    if (settings.worker_cpus != NULL) {
+        nworker_cpus = parse_cpu_list(settings.worker_cpus, worker_cpus,
+                                      CPU_LIST_MAX);
+    }
+    if (settings.housekeeping_cpus != NULL) {
+        n = parse_cpu_list(settings.housekeeping_cpus, cpus, CPU_LIST_MAX);
+        CPU_ZERO(&set);
+        for (i = 0; i < n; i++)
+            CPU_SET(cpus[i], &set);
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set),
+                                          &set)) != 0) {
+            fprintf(stderr, "Can't pin housekeeping threads: %s\n",
+                    strerror(ret));
+        }
+    }
+}
+#endif
+
+/*
+ * Starts a thread. Worker n (from 0) is pinned as -o worker_cpus asks, or
+ * may run anywhere; other threads pass -1 to share the starting thread's
+ * cpus.
+ */
+static void create_worker(void *(*func)(void *), void *arg, int worker) {
     pthread_t       thread;
     pthread_attr_t  attr;
     int             ret;
 
     pthread_attr_init(&attr);
 
+#ifdef CPU_PINNING
+    /* set before it starts, so it never runs on the housekeeping cpus */
+    if (worker >= 0 && (nworker_cpus > 0 || settings.housekeeping_cpus)) {
+        cpu_set_t set = default_cpus;
+        if (nworker_cpus > 0) {
+            CPU_ZERO(&set);
+            CPU_SET(worker_cpus[worker % nworker_cpus], &set);
+        }
+        if ((ret = pthread_attr_setaffinity_np(&attr, sizeof(set),
+                                               &set)) != 0) {
+            fprintf(stderr, "Can't pin worker thread %d: %s\n", worker,
+                    strerror(ret));
+        }
+    }
+#endif
+
     if ((ret = pthread_create(&thread, &attr, func, arg)) != 0) {
         fprintf(stderr, "Can't create thread: %s\n",
                 strerror(ret));
         exit(1);
     }
+    pthread_attr_destroy(&attr);
 }
 
 /*
@@ -354,29 +472,37 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     }
     cq_init(me->new_conn_queue);
 
-    if (pthread_mutex_init(&me->stats.mutex, NULL) != 0) {
-        perror("Failed to initialize mutex");
-        exit(EXIT_FAILURE);
-    }
-
     me->suffix_cache = cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
                                     NULL, NULL);
     if (me->suffix_cache == NULL) {
         fprintf(stderr, "Failed to create suffix cache\n");
         exit(EXIT_FAILURE);
     }
+
+#ifdef USE_IO_URING
+    if (settings.io_uring) {
+        me->ring = uring_new(URING_ENTRIES, URING_BUFS, URING_BUF_SIZE);
+        if (me->ring == NULL) {
+            fprintf(stderr, "Can't set up io_uring with provided buffers\n");
+            exit(EXIT_FAILURE);
+        }
+        /* the ring's fd turns readable when it holds completions */
+        event_set(&me->ring_event, uring_fd(me->ring),
+                  EV_READ | EV_PERSIST, thread_uring_process, me);
+        event_base_set(me->base, &me->ring_event);
+        if (event_add(&me->ring_event, 0) == -1) {
+            fprintf(stderr, "Can't monitor io_uring\n");
+            exit(1);
+        }
+    }
+#endif
 }
 
 /*
- * Worker thread: main event loop
+ * Per-thread setup, shared by both worker loops; thread_init() will block
+ * until all threads have finished initializing.
  */
-static void *worker_libevent(void *arg) {
-    LIBEVENT_THREAD *me = arg;
-
-    /* Any per-thread setup can happen here; thread_init() will block until
-     * all threads have finished initializing.
-     */
-
+static void worker_setup(LIBEVENT_THREAD *me) {
     /* set an indexable thread-specific memory item for the lock type.
      * this could be unnecessary if we pass the conn *c struct through
      * all item_lock calls...
@@ -384,34 +510,105 @@ static void *worker_libevent(void *arg) {
     me->item_lock_type = ITEM_LOCK_GRANULAR;
     pthread_setspecific(item_lock_type_key, &me->item_lock_type);
 
+    /* for the load sampler; thread_init() waits for us before it returns */
+    me->thread_id = pthread_self();
+
     register_thread_initialized();
+}
+
+/*
+ * Worker thread: main event loop
+ */
+static void *worker_libevent(void *arg) {
+    LIBEVENT_THREAD *me = arg;
+
+    worker_setup(me);
 
     event_base_loop(me->base, 0);
     return NULL;
 }
 
+static uint64_t busy_poll_usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * A worker's loop with -o busy_poll. After any work it keeps polling its
+ * events without blocking for that many microseconds, so a request that
+ * comes in meanwhile is picked up without a wakeup, and only then sleeps
+ * in epoll_wait(). Whether a poll found work is told by me->events, which
+ * every callback the loop runs bumps.
+ */
+static void *worker_libevent_busy_poll(void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    uint64_t seen, until;
+
+    worker_setup(me);
+
+    for (;;) {
+        event_base_loop(me->base, EVLOOP_ONCE);
+        seen = me->events;
+        until = busy_poll_usec() + settings.busy_poll;
+        while (busy_poll_usec() < until) {
+            event_base_loop(me->base, EVLOOP_NONBLOCK);
+            if (me->events != seen) {
+                THREAD_STATS_ADD(me, busy_poll_hits, 1);
+                seen = me->events;
+                until = busy_poll_usec() + settings.busy_poll;
+            }
+        }
+    }
+    return NULL;
+}
+
 
 /*
- * Processes an incoming "handle a new connection" item. This is called when
- * input arrives on the libevent wakeup pipe.
+ * Handles everything other threads have left for this one: requests in its
+ * flags, then every item on its connection queue. This is called when the
+ * wakeup eventfd or pipe becomes readable, however many wakeups were sent.
  */
 static void thread_libevent_process(int fd, short which, void *arg) {
     LIBEVENT_THREAD *me = arg;
     CQ_ITEM *item;
-    char buf[1];
 
-    if (read(fd, buf, 1) != 1)
-        if (settings.verbose > 0)
-            fprintf(stderr, "Can't read from libevent pipe\n");
+    me->events++;
+    notify_drain(fd);
 
-    switch (buf[0]) {
-    case 'c':
-    item = cq_pop(me->new_conn_queue);
+    /* we were told to flip the lock type and report in */
+    if (me->lock_type_switch) {
+        me->lock_type_switch = false;
+        me->item_lock_type = me->lock_type_wanted;
+        register_thread_initialized();
+    }
+
+    /* accepting was switched on or off; update our listeners */
+    if (me->listen_update) {
+        me->listen_update = false;
+        update_listen_conns(me);
+    }
+
+    if (me->idle_scan) {
+        me->idle_scan = false;
+        conn_idle_scan(me);
+    }
+
+    while ((item = cq_pop(me->new_conn_queue)) != NULL) {
+        if (item->c != NULL) {
+            /* a connection some other thread borrowed is coming back */
+            conn_worker_readd(item->c);
+            cqi_free(item);
+            continue;
+        }
 
-    if (NULL != item) {
         conn *c = conn_new(item->sfd, item->init_state, item->event_flags,
                            item->read_buffer_size, item->transport, me->base);
         if (c == NULL) {
+            if (item->init_state != conn_listening &&
+                !IS_UDP(item->transport)) {
+                THR_CONNS_ADD(me, -1);
+            }
             if (IS_UDP(item->transport)) {
                 fprintf(stderr, "Can't listen for events on UDP socket\n");
                 exit(1);
@@ -424,25 +621,159 @@ static void thread_libevent_process(int fd, short which, void *arg) {
             }
         } else {
             c->thread = me;
+            if (item->init_state == conn_listening) {
+                add_listen_conn(c);
+            } else if (!IS_UDP(item->transport)) {
+                THR_STATS_INCR(c, accepts);
+                conn_thread_link(c);
+#ifdef USE_IO_URING
+                if (me->ring != NULL)
+                    conn_uring_start(c);
+#endif
+            }
         }
         cqi_free(item);
     }
-        break;
-    /* we were told to flip the lock type and report in */
-    case 'l':
-    me->item_lock_type = ITEM_LOCK_GRANULAR;
-    register_thread_initialized();
-        break;
-    case 'g':
-    me->item_lock_type = ITEM_LOCK_GLOBAL;
-    register_thread_initialized();
-        break;
+
+#ifdef USE_IO_URING
+    if (me->ring != NULL)
+        thread_uring_submit(me);
+#endif
+}
+
+#ifdef USE_IO_URING
+/*
+ * Hands the kernel every request the thread's connections queued since the
+ * last call, in one system call.
+ */
+void thread_uring_submit(LIBEVENT_THREAD *me) {
+    if (uring_submit(me->ring) > 0)
+        THREAD_STATS_ADD(me, io_uring_enters, 1);
+}
+
+/*
+ * Runs the connections whose ring requests finished, then submits what
+ * they queued in turn. Sends mostly finish inside the submit, so a few
+ * rounds go by before returning to libevent.
+ */
+static void thread_uring_process(int fd, short which, void *arg) {
+    LIBEVENT_THREAD *me = arg;
+    int rounds = 0;
+    int n;
+
+    me->events++;
+
+    do {
+        n = uring_reap(me->ring, conn_uring_complete);
+        THREAD_STATS_ADD(me, io_uring_completions, n);
+        thread_uring_submit(me);
+    } while (n > 0 && ++rounds < 4);
+}
+#endif
+
+/*
+ * Returns a connection to the worker thread that owns it, after another
+ * thread (the LRU crawler, for a metadump) has been writing to its socket.
+ */
+void redispatch_conn(conn *c) {
+    CQ_ITEM *item = cqi_new();
+    if (item == NULL) {
+        /* Can't cross threads without the queue; the socket is stranded
+         * until the client gives up on it. */
+        fprintf(stderr, "Failed to allocate memory for connection redispatch\n");
+        return;
+    }
+    LIBEVENT_THREAD *thread = c->thread;
+
+    item->sfd = c->sfd;
+    item->c = c;
+
+    if (cq_push(thread->new_conn_queue, item) &&
+        !notify_send(thread->notify_send_fd)) {
+        perror("Writing to thread notify pipe");
+    }
+}
+
+/*
+ * Hands a TCP connection that sits between requests to the thread the load
+ * balancer asked its owner to shed one to (see threadlocal_load_update).
+ * Called on the owning thread. Returns false if the connection stays.
+ */
+bool conn_migrate(conn *c) {
+    LIBEVENT_THREAD *from = c->thread;
+    int to = from->migrate_to;
+    CQ_ITEM *item;
+
+    if (to < 0 || threads + to == from || IS_UDP(c->transport) ||
+        c->rbytes > 0) {
+        return false;
+    }
+    from->migrate_to = -1;
+
+    if ((item = cqi_new()) == NULL) {
+        return false;
+    }
+
+    event_del(&c->event);
+    if (settings.conn_buffer_pool)
+        conn_buffers_release(c);
+    THR_STATS_INCR(c, migrations);
+    conn_thread_unlink(c);
+    THR_CONNS_ADD(from, -1);
+    c->thread = threads + to;
+    THR_CONNS_ADD(c->thread, 1);
+
+    item->sfd = c->sfd;
+    item->c = c;
+    if (cq_push(c->thread->new_conn_queue, item) &&
+        !notify_send(c->thread->notify_send_fd)) {
+        perror("Writing to thread notify pipe");
+    }
+    return true;
+}
+
+/*
+ * Asks a worker that owns listening sockets to bring their events in line
+ * with accept_new_conns().
+ */
+void notify_listen_thread(LIBEVENT_THREAD *thread) {
+    thread->listen_update = true;
+    if (!notify_send(thread->notify_send_fd)) {
+        perror("Writing to thread notify pipe");
     }
 }
 
 /* Which thread we assigned a connection to most recently. */
 static int last_thread = -1;
 
+/* Busy times this close, in permille of a cpu, count as equal */
+#define PLACE_BUSY_SLACK 50
+
+/*
+ * Picks the worker that used the least cpu over the last second, and of
+ * those the one with the fewest connections. Ties go round robin.
+ */
+static int least_loaded_thread(void) {
+    int best = -1;
+    unsigned int best_busy = 0;
+    int best_conns = 0;
+    int n;
+
+    for (n = 1; n <= settings.num_threads; n++) {
+        int tid = (last_thread + n) % settings.num_threads;
+        unsigned int busy = threads[tid].busy / PLACE_BUSY_SLACK;
+        int conns = THR_CONNS_READ(&threads[tid]);
+
+        if (best < 0 || busy < best_busy ||
+            (busy == best_busy && conns < best_conns)) {
+            best = tid;
+            best_busy = busy;
+            best_conns = conns;
+        }
+    }
+    return best;
+}
+
 /*
  * Dispatches a new connection to another thread. This is only ever called
  * from the main thread, either during initialization (for UDP) or because
@@ -451,7 +782,7 @@ static int last_thread = -1;
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport) {
     CQ_ITEM *item = cqi_new();
-    char buf[1];
+    bool wake;
     if (item == NULL) {
         close(sfd);
         /* given that malloc failed this may also fail, but let's try */
@@ -459,23 +790,34 @@ void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
         return ;
     }
 
-    int tid = (last_thread + 1) % settings.num_threads;
+    bool client = init_state != conn_listening && !IS_UDP(transport);
+    int tid;
+
+    if (client && settings.conn_placement == PLACE_LEAST_LOADED) {
+        tid = least_loaded_thread();
+    } else {
+        tid = (last_thread + 1) % settings.num_threads;
+    }
 
     LIBEVENT_THREAD *thread = threads + tid;
 
     last_thread = tid;
+    if (client) {
+        /* counted now, so a burst of accepts doesn't all pick one thread */
+        THR_CONNS_ADD(thread, 1);
+    }
 
     item->sfd = sfd;
     item->init_state = init_state;
     item->event_flags = event_flags;
     item->read_buffer_size = read_buffer_size;
     item->transport = transport;
+    item->c = NULL;
 
-    cq_push(thread->new_conn_queue, item);
+    wake = cq_push(thread->new_conn_queue, item);
 
     MEMCACHED_CONN_DISPATCH(sfd, thread->thread_id);
-    buf[0] = 'c';
-    if (write(thread->notify_send_fd, buf, 1) != 1) {
+    if (wake && !notify_send(thread->notify_send_fd)) {
         perror("Writing to thread notify pipe");
     }
 }
@@ -618,9 +960,9 @@ enum store_item_type store_item(item *item, int comm, conn* c) {
  * Flushes expired items after a flush_all call
  */
 void item_flush_expired() {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_item_flush_expired();
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 /*
@@ -629,9 +971,9 @@ void item_flush_expired() {
 char *item_cachedump(unsigned int slabs_clsid, unsigned int limit, unsigned int *bytes) {
     char *ret;
 
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     ret = do_item_cachedump(slabs_clsid, limit, bytes);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
     return ret;
 }
 
@@ -639,117 +981,294 @@ char *item_cachedump(unsigned int slabs_clsid, unsigned int limit, unsigned int
  * Dumps statistics about slab classes
  */
 void  item_stats(ADD_STAT add_stats, void *c) {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_item_stats(add_stats, c);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 void  item_stats_totals(ADD_STAT add_stats, void *c) {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_item_stats_totals(add_stats, c);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 /*
  * Dumps a list of objects of each size in 32-byte increments
  */
 void  item_stats_sizes(ADD_STAT add_stats, void *c) {
-    mutex_lock(&cache_lock);
+    CACHE_LOCK();
     do_item_stats_sizes(add_stats, c);
-    mutex_unlock(&cache_lock);
+    CACHE_UNLOCK();
 }
 
 /******************************* GLOBAL STATS ******************************/
 
 void STATS_LOCK() {
-    pthread_mutex_lock(&stats_lock);
+    lockprof_lock(&stats_lock, LOCKPROF_STATS_LOCK, NULL, false);
 }
 
 void STATS_UNLOCK() {
-    pthread_mutex_unlock(&stats_lock);
+    lockprof_unlock(&stats_lock, LOCKPROF_STATS_LOCK, NULL);
+}
+
+#ifdef __ATOMIC_RELAXED
+#define THR_STATS_READ(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#else
+#define THR_STATS_READ(v) (v)
+#endif
+
+/* Serializes "stats reset" against aggregation over stats_base. The
+ * counters themselves are never locked. */
+static pthread_mutex_t stats_base_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copies a worker's live counters while the worker keeps updating them. */
+static void threadlocal_stats_copy(struct thread_stats *out,
+                                   struct thread_stats *in) {
+    int sid;
+
+    out->get_cmds = THR_STATS_READ(in->get_cmds);
+    out->get_misses = THR_STATS_READ(in->get_misses);
+    out->touch_cmds = THR_STATS_READ(in->touch_cmds);
+    out->touch_misses = THR_STATS_READ(in->touch_misses);
+    out->delete_misses = THR_STATS_READ(in->delete_misses);
+    out->incr_misses = THR_STATS_READ(in->incr_misses);
+    out->decr_misses = THR_STATS_READ(in->decr_misses);
+    out->cas_misses = THR_STATS_READ(in->cas_misses);
+    out->bytes_read = THR_STATS_READ(in->bytes_read);
+    out->bytes_written = THR_STATS_READ(in->bytes_written);
+    out->flush_cmds = THR_STATS_READ(in->flush_cmds);
+    out->conn_yields = THR_STATS_READ(in->conn_yields);
+    out->auth_cmds = THR_STATS_READ(in->auth_cmds);
+    out->auth_errors = THR_STATS_READ(in->auth_errors);
+    out->accepts = THR_STATS_READ(in->accepts);
+    out->requests = THR_STATS_READ(in->requests);
+    out->migrations = THR_STATS_READ(in->migrations);
+    out->zerocopy_sends = THR_STATS_READ(in->zerocopy_sends);
+    out->zerocopy_bytes = THR_STATS_READ(in->zerocopy_bytes);
+    out->zerocopy_copied = THR_STATS_READ(in->zerocopy_copied);
+    out->zerocopy_fallbacks = THR_STATS_READ(in->zerocopy_fallbacks);
+    out->zerocopy_completions = THR_STATS_READ(in->zerocopy_completions);
+    out->zerocopy_completion_usec =
+        THR_STATS_READ(in->zerocopy_completion_usec);
+    out->io_uring_enters = THR_STATS_READ(in->io_uring_enters);
+    out->io_uring_completions = THR_STATS_READ(in->io_uring_completions);
+    out->idle_kicks = THR_STATS_READ(in->idle_kicks);
+    out->busy_poll_hits = THR_STATS_READ(in->busy_poll_hits);
+
+    for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
+        out->slab_stats[sid].set_cmds =
+            THR_STATS_READ(in->slab_stats[sid].set_cmds);
+        out->slab_stats[sid].get_hits =
+            THR_STATS_READ(in->slab_stats[sid].get_hits);
+        out->slab_stats[sid].touch_hits =
+            THR_STATS_READ(in->slab_stats[sid].touch_hits);
+        out->slab_stats[sid].delete_hits =
+            THR_STATS_READ(in->slab_stats[sid].delete_hits);
+        out->slab_stats[sid].incr_hits =
+            THR_STATS_READ(in->slab_stats[sid].incr_hits);
+        out->slab_stats[sid].decr_hits =
+            THR_STATS_READ(in->slab_stats[sid].decr_hits);
+        out->slab_stats[sid].cas_hits =
+            THR_STATS_READ(in->slab_stats[sid].cas_hits);
+        out->slab_stats[sid].cas_badval =
+            THR_STATS_READ(in->slab_stats[sid].cas_badval);
+    }
 }
 
+/* Only the owning thread may write its counters, so a reset doesn't zero
+ * them. It records where they stood instead, and aggregation subtracts
+ * that. */
 void threadlocal_stats_reset(void) {
-    int ii, sid;
+    int ii;
+    pthread_mutex_lock(&stats_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        threads[ii].stats.get_cmds = 0;
-        threads[ii].stats.get_misses = 0;
-        threads[ii].stats.touch_cmds = 0;
-        threads[ii].stats.touch_misses = 0;
-        threads[ii].stats.delete_misses = 0;
-        threads[ii].stats.incr_misses = 0;
-        threads[ii].stats.decr_misses = 0;
-        threads[ii].stats.cas_misses = 0;
-        threads[ii].stats.bytes_read = 0;
-        threads[ii].stats.bytes_written = 0;
-        threads[ii].stats.flush_cmds = 0;
-        threads[ii].stats.conn_yields = 0;
-        threads[ii].stats.auth_cmds = 0;
-        threads[ii].stats.auth_errors = 0;
-
-        for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            threads[ii].stats.slab_stats[sid].set_cmds = 0;
-            threads[ii].stats.slab_stats[sid].get_hits = 0;
-            threads[ii].stats.slab_stats[sid].touch_hits = 0;
-            threads[ii].stats.slab_stats[sid].delete_hits = 0;
-            threads[ii].stats.slab_stats[sid].incr_hits = 0;
-            threads[ii].stats.slab_stats[sid].decr_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_badval = 0;
+        threadlocal_stats_copy(&threads[ii].stats_base, &threads[ii].stats);
+    }
+    pthread_mutex_unlock(&stats_base_lock);
+}
+
+/* Per worker counters, for "stats threads" */
+void threadlocal_stats_threads(ADD_STAT add_stats, void *c) {
+    char key_str[STAT_KEY_LEN];
+    char val_str[STAT_VAL_LEN];
+    int klen = 0, vlen = 0;
+    int ii;
+
+    pthread_mutex_lock(&stats_base_lock);
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        LIBEVENT_THREAD *t = &threads[ii];
+        uint64_t accepts = THR_STATS_READ(t->stats.accepts) -
+            t->stats_base.accepts;
+        uint64_t migrations = THR_STATS_READ(t->stats.migrations) -
+            t->stats_base.migrations;
+        APPEND_NUM_STAT(ii, "accepts", "%llu", (unsigned long long)accepts);
+        APPEND_NUM_STAT(ii, "curr_connections", "%d", THR_CONNS_READ(t));
+        APPEND_NUM_STAT(ii, "requests_per_sec", "%u", t->rps);
+        APPEND_NUM_STAT(ii, "busy_percent", "%.1f", t->busy / 10.0);
+        APPEND_NUM_STAT(ii, "migrations", "%llu",
+                        (unsigned long long)migrations);
+    }
+    pthread_mutex_unlock(&stats_base_lock);
+}
+
+/* CPU time a worker has used, in nanoseconds, or 0 if we can't tell */
+static uint64_t thread_cpu_ns(pthread_t thread_id) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(_POSIX_THREAD_CPUTIME)
+    clockid_t cid;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid(thread_id, &cid) == 0 &&
+        clock_gettime(cid, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/* Load gap, in permille of a cpu, worth moving a connection over */
+#define MIGRATE_BUSY_GAP 200
+
+/*
+ * Samples each worker's cpu time and request count. Called once a second
+ * from the clock handler, so reading the load costs the request path
+ * nothing. With conn_migrate, also asks the busiest worker to hand one of
+ * its connections to the idlest.
+ */
+void threadlocal_load_update(void) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    static uint64_t last_ns = 0;
+    struct timespec ts;
+    uint64_t now_ns, elapsed;
+    int hot = -1, cool = -1;
+    int ii;
+
+    if (threads == NULL || clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return;
+    now_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    elapsed = now_ns - last_ns;
+
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        LIBEVENT_THREAD *t = &threads[ii];
+        uint64_t cpu_ns = thread_cpu_ns(t->thread_id);
+        uint64_t requests = THR_STATS_READ(t->stats.requests);
+
+        if (last_ns != 0 && elapsed > 0) {
+            t->busy = (cpu_ns - t->load_cpu_ns) * 1000 / elapsed;
+            t->rps = (requests - t->load_requests) * 1000000000 / elapsed;
+        }
+        t->load_cpu_ns = cpu_ns;
+        t->load_requests = requests;
+        t->migrate_to = -1;
+
+        if (hot < 0 || t->busy > threads[hot].busy)
+            hot = ii;
+        if (cool < 0 || t->busy < threads[cool].busy)
+            cool = ii;
+    }
+    last_ns = now_ns;
+
+    if (settings.conn_migrate && hot != cool) {
+        unsigned int gap = threads[hot].busy - threads[cool].busy;
+        int conns = THR_CONNS_READ(&threads[hot]);
+        /* Only if an average connection's share of the load, moved over,
+         * narrows the gap rather than just swapping the two threads */
+        if (gap >= MIGRATE_BUSY_GAP && conns > 1 &&
+            gap > 2 * threads[hot].busy / conns) {
+            threads[hot].migrate_to = cool;
         }
+    }
+#endif
+}
+
+/*
+ * Asks every worker to look for connections past -o idle_timeout. Called
+ * once a second from the clock handler; each worker scans its own.
+ */
+void threadlocal_idle_scan(void) {
+    int ii;
 
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
+    if (threads == NULL)
+        return;
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        threads[ii].idle_scan = true;
+        if (!notify_send(threads[ii].notify_send_fd)) {
+            perror("Writing to thread notify pipe");
+        }
+    }
+}
+
+/* Buffer sets held by connections, and kept in pools, over all workers */
+void threadlocal_conn_buffers(int *attached, int *pooled) {
+    int ii;
+
+    *attached = *pooled = 0;
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        *attached += threads[ii].bufs_attached;
+        *pooled += threads[ii].buf_pool_count;
     }
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *stats) {
     int ii, sid;
+    struct thread_stats now;
+    struct thread_stats *cur = &now;
 
-    /* The struct has a mutex, but we can safely set the whole thing
-     * to zero since it is unused when aggregating. */
     memset(stats, 0, sizeof(*stats));
 
+    pthread_mutex_lock(&stats_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        stats->get_cmds += threads[ii].stats.get_cmds;
-        stats->get_misses += threads[ii].stats.get_misses;
-        stats->touch_cmds += threads[ii].stats.touch_cmds;
-        stats->touch_misses += threads[ii].stats.touch_misses;
-        stats->delete_misses += threads[ii].stats.delete_misses;
-        stats->decr_misses += threads[ii].stats.decr_misses;
-        stats->incr_misses += threads[ii].stats.incr_misses;
-        stats->cas_misses += threads[ii].stats.cas_misses;
-        stats->bytes_read += threads[ii].stats.bytes_read;
-        stats->bytes_written += threads[ii].stats.bytes_written;
-        stats->flush_cmds += threads[ii].stats.flush_cmds;
-        stats->conn_yields += threads[ii].stats.conn_yields;
-        stats->auth_cmds += threads[ii].stats.auth_cmds;
-        stats->auth_errors += threads[ii].stats.auth_errors;
+        struct thread_stats *base = &threads[ii].stats_base;
+        threadlocal_stats_copy(cur, &threads[ii].stats);
+
+        stats->get_cmds += cur->get_cmds - base->get_cmds;
+        stats->get_misses += cur->get_misses - base->get_misses;
+        stats->touch_cmds += cur->touch_cmds - base->touch_cmds;
+        stats->touch_misses += cur->touch_misses - base->touch_misses;
+        stats->delete_misses += cur->delete_misses - base->delete_misses;
+        stats->decr_misses += cur->decr_misses - base->decr_misses;
+        stats->incr_misses += cur->incr_misses - base->incr_misses;
+        stats->cas_misses += cur->cas_misses - base->cas_misses;
+        stats->bytes_read += cur->bytes_read - base->bytes_read;
+        stats->bytes_written += cur->bytes_written - base->bytes_written;
+        stats->flush_cmds += cur->flush_cmds - base->flush_cmds;
+        stats->conn_yields += cur->conn_yields - base->conn_yields;
+        stats->auth_cmds += cur->auth_cmds - base->auth_cmds;
+        stats->auth_errors += cur->auth_errors - base->auth_errors;
+        stats->zerocopy_sends += cur->zerocopy_sends - base->zerocopy_sends;
+        stats->zerocopy_bytes += cur->zerocopy_bytes - base->zerocopy_bytes;
+        stats->zerocopy_copied += cur->zerocopy_copied - base->zerocopy_copied;
+        stats->zerocopy_fallbacks +=
+            cur->zerocopy_fallbacks - base->zerocopy_fallbacks;
+        stats->zerocopy_completions +=
+            cur->zerocopy_completions - base->zerocopy_completions;
+        stats->zerocopy_completion_usec +=
+            cur->zerocopy_completion_usec - base->zerocopy_completion_usec;
+        stats->io_uring_enters += cur->io_uring_enters - base->io_uring_enters;
+        stats->io_uring_completions +=
+            cur->io_uring_completions - base->io_uring_completions;
+        stats->idle_kicks += cur->idle_kicks - base->idle_kicks;
+        stats->busy_poll_hits += cur->busy_poll_hits - base->busy_poll_hits;
 
         for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             stats->slab_stats[sid].set_cmds +=
-                threads[ii].stats.slab_stats[sid].set_cmds;
+                cur->slab_stats[sid].set_cmds - base->slab_stats[sid].set_cmds;
             stats->slab_stats[sid].get_hits +=
-                threads[ii].stats.slab_stats[sid].get_hits;
+                cur->slab_stats[sid].get_hits - base->slab_stats[sid].get_hits;
             stats->slab_stats[sid].touch_hits +=
-                threads[ii].stats.slab_stats[sid].touch_hits;
+                cur->slab_stats[sid].touch_hits - base->slab_stats[sid].touch_hits;
             stats->slab_stats[sid].delete_hits +=
-                threads[ii].stats.slab_stats[sid].delete_hits;
+                cur->slab_stats[sid].delete_hits - base->slab_stats[sid].delete_hits;
             stats->slab_stats[sid].decr_hits +=
-                threads[ii].stats.slab_stats[sid].decr_hits;
+                cur->slab_stats[sid].decr_hits - base->slab_stats[sid].decr_hits;
             stats->slab_stats[sid].incr_hits +=
-                threads[ii].stats.slab_stats[sid].incr_hits;
+                cur->slab_stats[sid].incr_hits - base->slab_stats[sid].incr_hits;
             stats->slab_stats[sid].cas_hits +=
-                threads[ii].stats.slab_stats[sid].cas_hits;
+                cur->slab_stats[sid].cas_hits - base->slab_stats[sid].cas_hits;
             stats->slab_stats[sid].cas_badval +=
-                threads[ii].stats.slab_stats[sid].cas_badval;
+                cur->slab_stats[sid].cas_badval - base->slab_stats[sid].cas_badval;
         }
-
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
     }
+    pthread_mutex_unlock(&stats_base_lock);
 }
 
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
@@ -795,6 +1314,10 @@ void thread_init(int nthreads, struct event_base *main_base) {
     pthread_mutex_init(&cqi_freelist_lock, NULL);
     cqi_freelist = NULL;
 
+#ifdef CPU_PINNING
+    thread_pin_init();
+#endif
+
     /* Want a wide lock table, but don't waste memory */
     if (nthreads < 3) {
         power = 10;
@@ -811,7 +1334,8 @@ void thread_init(int nthreads, struct event_base *main_base) {
     item_lock_hashpower = power;
 
     item_locks = calloc(item_lock_count, sizeof(pthread_mutex_t));
-    if (! item_locks) {
+    item_locks_at = calloc(item_lock_count, sizeof(uint64_t));
+    if (! item_locks || ! item_locks_at) {
         perror("Can't allocate item locks");
         exit(1);
     }
@@ -821,33 +1345,34 @@ void thread_init(int nthreads, struct event_base *main_base) {
     pthread_key_create(&item_lock_type_key, NULL);
     pthread_mutex_init(&item_global_lock, NULL);
 
-    threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
-    if (! threads) {
+    /* Each thread's stats start on a cache line of their own. */
+    if (posix_memalign((void **)&threads, CACHE_LINE_SIZE,
+                       nthreads * sizeof(LIBEVENT_THREAD)) != 0) {
         perror("Can't allocate thread descriptors");
         exit(1);
     }
+    memset(threads, 0, nthreads * sizeof(LIBEVENT_THREAD));
 
     dispatcher_thread.base = main_base;
     dispatcher_thread.thread_id = pthread_self();
 
     for (i = 0; i < nthreads; i++) {
-        int fds[2];
-        if (pipe(fds)) {
-            perror("Can't create notify pipe");
-            exit(1);
-        }
-
-        threads[i].notify_receive_fd = fds[0];
-        threads[i].notify_send_fd = fds[1];
+        notify_open(&threads[i].notify_receive_fd, &threads[i].notify_send_fd);
+        threads[i].migrate_to = -1;
 
         setup_thread(&threads[i]);
-        /* Reserve three fds for the libevent base, and two for the pipe */
-        stats.reserved_fds += 5;
+        /* Reserve three fds for the libevent base, the notify fds and
+         * the ring */
+        stats.reserved_fds += threads[i].notify_receive_fd ==
+            threads[i].notify_send_fd ? 4 : 5;
+        if (threads[i].ring != NULL)
+            stats.reserved_fds++;
     }
 
     /* Create threads after we've done all the libevent setup. */
     for (i = 0; i < nthreads; i++) {
-        create_worker(worker_libevent, &threads[i]);
+        create_worker(settings.busy_poll > 0 ? worker_libevent_busy_poll :
+                      worker_libevent, &threads[i], i);
     }
 
     /* Wait for all the threads to set themselves up before returning. */
@@ -886,16 +1411,20 @@ static LQ_ITEM *lq_pop(LQ *lq) {
     return item;
 }
 
-void lq_push(LQ *lq, LQ_ITEM *item) {
+/* Like cq_push(), true when the queue was empty and needs a wakeup */
+bool lq_push(LQ *lq, LQ_ITEM *item) {
+    bool was_empty;
     item->next = NULL;
 
     pthread_mutex_lock(&lq->lock);
-    if (NULL == lq->tail)
+    was_empty = (NULL == lq->tail);
+    if (was_empty)
         lq->head = item;
     else
         lq->tail->next = item;
     lq->tail = item;
     pthread_mutex_unlock(&lq->lock);
+    return was_empty;
 }
 
 LQ_ITEM *lqi_new(void) {
@@ -933,7 +1462,8 @@ LQ_ITEM *lqi_new(void) {
 static void lqi_free(LQ_ITEM *item) {
     pthread_mutex_lock(&lqi_freelist_lock);
 	if (item->item != NULL) {
-		free(item);
+		free(item->item);
+		item->item = NULL;
 	}
     item->next = lqi_freelist;
     lqi_freelist = item;
@@ -954,14 +1484,8 @@ void log_thread_init(struct event_base *main_base) {
     }
 
     for (i = 0; i < nthreads; i++) {
-        int fds[2];
-        if (pipe(fds)) {
-            perror("Can't create notify pipe");
-            exit(1);
-        }
-
-        log_threads[i].notify_receive_fd = fds[0];
-        log_threads[i].notify_send_fd = fds[1];
+        notify_open(&log_threads[i].notify_receive_fd,
+                    &log_threads[i].notify_send_fd);
 		path = calloc(512, sizeof(char));
 		sprintf(path, "%s/log_%d", settings.persisted_data_path, i);
 		log_threads[i].log_filepath = path;
@@ -970,13 +1494,14 @@ void log_thread_init(struct event_base *main_base) {
 		pthread_mutex_init(&log_threads[i].log_file_lock, NULL);
 
         setup_log_thread(&log_threads[i]);
-        /* Reserve three fds for the libevent base, and two for the pipe */
-        stats.reserved_fds += 5;
+        /* Reserve three fds for the libevent base, and the notify fds */
+        stats.reserved_fds += log_threads[i].notify_receive_fd ==
+            log_threads[i].notify_send_fd ? 4 : 5;
     }
 
     /* Create threads after we've done all the libevent setup. */
     for (i = 0; i < nthreads; i++) {
-        create_worker(worker_libevent, &log_threads[i]);
+        create_worker(worker_libevent, &log_threads[i], -1);
     }
 
     /* Wait for all the threads to set themselves up before returning. */
@@ -1014,11 +1539,6 @@ void setup_log_thread(LIBEVENT_LOG_THREAD *me) {
     }
     lq_init(me->new_log_queue);
 
-    if (pthread_mutex_init(&me->stats.mutex, NULL) != 0) {
-        perror("Failed to initialize mutex");
-        exit(EXIT_FAILURE);
-    }
-
     me->suffix_cache = cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
                                     NULL, NULL);
     if (me->suffix_cache == NULL) {
@@ -1032,25 +1552,18 @@ void log_event_process(int fd, short which, void*arg) {
 	LIBEVENT_LOG_THREAD *me = arg;
 	LQ_ITEM *lq_item;
 	item *item_p;
-	char buf[1];
 	char snapshot_before_path[512];
 	//unsigned int log_size = 0;
 
-	if (read(fd, buf, 1) != 1) {
-		fprintf(stderr, "Can't read from libevent pipe\n");
-	}
+	/* One wakeup covers everything queued since the last one */
+	notify_drain(fd);
 
-	switch(buf[0]) {
+	while ((lq_item = lq_pop(me->new_log_queue)) != NULL) {
+		switch(lq_item->type) {
 		case 'l': // log
-			lq_item = lq_pop(me->new_log_queue);
-
 			if (NULL == me->log_fd) {
 				fprintf(stderr, "thread log fd is null %d\n", me->slab_no);
-				return ;
-			}
-
-			if (NULL == lq_item) {
-				return ;
+				break;
 			}
 //			fprintf(stderr, "thread %d\n", me->slab_no);
 
@@ -1059,13 +1572,13 @@ void log_event_process(int fd, short which, void*arg) {
 			fwrite(item_p, ITEM_ntotal(item_p), 1, me->log_fd);
 //			pthread_mutex_unlock(&me->log_file_lock);
 			fflush(me->log_fd);
-			lqi_free(lq_item);
 			break;
 		case 's': //snapshot
 			sprintf(snapshot_before_path, "%s.snapshot_before", me->log_filepath);	
 //			fprintf(stderr, "snapshot thread %d:%s\n", me->slab_no, snapshot_before_path);
 //			pthread_mutex_lock(&me->log_file_lock);
-			fclose(me->log_fd);
+			if (me->log_fd != NULL)
+				fclose(me->log_fd);
 			rename(me->log_filepath, snapshot_before_path);
 			me->log_fd = fopen(me->log_filepath, "ab+");
 //			pthread_mutex_unlock(&me->log_file_lock);
@@ -1077,8 +1590,28 @@ void log_event_process(int fd, short which, void*arg) {
 			unlink(snapshot_before_path);
 //			pthread_mutex_unlock(&me->log_file_lock);
 			break;
+		}
+		lqi_free(lq_item);
+	}
+}
+
+/* Queue a snapshot marker behind the log records already waiting */
+static void notify_log_threads(char type) {
+	LQ_ITEM *marker;
+	int i;
+
+	for (i=0; i<stats.slabs_num; i++) {
+		if ((marker = lqi_new()) == NULL) {
+			fprintf(stderr, "Can't allocate snapshot marker\n");
+			continue;
+		}
+		marker->type = type;
+		marker->item = NULL;
+		if (lq_push(log_threads[i].new_log_queue, marker) &&
+		    !notify_send(log_threads[i].notify_send_fd)) {
+			perror("Writing to thread notify pipe");
+		}
 	}
-			
 }
 
 void snapshot_thread_init(void) {
@@ -1113,9 +1646,6 @@ void *snapshot_libevent(void *arg) {
 }
 
 void snapshot_process(int fd, short n, void *arg) {
-	char buf[1];
-	int i = 0;
-
 
 	if (begin_recover == 0 && stats.changes_after_last_snapshot >= settings.change_num_need_snapshop) {
 		STATS_LOCK();
@@ -1124,20 +1654,11 @@ void snapshot_process(int fd, short n, void *arg) {
 		
 		// ʼsnapshotlog̣ԭlog
 		// µlogµļ
-		buf[0] = 's';
-		
-		for (i=0; i<stats.slabs_num; i++) {
-			write(log_threads[i].notify_send_fd, buf, 1);
-		}
+		notify_log_threads('s');
 
 		snapshot_all_slab();
 
-		buf[0] = 'd';
-		for (i=0; i<stats.slabs_num; i++) {
-			write(log_threads[i].notify_send_fd, buf, 1);
-		}
-
-		
+		notify_log_threads('d');
 	}
 
 	event_add(&snapshot_ev_timer, &snapshot_tv);
@@ -1148,7 +1669,8 @@ void notify_log(item *vitem) {
 	int   item_ntotal = ITEM_ntotal(vitem);
 	item *copy_item = NULL;
 
-	if (begin_recover) {
+	/* Chunked items are not persisted */
+	if (begin_recover || (vitem->it_flags & ITEM_CHUNKED)) {
 		return;
 	}
 	copy_item = calloc(item_ntotal, sizeof(int));
@@ -1159,11 +1681,14 @@ void notify_log(item *vitem) {
 	 */
 	unsigned int id = slabs_clsid(item_ntotal);
 	LQ_ITEM *log_item = lqi_new();
+	if (log_item == NULL) {
+		free(copy_item);
+		return;
+	}
+	log_item->type = 'l';
 	log_item->item = copy_item;
-	lq_push(log_threads[id].new_log_queue, log_item);
-	char buf[1];
-	buf[0] = 'l';
-	if (write(log_threads[id].notify_send_fd, buf, 1) != 1) {
+	if (lq_push(log_threads[id].new_log_queue, log_item) &&
+	    !notify_send(log_threads[id].notify_send_fd)) {
         perror("Writing to thread notify pipe");
     }
 	stats.changes_after_last_snapshot++;
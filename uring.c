@@ -0,0 +1,247 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Worker thread io_uring. See uring.h.
+ */
+#include "config.h"
+#include "uring.h"
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* user_data of the ring's own requests, whose completions nobody wants */
+#define URING_INTERNAL 0
+/* the one group of provided buffers */
+#define URING_BGID 1
+
+struct uring {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_flags;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_queued;     /* filled in since the last submit */
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    char *bufs;                 /* what the kernel reads into */
+    int nbufs;
+    int buf_size;
+    int ret_start;              /* a run of used buffers to give back */
+    int ret_count;
+};
+
+/*
+ * The kernel only looks at the submission queue inside io_uring_enter(),
+ * so the entries can be filled in after the tail moves, as long as it's
+ * before the next call. Asking for events with a minimum of none also
+ * brings in any completions that overflowed the queue.
+ */
+static int uring_enter(struct uring *r, unsigned int min_complete) {
+    int n;
+
+    if (r->sq_queued == 0 && min_complete == 0 &&
+        !(__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+        return 0;
+    n = syscall(__NR_io_uring_enter, r->fd, r->sq_queued, min_complete,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n < 0)
+        return -1;
+    r->sq_queued -= n;
+    return n;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r, uint8_t opcode,
+                                          int fd, void *data) {
+    unsigned int tail = *r->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+        /* full; hand the kernel what's there to make room */
+        if (uring_enter(r, 0) <= 0)
+            return NULL;
+    }
+    sqe = &r->sqes[tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)data;
+    r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->sq_queued++;
+    return sqe;
+}
+
+static bool uring_provide(struct uring *r, int start, int count) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, IORING_OP_PROVIDE_BUFFERS,
+                                             count, URING_INTERNAL);
+    if (sqe == NULL)
+        return false;
+    sqe->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)start * r->buf_size);
+    sqe->len = r->buf_size;
+    sqe->off = start;
+    sqe->buf_group = URING_BGID;
+    return true;
+}
+
+/* Buffers mostly come back in the order they were taken, so runs of them
+ * go back to the kernel with one request. */
+static void uring_return_bufs(struct uring *r) {
+    if (r->ret_count > 0 && uring_provide(r, r->ret_start, r->ret_count))
+        r->ret_count = 0;
+}
+
+static void uring_return_buf(struct uring *r, int bid) {
+    if (r->ret_count > 0 && bid == r->ret_start + r->ret_count) {
+        r->ret_count++;
+        return;
+    }
+    uring_return_bufs(r);
+    /* if that failed the old run is lost, and reads fall back to polling
+     * once the rest run out */
+    r->ret_start = bid;
+    r->ret_count = 1;
+}
+
+static void uring_free(struct uring *r) {
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+        munmap(r->cq_ring, r->cq_ring_len);
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_len);
+    close(r->fd);
+    free(r->bufs);
+    free(r);
+}
+
+struct uring *uring_new(unsigned int entries, int nbufs, int buf_size) {
+    struct io_uring_params p;
+    struct uring *r;
+    char *sq, *cq;
+
+    if ((r = calloc(1, sizeof(struct uring))) == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
+
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    r->bufs = malloc((size_t)nbufs * buf_size);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED ||
+        r->sqes == MAP_FAILED || r->bufs == NULL) {
+        uring_free(r);
+        return NULL;
+    }
+
+    sq = r->sq_ring;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_flags = (unsigned int *)(sq + p.sq_off.flags);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    cq = r->cq_ring;
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->nbufs = nbufs;
+    r->buf_size = buf_size;
+
+    /* Older kernels take the ring but not provided buffers */
+    if (!uring_provide(r, 0, nbufs) || uring_enter(r, 1) != 1 ||
+        r->cqes[*r->cq_head & r->cq_mask].res < 0) {
+        uring_free(r);
+        return NULL;
+    }
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+    return r;
+}
+
+int uring_fd(const struct uring *r) {
+    return r->fd;
+}
+
+bool uring_recv(struct uring *r, int fd, void *data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, IORING_OP_RECV, fd, data);
+    if (sqe == NULL)
+        return false;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->len = r->buf_size;
+    return true;
+}
+
+bool uring_sendmsg(struct uring *r, int fd, const struct msghdr *m,
+                   void *data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, IORING_OP_SENDMSG, fd, data);
+    if (sqe == NULL)
+        return false;
+    sqe->addr = (uint64_t)(uintptr_t)m;
+    sqe->len = 1;
+    return true;
+}
+
+bool uring_poll(struct uring *r, int fd, short events, void *data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, IORING_OP_POLL_ADD, fd, data);
+    if (sqe == NULL)
+        return false;
+    sqe->poll_events = events;
+    return true;
+}
+
+int uring_submit(struct uring *r) {
+    uring_return_bufs(r);
+    return uring_enter(r, 0);
+}
+
+int uring_reap(struct uring *r, uring_cb cb) {
+    unsigned int head = *r->cq_head;
+    unsigned int tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        int bid = -1;
+
+        /* free the slot before the callback, which may queue more */
+        __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+        if (data == URING_INTERNAL)
+            continue;
+        if (flags & IORING_CQE_F_BUFFER)
+            bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        cb((void *)(uintptr_t)data, res,
+           bid >= 0 ? r->bufs + (size_t)bid * r->buf_size : NULL);
+        if (bid >= 0)
+            uring_return_buf(r, bid);
+        n++;
+    }
+    return n;
+}
+#endif
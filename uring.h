@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef URING_H
+#define URING_H
+
+/*
+ * A small io_uring for the worker threads, driven through the raw system
+ * calls. Reads land in buffers the ring hands the kernel up front, so a
+ * connection waiting for a request pins no memory of its own. Reads, sends
+ * and polls are queued as they come up and reach the kernel together on
+ * the next uring_submit(); uring_reap() hands back what has finished.
+ */
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_PROVIDE_BUFFERS
+#define USE_IO_URING 1
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+struct uring;
+
+/* Called for each finished request. buf holds what a read brought in. */
+typedef void (*uring_cb)(void *data, int res, const char *buf);
+
+/* Returns NULL if the kernel can't give us a ring with provided buffers */
+struct uring *uring_new(unsigned int entries, int nbufs, int buf_size);
+int uring_fd(const struct uring *r);
+
+/* Queue a request. data is passed to the callback when it finishes. */
+bool uring_recv(struct uring *r, int fd, void *data);
+bool uring_sendmsg(struct uring *r, int fd, const struct msghdr *m,
+                   void *data);
+bool uring_poll(struct uring *r, int fd, short events, void *data);
+
+/* Hands the queued requests to the kernel. Returns how many it took. */
+int uring_submit(struct uring *r);
+/* Calls cb for every completion waiting in the ring. Returns the count. */
+int uring_reap(struct uring *r, uring_cb cb);
+
+#endif
+#endif
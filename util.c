@@ -5,6 +5,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sched.h>
+#endif
 
 #include "memcached.h"
 
@@ -99,6 +105,40 @@ bool safe_strtol(const char *str, int32_t *out) {
     return false;
 }
 
+int parse_cpu_list(const char *str, int *cpus, int max) {
+    const char *p = str;
+    int n = 0;
+
+    if (str == NULL)
+        return -1;
+    for (;;) {
+        char *end;
+        long first, last, cpu;
+
+        if (!isdigit((unsigned char)*p))
+            return -1;
+        first = last = strtol(p, &end, 10);
+        if (*end == '-') {
+            p = end + 1;
+            if (!isdigit((unsigned char)*p))
+                return -1;
+            last = strtol(p, &end, 10);
+        }
+        if (first > last || last >= CPU_LIST_MAX)
+            return -1;
+        for (cpu = first; cpu <= last; cpu++) {
+            if (n == max)
+                return -1;
+            cpus[n++] = (int)cpu;
+        }
+        if (*end == '\0')
+            return n;
+        if (*end != ':')
+            return -1;
+        p = end + 1;
+    }
+}
+
 void vperror(const char *fmt, ...) {
     int old_errno = errno;
     char buf[1024];
@@ -115,6 +155,253 @@ void vperror(const char *fmt, ...) {
     perror(buf);
 }
 
+void *mem_map_large(size_t size) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    void *ptr;
+#ifdef MAP_HUGETLB
+    /* Explicit huge pages only exist if the admin reserved some */
+    size_t huge = (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    ptr = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+#endif
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    mem_advise_large(ptr, size);
+    return ptr;
+#else
+    return malloc(size);
+#endif
+}
+
+void mem_advise_large(void *ptr, size_t size) {
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    uintptr_t start = ((uintptr_t)ptr + LARGE_PAGE_SIZE - 1)
+        & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+    if (end > start)
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+void *mem_map(size_t size) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+#else
+    return calloc(1, size);
+#endif
+}
+
+void mem_unmap(void *ptr, size_t size) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    munmap(ptr, size);
+#else
+    (void)size;
+    free(ptr);
+#endif
+}
+
+#if defined(__linux__) && defined(SYS_mbind)
+/* MPOL_* from <numaif.h>, which needs libnuma */
+#define MPOL_PREFERRED_MODE 1
+#define MPOL_INTERLEAVE_MODE 3
+#define NODE_MASK_BITS 1024
+#define MASK_WORD_BITS (8 * sizeof(unsigned long))
+
+/*
+ * Reads a sysfs list of ranges, like "0-1,3", into a mask of NODE_MASK_BITS.
+ * Returns the highest number listed plus one, or 0 if there is none.
+ */
+static int read_sysfs_list(const char *path, unsigned long *mask) {
+    char buf[1024];
+    char *p = buf;
+    int top = 0;
+    FILE *fp;
+
+    memset(mask, 0, NODE_MASK_BITS / 8);
+    if ((fp = fopen(path, "r")) == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), fp) == NULL) {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    while (*p >= '0' && *p <= '9') {
+        unsigned long lo = strtoul(p, &p, 10);
+        unsigned long hi = lo;
+        if (*p == '-')
+            hi = strtoul(p + 1, &p, 10);
+        for (; lo <= hi && lo < NODE_MASK_BITS; lo++) {
+            mask[lo / MASK_WORD_BITS] |= 1UL << (lo % MASK_WORD_BITS);
+            top = lo + 1;
+        }
+        if (*p == ',')
+            p++;
+    }
+    return top;
+}
+
+/* mbind() works on whole pages, so the start is rounded down to one */
+static bool mem_policy(void *ptr, size_t size, int mode,
+                       const unsigned long *mask) {
+    uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(pagesize - 1);
+
+    return syscall(SYS_mbind, start, size + ((uintptr_t)ptr - start),
+                   mode, mask, NODE_MASK_BITS, 0) == 0;
+}
+#endif
+
+bool mem_interleave(void *ptr, size_t size) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[NODE_MASK_BITS / MASK_WORD_BITS];
+
+    if (read_sysfs_list("/sys/devices/system/node/online", mask) == 0)
+        return false;
+    return mem_policy(ptr, size, MPOL_INTERLEAVE_MODE, mask);
+#else
+    return false;
+#endif
+}
+
+bool mem_prefer_node(void *ptr, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[NODE_MASK_BITS / MASK_WORD_BITS];
+
+    if (node < 0 || node >= NODE_MASK_BITS)
+        return false;
+    memset(mask, 0, sizeof(mask));
+    mask[node / MASK_WORD_BITS] = 1UL << (node % MASK_WORD_BITS);
+    return mem_policy(ptr, size, MPOL_PREFERRED_MODE, mask);
+#else
+    return false;
+#endif
+}
+
+int mem_numa_topology(int *node_of_cpu, int max) {
+    int nodes = 1;
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long online[NODE_MASK_BITS / MASK_WORD_BITS];
+    unsigned long cpus[NODE_MASK_BITS / MASK_WORD_BITS];
+    char path[64];
+    int node, cpu;
+#endif
+
+    memset(node_of_cpu, 0, max * sizeof(int));
+#if defined(__linux__) && defined(SYS_mbind)
+    if ((nodes = read_sysfs_list("/sys/devices/system/node/online",
+                                 online)) == 0)
+        return 1;
+    for (node = 0; node < nodes; node++) {
+        if (!(online[node / MASK_WORD_BITS] & (1UL << (node % MASK_WORD_BITS))))
+            continue;
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        read_sysfs_list(path, cpus);
+        for (cpu = 0; cpu < max && cpu < NODE_MASK_BITS; cpu++) {
+            if (cpus[cpu / MASK_WORD_BITS] & (1UL << (cpu % MASK_WORD_BITS)))
+                node_of_cpu[cpu] = node;
+        }
+    }
+#endif
+    return nodes;
+}
+
+/* Each stripe's progress is written by its thread and read by the caller */
+#ifdef __ATOMIC_RELAXED
+#define PREFAULT_DONE_SET(s, v) __atomic_store_n(&(s)->done, (v), __ATOMIC_RELAXED)
+#define PREFAULT_DONE_READ(s) __atomic_load_n(&(s)->done, __ATOMIC_RELAXED)
+#else
+#define PREFAULT_DONE_SET(s, v) ((void)__sync_lock_test_and_set(&(s)->done, (v)))
+#define PREFAULT_DONE_READ(s) __sync_add_and_fetch(&(s)->done, 0)
+#endif
+
+struct prefault_stripe {
+    pthread_t thread;
+    char *start;
+    size_t size;
+    size_t done;
+    int cpu;                /* to run on, or -1 */
+};
+
+static void *prefault_thread(void *arg) {
+    struct prefault_stripe *s = arg;
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t off;
+
+#if defined(__linux__) && defined(CPU_SET)
+    if (s->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s->cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+    for (off = 0; off < s->size; off += pagesize) {
+        ((volatile char *)s->start)[off] = 0;
+        if ((off & (LARGE_PAGE_SIZE - 1)) == 0)
+            PREFAULT_DONE_SET(s, off);
+    }
+    PREFAULT_DONE_SET(s, s->size);
+    return NULL;
+}
+
+void mem_prefault(void *ptr, size_t size, int nthreads, const char *name) {
+    struct prefault_stripe *stripes;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t stripe, done;
+    int i, shown = 0;
+
+    if (nthreads < 1 || size == 0)
+        return;
+    if ((stripes = calloc(nthreads, sizeof(*stripes))) == NULL)
+        return;
+    if (name != NULL)
+        fprintf(stderr, "Prefaulting %.1f MB of %s with %d threads\n",
+                size / (1024.0 * 1024.0), name, nthreads);
+
+    /* Stripes in whole huge pages so no two threads fault the same one */
+    stripe = (size / nthreads + LARGE_PAGE_SIZE - 1) &
+        ~((size_t)LARGE_PAGE_SIZE - 1);
+    for (i = 0; i < nthreads; i++) {
+        size_t off = stripe * i;
+        struct prefault_stripe *s = &stripes[i];
+        s->start = (char *)ptr + off;
+        s->size = off >= size ? 0 : (size - off < stripe ? size - off : stripe);
+        s->cpu = ncpus > 1 ? (int)(i * ncpus / nthreads) : -1;
+        if (pthread_create(&s->thread, NULL, prefault_thread, s) != 0) {
+            s->cpu = -1;
+            prefault_thread(s);
+            s->cpu = -2;    /* nothing to join */
+        }
+    }
+
+    for (;;) {
+        done = 0;
+        for (i = 0; i < nthreads; i++)
+            done += PREFAULT_DONE_READ(&stripes[i]);
+        if (name != NULL && done * 10 / size > (size_t)shown) {
+            shown = done * 10 / size;
+            fprintf(stderr, "Prefaulted %d%% of %s\n", shown * 10, name);
+        }
+        if (done >= size)
+            break;
+        usleep(100000);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        if (stripes[i].cpu != -2)
+            pthread_join(stripes[i].thread, NULL);
+    }
+    free(stripes);
+}
+
 #ifndef HAVE_HTONLL
 static uint64_t mc_swap64(uint64_t in) {
 #ifdef ENDIAN_LITTLE
@@ -12,6 +12,69 @@ bool safe_strtoll(const char *str, int64_t *out);
 bool safe_strtoul(const char *str, uint32_t *out);
 bool safe_strtol(const char *str, int32_t *out);
 
+/* Highest cpu number, plus one, that a cpu list may name */
+#define CPU_LIST_MAX 1024
+
+/*
+ * Parses a colon separated list of cpus and ranges of them, such as
+ * "0-3:8", into cpus in the order given. Returns how many there are, or
+ * -1 if the list is malformed or holds more than max.
+ */
+int parse_cpu_list(const char *str, int *cpus, int max);
+
+/* Huge page size assumed when asking the kernel for large pages */
+#define LARGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Allocates a large region that is never freed, backed by huge pages when
+ * the platform can provide them. Reserved huge pages are used if the system
+ * has any, otherwise transparent huge pages are requested.
+ */
+void *mem_map_large(size_t size);
+
+/* Asks for transparent huge pages over the aligned part of a region */
+void mem_advise_large(void *ptr, size_t size);
+
+/*
+ * Maps a zeroed, page aligned region of its own, so a NUMA policy set on it
+ * can't move neighbouring heap data. Released with mem_unmap().
+ */
+void *mem_map(size_t size);
+void mem_unmap(void *ptr, size_t size);
+
+/*
+ * Spreads the pages of a region evenly over the online NUMA nodes. Must be
+ * called before the region is touched, on memory from mem_map() or
+ * mem_map_large(). Returns false where unsupported.
+ */
+bool mem_interleave(void *ptr, size_t size);
+
+/*
+ * Asks for the pages of a region to come from one NUMA node, falling back
+ * to others when it is full. Same rules as mem_interleave().
+ */
+bool mem_prefer_node(void *ptr, size_t size, int node);
+
+/* Most cpus mem_numa_topology() is asked about, and most nodes the slab
+ * allocator keeps apart */
+#define NUMA_CPUS_MAX 1024
+#define NUMA_NODES_MAX 8
+
+/*
+ * Fills node_of_cpu[0 .. max - 1] with the node each cpu is on, 0 when
+ * unknown, and returns the highest online node plus one. That is 1 where
+ * there is no NUMA information.
+ */
+int mem_numa_topology(int *node_of_cpu, int max);
+
+/*
+ * Faults in every page of a region that isn't in use yet, split in stripes
+ * over nthreads threads spread across the cpus, so first touches land on
+ * every NUMA node. The first byte of each page is cleared. Progress goes
+ * to stderr under the given name unless it is NULL.
+ */
+void mem_prefault(void *ptr, size_t size, int nthreads, const char *name);
+
 #ifndef HAVE_HTONLL
 extern uint64_t htonll(uint64_t);
 extern uint64_t ntohll(uint64_t);